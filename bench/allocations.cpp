@@ -0,0 +1,65 @@
+#include "allocations.h"
+#include <new>
+#include <stdlib.h>
+
+namespace
+{
+    thread_local size_t t_allocations = 0;
+
+    void* allocate(size_t size)
+    {
+        t_allocations++;
+        void* p = malloc(size == 0 ? 1 : size);
+        if (p == NULL) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+}
+
+size_t Bench::allocations()
+{
+    return t_allocations;
+}
+
+void* operator new(size_t size)
+{
+    return allocate(size);
+}
+
+void* operator new[](size_t size)
+{
+    return allocate(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    t_allocations++;
+    return malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    t_allocations++;
+    return malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    free(p);
+}
@@ -0,0 +1,13 @@
+#ifndef IOT_BENCH_ALLOCATIONS_H
+#define IOT_BENCH_ALLOCATIONS_H
+
+#include <stddef.h>
+
+// Global operator new is replaced in the benchmark binary and counts per thread
+namespace Bench
+{
+    // Allocations made by the calling thread so far
+    size_t allocations();
+}
+
+#endif // IOT_BENCH_ALLOCATIONS_H
@@ -0,0 +1,1712 @@
+#include "fakenm.h"
+#include "allocations.h"
+#include "clock.h"
+#include <NetworkManager.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using IoT::Clock;
+
+struct _NMIPAddress
+{
+    std::string address;
+};
+
+namespace
+{
+    // Fake objects keep their state in a node, GObject types only add signals and properties
+    struct Node
+    {
+        virtual ~Node() {}
+        std::string path;
+    };
+
+    struct Instance
+    {
+        GObject parent;
+        Node* node;
+    };
+
+    template<class N>
+    N* node(gpointer object)
+    {
+        Instance* instance = (Instance*)object;
+        if (instance->node == NULL) {
+            instance->node = new N();
+        }
+        return static_cast<N*>(instance->node);
+    }
+
+    template<class T, class N>
+    T* create(GType type)
+    {
+        gpointer object = g_object_new(type, NULL);
+        node<N>(object);
+        return (T*)object;
+    }
+
+    struct ClientNode: Node
+    {
+        guint flags = 0;
+    };
+
+    struct DeviceNode: Node
+    {
+        ~DeviceNode()
+        {
+            g_ptr_array_unref(aps);
+        }
+
+        std::string iface;
+        NMDeviceState state = NM_DEVICE_STATE_DISCONNECTED;
+        // Bumped by every activation and disconnect, steps of a superseded activation are dropped
+        unsigned generation = 0;
+        NMActiveConnection* active = NULL;
+        NMAccessPoint* activeAp = NULL;
+        GPtrArray* aps = NULL;
+        gint64 lastScan = 0;
+    };
+
+    struct AccessPointNode: Node
+    {
+        ~AccessPointNode()
+        {
+            g_bytes_unref(ssid);
+        }
+
+        GBytes* ssid = NULL;
+        std::string bssid;
+        guint8 strength = 0;
+        guint32 frequency = 0;
+        NM80211ApFlags flags = NM_802_11_AP_FLAGS_NONE;
+        NM80211ApSecurityFlags rsn = NM_802_11_AP_SEC_NONE;
+    };
+
+    struct ActiveNode: Node
+    {
+        ~ActiveNode()
+        {
+            g_object_unref(remote);
+            g_object_unref(ip4);
+        }
+
+        NMRemoteConnection* remote = NULL;
+        NMIPConfig* ip4 = NULL;
+    };
+
+    struct IPConfigNode: Node
+    {
+        ~IPConfigNode()
+        {
+            for (guint i = 0; i < addresses->len; i++) {
+                delete (NMIPAddress*)g_ptr_array_index(addresses, i);
+            }
+            g_ptr_array_unref(addresses);
+        }
+
+        GPtrArray* addresses = g_ptr_array_new();
+    };
+
+    struct ConnectionNode: Node
+    {
+        ~ConnectionNode()
+        {
+            for (NMSetting* setting : settings) {
+                g_object_unref(setting);
+            }
+        }
+
+        std::vector<NMSetting*> settings;
+        bool unsaved = false;
+        guint powersave = 0; // As last added or committed
+    };
+
+    struct SettingNode: Node
+    {
+        ~SettingNode()
+        {
+            for (GValue& value : values) {
+                if (value.g_type != 0) {
+                    g_value_unset(&value);
+                }
+            }
+        }
+
+        std::vector<GValue> values;
+    };
+
+    // Property ids of the settings, in installation order
+    enum { ConnectionUUID = 1, ConnectionId, ConnectionType, ConnectionAutoconnect };
+    enum { WirelessSSID = 1, WirelessBSSID, WirelessMode, WirelessBand, WirelessChannel, WirelessPowersave, WirelessHidden };
+    enum { SecurityKeyMgmt = 1, SecurityPSK, SecurityWepTxKeyIdx, SecurityWepKeyType, SecurityWepKey0 };
+    enum { IP4Method = 1 };
+    enum { ClientRunning = 1, ClientInstanceFlags };
+
+    struct Radio
+    {
+        Bench::AccessPoint config;
+        NMAccessPoint* object;
+        bool probed; // Hidden network answered the last targeted scan
+    };
+
+    // NM's side of the bus. Replies and state changes are due after their latency and are
+    // dispatched on GLib's default context, like libnm delivers D-Bus messages
+    class Daemon
+    {
+    public:
+        Daemon()
+        {
+            m_thread = std::thread([this]() { run(); });
+        }
+
+        void after(Clock::Duration delay, std::function<void()> event)
+        {
+            std::lock_guard<std::mutex> lock(m_mx);
+            m_events.insert(std::make_pair(Clock::instance().now() + delay, std::move(event)));
+            m_cv.notify_all();
+        }
+    private:
+        static gboolean dispatch(gpointer data)
+        {
+            std::function<void()>* event = (std::function<void()>*)data;
+            (*event)();
+            delete event;
+            return G_SOURCE_REMOVE;
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(m_mx);
+            while (1) {
+                if (m_events.empty()) {
+                    m_cv.wait(lock);
+                    continue;
+                }
+
+                Clock& clock = Clock::instance();
+                auto next = m_events.begin();
+                if (clock.now() < next->first) {
+                    clock.waitUntil(m_cv, lock, next->first);
+                    continue;
+                }
+
+                // Events due at the same time keep their order, both here and in GLib's idle queue
+                std::function<void()>* event = new std::function<void()>(std::move(next->second));
+                m_events.erase(next);
+                lock.unlock();
+                g_main_context_invoke(NULL, dispatch, event);
+                lock.lock();
+            }
+        }
+
+        std::mutex m_mx;
+        std::condition_variable m_cv;
+        std::multimap<Clock::TimePoint, std::function<void()>> m_events;
+        std::thread m_thread;
+    };
+
+    struct World
+    {
+        World();
+
+        std::string path(const char* kind)
+        {
+            char path[64];
+            snprintf(path, sizeof(path), "/org/freedesktop/NetworkManager/%s/%u", kind, ++objects);
+            return path;
+        }
+
+        Radio* find(const std::string& ssid)
+        {
+            for (Radio& radio : air) {
+                if (radio.config.ssid == ssid) {
+                    return &radio;
+                }
+            }
+            return NULL;
+        }
+
+        Radio* radioOf(NMAccessPoint* ap)
+        {
+            for (Radio& radio : air) {
+                if (radio.object == ap) {
+                    return &radio;
+                }
+            }
+            return NULL;
+        }
+
+        // Guards the object graph, events change it on the GLib context while the library reads it anywhere
+        std::recursive_mutex mx;
+        Bench::Latency latency;
+        std::vector<Radio> air;
+        NMDevice* device;
+        GPtrArray* devices;
+        GObject* client = NULL;
+        bool running = true;
+        GPtrArray* gone; // Devices listed while the daemon is down
+        GPtrArray* connections;
+        bool wireless = true;
+        unsigned objects = 0;
+        std::thread::id tracker;
+        size_t trackerAllocations = 0;
+        size_t reapplies = 0;
+        GDBusConnection* bus = NULL; // Calls are mirrored on it, see Bench::setDBusConnection
+        Daemon daemon;
+    };
+
+    World& world()
+    {
+        // Never destroyed, the daemon thread and the library's threads run until the process exits
+        static World* instance = new World();
+        return *instance;
+    }
+
+    typedef std::lock_guard<std::recursive_mutex> Lock;
+
+    GObjectClass* s_objectParent = NULL;
+
+    void finalize(GObject* object)
+    {
+        delete ((Instance*)object)->node;
+        s_objectParent->finalize(object);
+    }
+
+    void objectClassInit(gpointer klass, gpointer)
+    {
+        s_objectParent = G_OBJECT_CLASS(g_type_class_peek_parent(klass));
+        G_OBJECT_CLASS(klass)->finalize = finalize;
+    }
+
+    GType registerType(GType parent, const char* name, GClassInitFunc init)
+    {
+        return g_type_register_static_simple(parent, g_intern_static_string(name), sizeof(GObjectClass), init,
+                                             sizeof(Instance), NULL, G_TYPE_FLAG_NONE);
+    }
+
+    void clientGetProperty(GObject* object, guint id, GValue* value, GParamSpec*)
+    {
+        if (id == ClientRunning) {
+            g_value_set_boolean(value, nm_client_get_nm_running(NM_CLIENT(object)));
+        } else if (id == ClientInstanceFlags) {
+            g_value_set_uint(value, node<ClientNode>(object)->flags);
+        }
+    }
+
+    void clientSetProperty(GObject* object, guint id, const GValue* value, GParamSpec*)
+    {
+        if (id == ClientInstanceFlags) {
+            node<ClientNode>(object)->flags = g_value_get_uint(value);
+        }
+    }
+
+    void clientClassInit(gpointer klass, gpointer)
+    {
+        GObjectClass* object = G_OBJECT_CLASS(klass);
+        object->get_property = clientGetProperty;
+        object->set_property = clientSetProperty;
+        g_object_class_install_property(object, ClientRunning,
+            g_param_spec_boolean(NM_CLIENT_NM_RUNNING, NULL, NULL, FALSE, (GParamFlags)(G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+        g_object_class_install_property(object, ClientInstanceFlags,
+            g_param_spec_uint(NM_CLIENT_INSTANCE_FLAGS, NULL, NULL, 0, G_MAXUINT, 0, (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+    }
+
+    void clientInitAsync(GAsyncInitable* initable, int, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer data)
+    {
+        World& w = world();
+        {
+            Lock lock(w.mx);
+            node<ClientNode>(initable)->path = "/org/freedesktop/NetworkManager";
+            w.tracker = std::this_thread::get_id();
+            w.client = G_OBJECT(initable);
+        }
+
+        GTask* task = g_task_new(initable, cancellable, callback, data);
+        w.daemon.after(w.latency.call, [task]() {
+            g_task_return_boolean(task, TRUE);
+            g_object_unref(task);
+        });
+    }
+
+    gboolean clientInitFinish(GAsyncInitable*, GAsyncResult* result, GError** error)
+    {
+        return g_task_propagate_boolean(G_TASK(result), error);
+    }
+
+    void asyncInitableInit(gpointer iface, gpointer)
+    {
+        GAsyncInitableIface* initable = (GAsyncInitableIface*)iface;
+        initable->init_async = clientInitAsync;
+        initable->init_finish = clientInitFinish;
+    }
+
+    void deviceClassInit(gpointer klass, gpointer)
+    {
+        g_signal_new("state-changed", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_FIRST, 0, NULL, NULL, NULL,
+                     G_TYPE_NONE, 3, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT);
+    }
+
+    void deviceWifiGetProperty(GObject* object, guint, GValue* value, GParamSpec*)
+    {
+        Lock lock(world().mx);
+        g_value_set_int64(value, node<DeviceNode>(object)->lastScan);
+    }
+
+    void deviceWifiClassInit(gpointer klass, gpointer)
+    {
+        GObjectClass* object = G_OBJECT_CLASS(klass);
+        object->get_property = deviceWifiGetProperty;
+        g_object_class_install_property(object, 1,
+            g_param_spec_int64(NM_DEVICE_WIFI_LAST_SCAN, NULL, NULL, -1, INT64_MAX, 0, (GParamFlags)(G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+    }
+
+    struct PropertySpec
+    {
+        const char* name;
+        GType type;
+    };
+
+    void settingGetProperty(GObject* object, guint id, GValue* value, GParamSpec* spec)
+    {
+        std::vector<GValue>& values = node<SettingNode>(object)->values;
+        if (id <= values.size() && values[id - 1].g_type != 0) {
+            g_value_copy(&values[id - 1], value);
+        } else {
+            g_param_value_set_default(spec, value);
+        }
+    }
+
+    void settingSetProperty(GObject* object, guint id, const GValue* value, GParamSpec* spec)
+    {
+        std::vector<GValue>& values = node<SettingNode>(object)->values;
+        if (values.size() < id) {
+            GValue unset = G_VALUE_INIT;
+            values.resize(id, unset);
+        }
+        GValue& stored = values[id - 1];
+        if (stored.g_type != 0) {
+            g_value_unset(&stored);
+        }
+        g_value_init(&stored, G_PARAM_SPEC_VALUE_TYPE(spec));
+        g_value_copy(value, &stored);
+    }
+
+    void installProperties(gpointer klass, const PropertySpec* specs, size_t count)
+    {
+        GObjectClass* object = G_OBJECT_CLASS(klass);
+        object->get_property = settingGetProperty;
+        object->set_property = settingSetProperty;
+        GParamFlags flags = (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+        for (size_t i = 0; i < count; i++) {
+            const PropertySpec& spec = specs[i];
+            GParamSpec* param;
+            if (spec.type == G_TYPE_STRING) {
+                param = g_param_spec_string(spec.name, NULL, NULL, NULL, flags);
+            } else if (spec.type == G_TYPE_UINT) {
+                param = g_param_spec_uint(spec.name, NULL, NULL, 0, G_MAXUINT, 0, flags);
+            } else if (spec.type == G_TYPE_BOOLEAN) {
+                param = g_param_spec_boolean(spec.name, NULL, NULL, FALSE, flags);
+            } else {
+                param = g_param_spec_boxed(spec.name, NULL, NULL, spec.type, flags);
+            }
+            g_object_class_install_property(object, i + 1, param);
+        }
+    }
+
+    void connectionSettingClassInit(gpointer klass, gpointer)
+    {
+        const PropertySpec specs[] = {
+            { NM_SETTING_CONNECTION_UUID, G_TYPE_STRING },
+            { NM_SETTING_CONNECTION_ID, G_TYPE_STRING },
+            { NM_SETTING_CONNECTION_TYPE, G_TYPE_STRING },
+            { NM_SETTING_CONNECTION_AUTOCONNECT, G_TYPE_BOOLEAN },
+        };
+        installProperties(klass, specs, sizeof(specs) / sizeof(specs[0]));
+    }
+
+    void wirelessSettingClassInit(gpointer klass, gpointer)
+    {
+        const PropertySpec specs[] = {
+            { NM_SETTING_WIRELESS_SSID, G_TYPE_BYTES },
+            { NM_SETTING_WIRELESS_BSSID, G_TYPE_STRING },
+            { NM_SETTING_WIRELESS_MODE, G_TYPE_STRING },
+            { NM_SETTING_WIRELESS_BAND, G_TYPE_STRING },
+            { NM_SETTING_WIRELESS_CHANNEL, G_TYPE_UINT },
+            { NM_SETTING_WIRELESS_POWERSAVE, G_TYPE_UINT },
+            { NM_SETTING_WIRELESS_HIDDEN, G_TYPE_BOOLEAN },
+        };
+        installProperties(klass, specs, sizeof(specs) / sizeof(specs[0]));
+    }
+
+    void securitySettingClassInit(gpointer klass, gpointer)
+    {
+        const PropertySpec specs[] = {
+            { NM_SETTING_WIRELESS_SECURITY_KEY_MGMT, G_TYPE_STRING },
+            { NM_SETTING_WIRELESS_SECURITY_PSK, G_TYPE_STRING },
+            { NM_SETTING_WIRELESS_SECURITY_WEP_TX_KEYIDX, G_TYPE_UINT },
+            { NM_SETTING_WIRELESS_SECURITY_WEP_KEY_TYPE, G_TYPE_UINT },
+            { NM_SETTING_WIRELESS_SECURITY_WEP_KEY0, G_TYPE_STRING },
+        };
+        installProperties(klass, specs, sizeof(specs) / sizeof(specs[0]));
+    }
+
+    void ip4SettingClassInit(gpointer klass, gpointer)
+    {
+        const PropertySpec specs[] = {
+            { NM_SETTING_IP_CONFIG_METHOD, G_TYPE_STRING },
+        };
+        installProperties(klass, specs, sizeof(specs) / sizeof(specs[0]));
+    }
+
+    const GValue* settingValue(gpointer setting, guint id)
+    {
+        if (setting == NULL) {
+            return NULL;
+        }
+        std::vector<GValue>& values = node<SettingNode>(setting)->values;
+        return id <= values.size() && values[id - 1].g_type != 0 ? &values[id - 1] : NULL;
+    }
+
+    const char* stringOf(gpointer setting, guint id)
+    {
+        const GValue* value = settingValue(setting, id);
+        return value == NULL ? NULL : g_value_get_string(value);
+    }
+
+    NMSetting* settingOf(NMConnection* connection, GType type)
+    {
+        for (NMSetting* setting : node<ConnectionNode>(connection)->settings) {
+            if (G_OBJECT_TYPE(setting) == type) {
+                return setting;
+            }
+        }
+        return NULL;
+    }
+
+    guint powersaveOf(ConnectionNode* connection)
+    {
+        for (NMSetting* setting : connection->settings) {
+            if (G_OBJECT_TYPE(setting) == NM_TYPE_SETTING_WIRELESS) {
+                const GValue* value = settingValue(setting, WirelessPowersave);
+                return value == NULL ? 0 : g_value_get_uint(value);
+            }
+        }
+        return 0;
+    }
+
+    std::string ssidOf(GBytes* ssid)
+    {
+        if (ssid == NULL) {
+            return std::string();
+        }
+        gsize size = 0;
+        const char* data = (const char*)g_bytes_get_data(ssid, &size);
+        return std::string(data, size);
+    }
+
+    bool isHotspot(NMConnection* connection)
+    {
+        const char* mode = stringOf(settingOf(connection, NM_TYPE_SETTING_WIRELESS), WirelessMode);
+        return mode != NULL && strcmp(mode, NM_SETTING_WIRELESS_MODE_AP) == 0;
+    }
+
+    bool listed(NMDevice* device, NMAccessPoint* ap)
+    {
+        GPtrArray* aps = node<DeviceNode>(device)->aps;
+        for (guint i = 0; i < aps->len; i++) {
+            if (g_ptr_array_index(aps, i) == ap) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool current(NMDevice* device, unsigned generation)
+    {
+        Lock lock(world().mx);
+        return node<DeviceNode>(device)->generation == generation;
+    }
+
+    void changeState(NMDevice* device, NMDeviceState state, NMDeviceStateReason reason)
+    {
+        guint old;
+        {
+            Lock lock(world().mx);
+            DeviceNode* d = node<DeviceNode>(device);
+            old = d->state;
+            if (old == (guint)state) {
+                return;
+            }
+            d->state = state;
+        }
+        g_signal_emit_by_name(device, "state-changed", (guint)state, old, (guint)reason);
+    }
+
+    // Replaced objects are never released, the library may still hold borrowed pointers to them
+    void dropLink(NMDevice* device, NMDeviceStateReason reason)
+    {
+        NMDeviceState state;
+        {
+            Lock lock(world().mx);
+            DeviceNode* d = node<DeviceNode>(device);
+            d->generation++;
+            d->active = NULL;
+            d->activeAp = NULL;
+            state = d->state;
+        }
+        if (state >= NM_DEVICE_STATE_PREPARE && state <= NM_DEVICE_STATE_ACTIVATED) {
+            changeState(device, NM_DEVICE_STATE_DEACTIVATING, reason);
+            changeState(device, NM_DEVICE_STATE_DISCONNECTED, reason);
+        } else if (state == NM_DEVICE_STATE_FAILED) {
+            changeState(device, NM_DEVICE_STATE_DISCONNECTED, reason);
+        }
+    }
+
+    NMActiveConnection* newActive(NMRemoteConnection* remote)
+    {
+        World& w = world();
+        NMActiveConnection* active = create<NMActiveConnection, ActiveNode>(NM_TYPE_ACTIVE_CONNECTION);
+        ActiveNode* a = node<ActiveNode>(active);
+        a->path = w.path("ActiveConnection");
+        a->remote = (NMRemoteConnection*)g_object_ref(remote);
+        a->ip4 = create<NMIPConfig, IPConfigNode>(NM_TYPE_IP_CONFIG);
+        node<IPConfigNode>(a->ip4)->path = w.path("IP4Config");
+        return active;
+    }
+
+    void setAddress(NMActiveConnection* active, const char* address)
+    {
+        Lock lock(world().mx);
+        NMIPConfig* ip4 = node<ActiveNode>(active)->ip4;
+        g_ptr_array_add(node<IPConfigNode>(ip4)->addresses, new NMIPAddress { address });
+    }
+
+    void associate(NMDevice* device, NMActiveConnection* active, unsigned generation, const std::string& ssid,
+                   const std::string& bssid, const std::string& psk, bool hidden)
+    {
+        World& w = world();
+        Radio* radio;
+        bool reachable;
+        {
+            Lock lock(w.mx);
+            radio = w.find(ssid);
+            // Hidden network answers probes only when the profile says it is hidden, or it was just probed
+            reachable = radio != NULL && radio->config.inRange && (bssid.empty() || node<AccessPointNode>(radio->object)->bssid == bssid) &&
+                        (!radio->config.hidden || hidden || listed(device, radio->object));
+        }
+
+        if (!reachable) {
+            w.daemon.after(w.latency.associate, [device, generation]() {
+                if (!current(device, generation)) {
+                    return;
+                }
+                {
+                    Lock lock(world().mx);
+                    DeviceNode* d = node<DeviceNode>(device);
+                    d->generation++;
+                    d->active = NULL;
+                }
+                changeState(device, NM_DEVICE_STATE_FAILED, NM_DEVICE_STATE_REASON_SSID_NOT_FOUND);
+                changeState(device, NM_DEVICE_STATE_DISCONNECTED, NM_DEVICE_STATE_REASON_SSID_NOT_FOUND);
+            });
+            return;
+        }
+
+        if (radio->config.password != psk) {
+            // Supplicant keeps retrying the handshake until NM gives up and asks for new secrets
+            w.daemon.after(w.latency.authFailure, [device, generation]() {
+                if (current(device, generation)) {
+                    changeState(device, NM_DEVICE_STATE_NEED_AUTH, NM_DEVICE_STATE_REASON_SUPPLICANT_DISCONNECT);
+                }
+            });
+            return;
+        }
+
+        NMAccessPoint* ap = radio->object;
+        w.daemon.after(w.latency.associate, [device, generation, ap]() {
+            if (!current(device, generation)) {
+                return;
+            }
+            {
+                Lock lock(world().mx);
+                node<DeviceNode>(device)->activeAp = ap;
+            }
+            changeState(device, NM_DEVICE_STATE_IP_CONFIG, NM_DEVICE_STATE_REASON_NONE);
+        });
+        w.daemon.after(w.latency.associate + w.latency.dhcp, [device, generation, active]() {
+            if (!current(device, generation)) {
+                return;
+            }
+            setAddress(active, "192.168.1.100");
+            changeState(device, NM_DEVICE_STATE_ACTIVATED, NM_DEVICE_STATE_REASON_NONE);
+        });
+    }
+
+    // Runs once NM accepted the request, the active connection is returned before the link is up
+    void activate(NMDevice* device, NMRemoteConnection* remote, GTask* task)
+    {
+        World& w = world();
+        dropLink(device, NM_DEVICE_STATE_REASON_NEW_ACTIVATION);
+
+        NMActiveConnection* active;
+        unsigned generation;
+        bool hotspot;
+        std::string ssid, bssid, psk;
+        bool hidden;
+        {
+            Lock lock(w.mx);
+            active = newActive(remote);
+            DeviceNode* d = node<DeviceNode>(device);
+            generation = ++d->generation;
+            d->active = active;
+
+            NMConnection* connection = NM_CONNECTION(remote);
+            NMSetting* wireless = settingOf(connection, NM_TYPE_SETTING_WIRELESS);
+            const GValue* ssidValue = settingValue(wireless, WirelessSSID);
+            ssid = ssidOf(ssidValue == NULL ? NULL : (GBytes*)g_value_get_boxed(ssidValue));
+            const char* pinned = stringOf(wireless, WirelessBSSID);
+            bssid = pinned == NULL ? "" : pinned;
+            const GValue* hiddenValue = settingValue(wireless, WirelessHidden);
+            hidden = hiddenValue != NULL && g_value_get_boolean(hiddenValue);
+            const char* key = stringOf(settingOf(connection, NM_TYPE_SETTING_WIRELESS_SECURITY), SecurityPSK);
+            psk = key == NULL ? "" : key;
+            hotspot = isHotspot(connection);
+        }
+
+        changeState(device, NM_DEVICE_STATE_PREPARE, NM_DEVICE_STATE_REASON_NONE);
+        g_task_return_pointer(task, g_object_ref(active), g_object_unref);
+        g_object_unref(task);
+        changeState(device, NM_DEVICE_STATE_CONFIG, NM_DEVICE_STATE_REASON_NONE);
+
+        if (hotspot) {
+            w.daemon.after(w.latency.apStart, [device, generation, active]() {
+                if (!current(device, generation)) {
+                    return;
+                }
+                setAddress(active, "10.42.0.1");
+                changeState(device, NM_DEVICE_STATE_IP_CONFIG, NM_DEVICE_STATE_REASON_NONE);
+                changeState(device, NM_DEVICE_STATE_ACTIVATED, NM_DEVICE_STATE_REASON_NONE);
+            });
+            return;
+        }
+
+        associate(device, active, generation, ssid, bssid, psk, hidden);
+    }
+
+    bool inHotspotMode(NMDevice* device)
+    {
+        Lock lock(world().mx);
+        DeviceNode* d = node<DeviceNode>(device);
+        return d->active != NULL && isHotspot(NM_CONNECTION(node<ActiveNode>(d->active)->remote));
+    }
+
+    // Full scans list every beaconing network in range, hidden ones show up only while probed for
+    void publishScan(NMDevice* device, const std::vector<std::string>& probed)
+    {
+        World& w = world();
+        {
+            Lock lock(w.mx);
+            GPtrArray* aps = g_ptr_array_new_with_free_func(g_object_unref);
+            for (Radio& radio : w.air) {
+                if (radio.config.hidden) {
+                    radio.probed = std::find(probed.begin(), probed.end(), radio.config.ssid) != probed.end();
+                }
+                if (radio.config.inRange && (!radio.config.hidden || radio.probed)) {
+                    g_ptr_array_add(aps, g_object_ref(radio.object));
+                }
+            }
+            DeviceNode* d = node<DeviceNode>(device);
+            d->aps = aps;
+            d->lastScan = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::instance().now().time_since_epoch()).count();
+        }
+        g_object_notify(G_OBJECT(device), NM_DEVICE_WIFI_LAST_SCAN);
+    }
+
+    std::vector<std::string> ssidsOf(GVariant* options)
+    {
+        std::vector<std::string> ssids;
+        if (options == NULL) {
+            return ssids;
+        }
+        GVariant* list = g_variant_lookup_value(options, "ssids", G_VARIANT_TYPE_BYTESTRING_ARRAY);
+        if (list != NULL) {
+            for (gsize i = 0; i < g_variant_n_children(list); i++) {
+                GVariant* ssid = g_variant_get_child_value(list, i);
+                gsize size = 0;
+                const char* data = (const char*)g_variant_get_fixed_array(ssid, &size, 1);
+                ssids.push_back(std::string(data, size));
+                g_variant_unref(ssid);
+            }
+            g_variant_unref(list);
+        }
+        return ssids;
+    }
+
+    NMRemoteConnection* addRemote(NMConnection* partial, bool unsaved)
+    {
+        World& w = world();
+        Lock lock(w.mx);
+        NMRemoteConnection* remote = create<NMRemoteConnection, ConnectionNode>(NM_TYPE_REMOTE_CONNECTION);
+        ConnectionNode* c = node<ConnectionNode>(remote);
+        c->path = w.path("Settings");
+        c->unsaved = unsaved;
+        for (NMSetting* setting : node<ConnectionNode>(partial)->settings) {
+            c->settings.push_back((NMSetting*)g_object_ref(setting));
+        }
+        c->powersave = powersaveOf(c);
+        g_ptr_array_add(w.connections, remote);
+        return remote;
+    }
+
+    // Sends the call over the test's bus and waits for the peer's reply, so it is seen like libnm's own traffic
+    void mirror(const char* method)
+    {
+        GDBusConnection* bus = NULL;
+        {
+            World& w = world();
+            Lock lock(w.mx);
+            if (w.bus != NULL) {
+                bus = (GDBusConnection*)g_object_ref(w.bus);
+            }
+        }
+        if (bus == NULL) {
+            return;
+        }
+
+        GDBusMessage* call = g_dbus_message_new_method_call(NULL, "/org/freedesktop/NetworkManager",
+                                                            "org.freedesktop.NetworkManager", method);
+        GDBusMessage* reply = g_dbus_connection_send_message_with_reply_sync(bus, call, G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                                                             -1, NULL, NULL, NULL);
+        if (reply != NULL) {
+            g_object_unref(reply);
+        }
+        g_object_unref(call);
+        g_object_unref(bus);
+    }
+
+    void returnTrue(gpointer source, const char* method, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer data,
+                    std::function<void()> effect)
+    {
+        mirror(method);
+        GTask* task = g_task_new(source, cancellable, callback, data);
+        World& w = world();
+        w.daemon.after(w.latency.call, [task, effect]() {
+            effect();
+            g_task_return_boolean(task, TRUE);
+            g_object_unref(task);
+        });
+    }
+
+    thread_local bool t_inPass = false;
+    thread_local size_t t_passStarted = 0;
+
+    World::World()
+    {
+        device = create<NMDevice, DeviceNode>(NM_TYPE_DEVICE_WIFI);
+        DeviceNode* d = node<DeviceNode>(device);
+        d->path = path("Devices");
+        d->iface = "wlan0";
+        d->aps = g_ptr_array_new_with_free_func(g_object_unref);
+        devices = g_ptr_array_new_with_free_func(g_object_unref);
+        g_ptr_array_add(devices, device);
+        gone = g_ptr_array_new();
+        connections = g_ptr_array_new_with_free_func(g_object_unref);
+    }
+}
+
+extern "C" {
+
+GType nm_object_get_type(void)
+{
+    static GType type = registerType(G_TYPE_OBJECT, "NMObject", objectClassInit);
+    return type;
+}
+
+GType nm_client_get_type(void)
+{
+    static GType type = []() {
+        GType type = registerType(NM_TYPE_OBJECT, "NMClient", clientClassInit);
+        GInterfaceInfo initable = { asyncInitableInit, NULL, NULL };
+        g_type_add_interface_static(type, G_TYPE_ASYNC_INITABLE, &initable);
+        return type;
+    }();
+    return type;
+}
+
+GType nm_device_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_OBJECT, "NMDevice", deviceClassInit);
+    return type;
+}
+
+GType nm_device_wifi_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_DEVICE, "NMDeviceWifi", deviceWifiClassInit);
+    return type;
+}
+
+GType nm_access_point_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_OBJECT, "NMAccessPoint", NULL);
+    return type;
+}
+
+GType nm_active_connection_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_OBJECT, "NMActiveConnection", NULL);
+    return type;
+}
+
+GType nm_ip_config_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_OBJECT, "NMIPConfig", NULL);
+    return type;
+}
+
+GType nm_connection_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_OBJECT, "NMConnection", NULL);
+    return type;
+}
+
+GType nm_simple_connection_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_CONNECTION, "NMSimpleConnection", NULL);
+    return type;
+}
+
+GType nm_remote_connection_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_CONNECTION, "NMRemoteConnection", NULL);
+    return type;
+}
+
+GType nm_setting_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_OBJECT, "NMSetting", NULL);
+    return type;
+}
+
+GType nm_setting_connection_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_SETTING, "NMSettingConnection", connectionSettingClassInit);
+    return type;
+}
+
+GType nm_setting_wireless_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_SETTING, "NMSettingWireless", wirelessSettingClassInit);
+    return type;
+}
+
+GType nm_setting_wireless_security_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_SETTING, "NMSettingWirelessSecurity", securitySettingClassInit);
+    return type;
+}
+
+GType nm_setting_ip4_config_get_type(void)
+{
+    static GType type = registerType(NM_TYPE_SETTING, "NMSettingIP4Config", ip4SettingClassInit);
+    return type;
+}
+
+void nm_client_new_async(GCancellable* cancellable, GAsyncReadyCallback callback, gpointer data)
+{
+    g_async_initable_new_async(NM_TYPE_CLIENT, G_PRIORITY_DEFAULT, cancellable, callback, data, NULL);
+}
+
+NMClient* nm_client_new_finish(GAsyncResult* result, GError** error)
+{
+    GObject* source = g_async_result_get_source_object(result);
+    GObject* client = g_async_initable_new_finish(G_ASYNC_INITABLE(source), result, error);
+    g_object_unref(source);
+    return (NMClient*)client;
+}
+
+const char* nm_client_get_version(NMClient*)
+{
+    return "1.22.0";
+}
+
+gboolean nm_client_get_nm_running(NMClient*)
+{
+    World& w = world();
+    Lock lock(w.mx);
+    return w.running;
+}
+
+gboolean nm_client_wireless_get_enabled(NMClient*)
+{
+    World& w = world();
+    Lock lock(w.mx);
+    return w.wireless;
+}
+
+void nm_client_wireless_set_enabled(NMClient*, gboolean enabled)
+{
+    mirror("Set");
+    World& w = world();
+    {
+        Lock lock(w.mx);
+        w.wireless = enabled;
+    }
+    w.daemon.after(w.latency.call, [enabled]() {
+        NMDevice* device = world().device;
+        if (enabled) {
+            if (nm_device_get_state(device) == NM_DEVICE_STATE_UNAVAILABLE) {
+                changeState(device, NM_DEVICE_STATE_DISCONNECTED, NM_DEVICE_STATE_REASON_NONE);
+            }
+        } else {
+            dropLink(device, NM_DEVICE_STATE_REASON_USER_REQUESTED);
+            changeState(device, NM_DEVICE_STATE_UNAVAILABLE, NM_DEVICE_STATE_REASON_NONE);
+        }
+    });
+}
+
+const GPtrArray* nm_client_get_devices(NMClient*)
+{
+    World& w = world();
+    Lock lock(w.mx);
+    if (std::this_thread::get_id() == w.tracker) {
+        t_inPass = true;
+        t_passStarted = Bench::allocations();
+    }
+    return w.running ? w.devices : w.gone;
+}
+
+NMDevice* nm_client_get_device_by_iface(NMClient*, const char* iface)
+{
+    World& w = world();
+    Lock lock(w.mx);
+    if (!w.running) {
+        return NULL;
+    }
+    for (guint i = 0; i < w.devices->len; i++) {
+        NMDevice* device = (NMDevice*)g_ptr_array_index(w.devices, i);
+        if (node<DeviceNode>(device)->iface == iface) {
+            return device;
+        }
+    }
+    return NULL;
+}
+
+const GPtrArray* nm_client_get_connections(NMClient*)
+{
+    return world().connections;
+}
+
+NMRemoteConnection* nm_client_get_connection_by_uuid(NMClient*, const char* uuid)
+{
+    World& w = world();
+    Lock lock(w.mx);
+    for (guint i = 0; i < w.connections->len; i++) {
+        NMConnection* connection = (NMConnection*)g_ptr_array_index(w.connections, i);
+        const char* own = nm_connection_get_uuid(connection);
+        if (own != NULL && strcmp(own, uuid) == 0) {
+            return NM_REMOTE_CONNECTION(connection);
+        }
+    }
+    return NULL;
+}
+
+gboolean nm_client_connectivity_check_get_available(NMClient*)
+{
+    return TRUE;
+}
+
+gboolean nm_client_connectivity_check_get_enabled(NMClient*)
+{
+    return TRUE;
+}
+
+NMConnectivityState nm_client_get_connectivity(NMClient*)
+{
+    World& w = world();
+    Lock lock(w.mx);
+    DeviceNode* d = node<DeviceNode>(w.device);
+    Radio* radio = w.radioOf(d->activeAp);
+    bool online = d->state == NM_DEVICE_STATE_ACTIVATED && radio != NULL && radio->config.inRange;
+    return online ? NM_CONNECTIVITY_FULL : NM_CONNECTIVITY_NONE;
+}
+
+GDBusConnection* nm_client_get_dbus_connection(NMClient*)
+{
+    World& w = world();
+    Lock lock(w.mx);
+    return w.bus;
+}
+
+void nm_client_activate_connection_async(NMClient* client, NMConnection* connection, NMDevice* device, const char*,
+                                         GCancellable* cancellable, GAsyncReadyCallback callback, gpointer data)
+{
+    mirror("ActivateConnection");
+    World& w = world();
+    GTask* task = g_task_new(client, cancellable, callback, data);
+    if (device == NULL) {
+        device = w.device;
+    }
+    NMRemoteConnection* remote = (NMRemoteConnection*)g_object_ref(connection);
+    w.daemon.after(w.latency.call, [device, remote, task]() {
+        activate(device, remote, task);
+        g_object_unref(remote);
+    });
+}
+
+NMActiveConnection* nm_client_activate_connection_finish(NMClient*, GAsyncResult* result, GError** error)
+{
+    return (NMActiveConnection*)g_task_propagate_pointer(G_TASK(result), error);
+}
+
+void nm_client_add_connection_async(NMClient* client, NMConnection* connection, gboolean save, GCancellable* cancellable,
+                                    GAsyncReadyCallback callback, gpointer data)
+{
+    mirror("AddConnection");
+    World& w = world();
+    GTask* task = g_task_new(client, cancellable, callback, data);
+    g_object_ref(connection);
+    w.daemon.after(w.latency.call, [connection, save, task]() {
+        NMRemoteConnection* remote = addRemote(connection, !save);
+        g_object_unref(connection);
+        g_task_return_pointer(task, g_object_ref(remote), g_object_unref);
+        g_object_unref(task);
+    });
+}
+
+NMRemoteConnection* nm_client_add_connection_finish(NMClient*, GAsyncResult* result, GError** error)
+{
+    return (NMRemoteConnection*)g_task_propagate_pointer(G_TASK(result), error);
+}
+
+void nm_client_add_and_activate_connection2(NMClient* client, NMConnection* partial, NMDevice* device, const char*,
+                                            GVariant* options, GCancellable* cancellable, GAsyncReadyCallback callback,
+                                            gpointer data)
+{
+    bool inMemory = false;
+    if (options != NULL) {
+        g_variant_ref_sink(options);
+        GVariant* persist = g_variant_lookup_value(options, "persist", G_VARIANT_TYPE_STRING);
+        if (persist != NULL) {
+            inMemory = strcmp(g_variant_get_string(persist, NULL), "memory") == 0;
+            g_variant_unref(persist);
+        }
+        g_variant_unref(options);
+    }
+
+    mirror("AddAndActivateConnection2");
+    World& w = world();
+    GTask* task = g_task_new(client, cancellable, callback, data);
+    if (device == NULL) {
+        device = w.device;
+    }
+    g_object_ref(partial);
+    w.daemon.after(w.latency.call, [partial, device, inMemory, task]() {
+        NMRemoteConnection* remote = addRemote(partial, inMemory);
+        g_object_unref(partial);
+        activate(device, remote, task);
+    });
+}
+
+NMActiveConnection* nm_client_add_and_activate_connection2_finish(NMClient*, GAsyncResult* result, GVariant** out, GError** error)
+{
+    if (out != NULL) {
+        *out = NULL;
+    }
+    return (NMActiveConnection*)g_task_propagate_pointer(G_TASK(result), error);
+}
+
+void nm_client_add_and_activate_connection_async(NMClient* client, NMConnection* partial, NMDevice* device, const char* specific,
+                                                 GCancellable* cancellable, GAsyncReadyCallback callback, gpointer data)
+{
+    nm_client_add_and_activate_connection2(client, partial, device, specific, NULL, cancellable, callback, data);
+}
+
+NMActiveConnection* nm_client_add_and_activate_connection_finish(NMClient* client, GAsyncResult* result, GError** error)
+{
+    return nm_client_add_and_activate_connection2_finish(client, result, NULL, error);
+}
+
+gboolean nm_client_deactivate_connection(NMClient*, NMActiveConnection* active, GCancellable*, GError** error)
+{
+    mirror("DeactivateConnection");
+    World& w = world();
+    Clock::instance().sleepFor(w.latency.call);
+    {
+        Lock lock(w.mx);
+        if (node<DeviceNode>(w.device)->active != active) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "The connection was not active");
+            return FALSE;
+        }
+    }
+    w.daemon.after(Clock::Duration::zero(), []() {
+        dropLink(world().device, NM_DEVICE_STATE_REASON_USER_REQUESTED);
+    });
+    return TRUE;
+}
+
+const char* nm_object_get_path(NMObject* object)
+{
+    return ((Instance*)object)->node->path.c_str();
+}
+
+const char* nm_device_get_iface(NMDevice* device)
+{
+    return node<DeviceNode>(device)->iface.c_str();
+}
+
+NMDeviceState nm_device_get_state(NMDevice* device)
+{
+    Lock lock(world().mx);
+    return node<DeviceNode>(device)->state;
+}
+
+NMActiveConnection* nm_device_get_active_connection(NMDevice* device)
+{
+    Lock lock(world().mx);
+    return node<DeviceNode>(device)->active;
+}
+
+void nm_device_reapply_async(NMDevice* device, NMConnection* connection, guint64, guint32, GCancellable* cancellable,
+                             GAsyncReadyCallback callback, gpointer data)
+{
+    mirror("Reapply");
+    GTask* task = g_task_new(device, cancellable, callback, data);
+    World& w = world();
+    w.daemon.after(w.latency.call, [task, device, connection]() {
+        World& w = world();
+        Lock lock(w.mx);
+        NMActiveConnection* active = node<DeviceNode>(device)->active;
+        if (active == NULL || node<ActiveNode>(active)->remote != (NMRemoteConnection*)connection) {
+            g_task_return_new_error(task, g_quark_from_static_string("nm-device-error-quark"), 5, "Device is not activated");
+        } else {
+            w.reapplies++;
+            g_task_return_boolean(task, TRUE);
+        }
+        g_object_unref(task);
+    });
+}
+
+gboolean nm_device_reapply_finish(NMDevice*, GAsyncResult* result, GError** error)
+{
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+void nm_device_disconnect_async(NMDevice* device, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer data)
+{
+    returnTrue(device, "Disconnect", cancellable, callback, data, [device]() {
+        dropLink(device, NM_DEVICE_STATE_REASON_USER_REQUESTED);
+    });
+}
+
+void nm_device_wifi_request_scan_options_async(NMDeviceWifi* device, GVariant* options, GCancellable* cancellable,
+                                               GAsyncReadyCallback callback, gpointer data)
+{
+    std::vector<std::string> ssids;
+    if (options != NULL) {
+        g_variant_ref_sink(options);
+        ssids = ssidsOf(options);
+        g_variant_unref(options);
+    }
+
+    mirror("RequestScan");
+    World& w = world();
+    GTask* task = g_task_new(device, cancellable, callback, data);
+    w.daemon.after(w.latency.call, [device, ssids, task]() {
+        NMDevice* dev = NM_DEVICE(device);
+        if (inHotspotMode(dev)) {
+            g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_BUSY, "Scanning not allowed while in AP mode");
+            g_object_unref(task);
+            return;
+        }
+        g_task_return_boolean(task, TRUE);
+        g_object_unref(task);
+
+        World& w = world();
+        w.daemon.after(ssids.empty() ? w.latency.scan : w.latency.targetedScan, [dev, ssids]() {
+            publishScan(dev, ssids);
+        });
+    });
+}
+
+void nm_device_wifi_request_scan_async(NMDeviceWifi* device, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer data)
+{
+    nm_device_wifi_request_scan_options_async(device, NULL, cancellable, callback, data);
+}
+
+gboolean nm_device_wifi_request_scan_finish(NMDeviceWifi*, GAsyncResult* result, GError** error)
+{
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+const GPtrArray* nm_device_wifi_get_access_points(NMDeviceWifi* device)
+{
+    Lock lock(world().mx);
+    return node<DeviceNode>(device)->aps;
+}
+
+NMAccessPoint* nm_device_wifi_get_active_access_point(NMDeviceWifi* device)
+{
+    Lock lock(world().mx);
+    return node<DeviceNode>(device)->activeAp;
+}
+
+guint32 nm_device_wifi_get_bitrate(NMDeviceWifi* device)
+{
+    return nm_device_wifi_get_active_access_point(device) == NULL ? 0 : 65000;
+}
+
+GBytes* nm_access_point_get_ssid(NMAccessPoint* ap)
+{
+    return node<AccessPointNode>(ap)->ssid;
+}
+
+const char* nm_access_point_get_bssid(NMAccessPoint* ap)
+{
+    return node<AccessPointNode>(ap)->bssid.c_str();
+}
+
+guint8 nm_access_point_get_strength(NMAccessPoint* ap)
+{
+    return node<AccessPointNode>(ap)->strength;
+}
+
+guint32 nm_access_point_get_frequency(NMAccessPoint* ap)
+{
+    return node<AccessPointNode>(ap)->frequency;
+}
+
+NM80211ApFlags nm_access_point_get_flags(NMAccessPoint* ap)
+{
+    return node<AccessPointNode>(ap)->flags;
+}
+
+NM80211ApSecurityFlags nm_access_point_get_wpa_flags(NMAccessPoint*)
+{
+    return NM_802_11_AP_SEC_NONE;
+}
+
+NM80211ApSecurityFlags nm_access_point_get_rsn_flags(NMAccessPoint* ap)
+{
+    return node<AccessPointNode>(ap)->rsn;
+}
+
+gboolean nm_access_point_connection_valid(NMAccessPoint* ap, NMConnection* connection)
+{
+    NMSettingWireless* wireless = nm_connection_get_setting_wireless(connection);
+    return wireless != NULL && ssidOf(nm_setting_wireless_get_ssid(wireless)) == ssidOf(nm_access_point_get_ssid(ap));
+}
+
+NMRemoteConnection* nm_active_connection_get_connection(NMActiveConnection* active)
+{
+    return node<ActiveNode>(active)->remote;
+}
+
+// Follows the device while it is active on this connection, a replaced one is gone
+NMActiveConnectionState nm_active_connection_get_state(NMActiveConnection* active)
+{
+    World& w = world();
+    Lock lock(w.mx);
+    DeviceNode* d = node<DeviceNode>(w.device);
+    if (d->active != active) {
+        return NM_ACTIVE_CONNECTION_STATE_DEACTIVATED;
+    }
+    if (d->state == NM_DEVICE_STATE_ACTIVATED) {
+        return NM_ACTIVE_CONNECTION_STATE_ACTIVATED;
+    }
+    return d->state >= NM_DEVICE_STATE_PREPARE && d->state < NM_DEVICE_STATE_ACTIVATED ?
+           NM_ACTIVE_CONNECTION_STATE_ACTIVATING : NM_ACTIVE_CONNECTION_STATE_DEACTIVATED;
+}
+
+NMIPConfig* nm_active_connection_get_ip4_config(NMActiveConnection* active)
+{
+    return node<ActiveNode>(active)->ip4;
+}
+
+GPtrArray* nm_ip_config_get_addresses(NMIPConfig* config)
+{
+    Lock lock(world().mx);
+    return node<IPConfigNode>(config)->addresses;
+}
+
+const char* nm_ip_address_get_address(NMIPAddress* address)
+{
+    return address->address.c_str();
+}
+
+NMConnection* nm_simple_connection_new(void)
+{
+    return create<NMConnection, ConnectionNode>(NM_TYPE_SIMPLE_CONNECTION);
+}
+
+const char* nm_connection_get_path(NMConnection* connection)
+{
+    const std::string& path = node<ConnectionNode>(connection)->path;
+    return path.empty() ? NULL : path.c_str();
+}
+
+const char* nm_connection_get_uuid(NMConnection* connection)
+{
+    return stringOf(settingOf(connection, NM_TYPE_SETTING_CONNECTION), ConnectionUUID);
+}
+
+NMSettingWireless* nm_connection_get_setting_wireless(NMConnection* connection)
+{
+    return (NMSettingWireless*)settingOf(connection, NM_TYPE_SETTING_WIRELESS);
+}
+
+void nm_connection_add_setting(NMConnection* connection, NMSetting* setting)
+{
+    Lock lock(world().mx);
+    std::vector<NMSetting*>& settings = node<ConnectionNode>(connection)->settings;
+    for (NMSetting*& existing : settings) {
+        if (G_OBJECT_TYPE(existing) == G_OBJECT_TYPE(setting)) {
+            g_object_unref(existing);
+            existing = setting;
+            return;
+        }
+    }
+    settings.push_back(setting);
+}
+
+gboolean nm_connection_verify(NMConnection* connection, GError** error)
+{
+    NMSetting* base = settingOf(connection, NM_TYPE_SETTING_CONNECTION);
+    NMSetting* wireless = settingOf(connection, NM_TYPE_SETTING_WIRELESS);
+    if (stringOf(base, ConnectionUUID) == NULL || stringOf(base, ConnectionId) == NULL ||
+        (wireless != NULL && settingValue(wireless, WirelessSSID) == NULL)) {
+        g_set_error(error, g_quark_from_static_string("nm-connection-error-quark"), 1, "Connection is incomplete");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean nm_remote_connection_get_unsaved(NMRemoteConnection* remote)
+{
+    Lock lock(world().mx);
+    return node<ConnectionNode>(remote)->unsaved;
+}
+
+void nm_remote_connection_commit_changes_async(NMRemoteConnection* remote, gboolean save, GCancellable* cancellable,
+                                               GAsyncReadyCallback callback, gpointer data)
+{
+    returnTrue(remote, save ? "Save" : "Update2", cancellable, callback, data, [remote, save]() {
+        Lock lock(world().mx);
+        ConnectionNode* c = node<ConnectionNode>(remote);
+        // Changes kept in memory only leave the profile unsaved, as in NM
+        c->unsaved = !save;
+        c->powersave = powersaveOf(c);
+    });
+}
+
+gboolean nm_remote_connection_commit_changes_finish(NMRemoteConnection*, GAsyncResult* result, GError** error)
+{
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+void nm_remote_connection_save_async(NMRemoteConnection* remote, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer data)
+{
+    nm_remote_connection_commit_changes_async(remote, TRUE, cancellable, callback, data);
+}
+
+gboolean nm_remote_connection_save_finish(NMRemoteConnection* remote, GAsyncResult* result, GError** error)
+{
+    return nm_remote_connection_commit_changes_finish(remote, result, error);
+}
+
+void nm_remote_connection_delete_async(NMRemoteConnection* remote, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer data)
+{
+    returnTrue(remote, "Delete", cancellable, callback, data, [remote]() {
+        World& w = world();
+        Lock lock(w.mx);
+        // Kept alive, callers may still hold borrowed pointers
+        g_object_ref(remote);
+        g_ptr_array_remove(w.connections, remote);
+    });
+}
+
+gboolean nm_remote_connection_delete_finish(NMRemoteConnection*, GAsyncResult* result, GError** error)
+{
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+NMSetting* nm_setting_connection_new(void)
+{
+    return (NMSetting*)g_object_new(NM_TYPE_SETTING_CONNECTION, NULL);
+}
+
+NMSetting* nm_setting_wireless_new(void)
+{
+    return (NMSetting*)g_object_new(NM_TYPE_SETTING_WIRELESS, NULL);
+}
+
+NMSetting* nm_setting_wireless_security_new(void)
+{
+    return (NMSetting*)g_object_new(NM_TYPE_SETTING_WIRELESS_SECURITY, NULL);
+}
+
+NMSetting* nm_setting_ip4_config_new(void)
+{
+    return (NMSetting*)g_object_new(NM_TYPE_SETTING_IP4_CONFIG, NULL);
+}
+
+GBytes* nm_setting_wireless_get_ssid(NMSettingWireless* setting)
+{
+    const GValue* value = settingValue(setting, WirelessSSID);
+    return value == NULL ? NULL : (GBytes*)g_value_get_boxed(value);
+}
+
+const char* nm_setting_wireless_get_mode(NMSettingWireless* setting)
+{
+    return stringOf(setting, WirelessMode);
+}
+
+const char* nm_setting_wireless_get_bssid(NMSettingWireless* setting)
+{
+    return stringOf(setting, WirelessBSSID);
+}
+
+const char* nm_setting_wireless_get_band(NMSettingWireless* setting)
+{
+    return stringOf(setting, WirelessBand);
+}
+
+guint32 nm_setting_wireless_get_channel(NMSettingWireless* setting)
+{
+    const GValue* value = settingValue(setting, WirelessChannel);
+    return value == NULL ? 0 : g_value_get_uint(value);
+}
+
+guint32 nm_setting_wireless_get_powersave(NMSettingWireless* setting)
+{
+    const GValue* value = settingValue(setting, WirelessPowersave);
+    return value == NULL ? 0 : g_value_get_uint(value);
+}
+
+gboolean nm_setting_wireless_get_hidden(NMSettingWireless* setting)
+{
+    const GValue* value = settingValue(setting, WirelessHidden);
+    return value != NULL && g_value_get_boolean(value);
+}
+
+char* nm_utils_uuid_generate(void)
+{
+    static std::atomic<unsigned> generated(0);
+    return g_strdup_printf("00000000-0000-4000-8000-%012x", ++generated);
+}
+
+}
+
+namespace Bench
+{
+    Latency& latency()
+    {
+        return world().latency;
+    }
+
+    void addAccessPoint(const AccessPoint& ap)
+    {
+        World& w = world();
+        Lock lock(w.mx);
+        Radio radio { ap, create<NMAccessPoint, AccessPointNode>(NM_TYPE_ACCESS_POINT), false };
+        AccessPointNode* n = node<AccessPointNode>(radio.object);
+        n->path = w.path("AccessPoint");
+        n->ssid = g_bytes_new(ap.ssid.data(), ap.ssid.size());
+        char bssid[18];
+        snprintf(bssid, sizeof(bssid), "02:00:00:00:%02X:%02X", (unsigned)(w.air.size() >> 8) & 0xff, (unsigned)w.air.size() & 0xff);
+        n->bssid = bssid;
+        n->strength = ap.signal;
+        n->frequency = ap.frequency;
+        if (!ap.password.empty()) {
+            n->flags = NM_802_11_AP_FLAGS_PRIVACY;
+            n->rsn = (NM80211ApSecurityFlags)(NM_802_11_AP_SEC_PAIR_CCMP | NM_802_11_AP_SEC_GROUP_CCMP | NM_802_11_AP_SEC_KEY_MGMT_PSK);
+        }
+        w.air.push_back(radio);
+
+        if (ap.inRange && !ap.hidden) {
+            // A new list like a scan would publish, the old one may be iterated right now
+            DeviceNode* d = node<DeviceNode>(w.device);
+            GPtrArray* aps = g_ptr_array_new_with_free_func(g_object_unref);
+            for (guint i = 0; i < d->aps->len; i++) {
+                g_ptr_array_add(aps, g_object_ref(g_ptr_array_index(d->aps, i)));
+            }
+            g_ptr_array_add(aps, g_object_ref(radio.object));
+            d->aps = aps;
+        }
+    }
+
+    void setInRange(const std::string& ssid, bool inRange)
+    {
+        World& w = world();
+        {
+            Lock lock(w.mx);
+            Radio* radio = w.find(ssid);
+            if (radio == NULL) {
+                return;
+            }
+            radio->config.inRange = inRange;
+        }
+
+        if (!inRange) {
+            w.daemon.after(Clock::Duration::zero(), [ssid]() {
+                World& w = world();
+                bool lost;
+                {
+                    Lock lock(w.mx);
+                    DeviceNode* d = node<DeviceNode>(w.device);
+                    Radio* radio = w.radioOf(d->activeAp);
+                    lost = radio != NULL && radio->config.ssid == ssid;
+
+                    // NM drops vanished access points from its list, a hidden one is found again by probing only
+                    Radio* gone = w.find(ssid);
+                    gone->probed = false;
+                    GPtrArray* aps = g_ptr_array_new_with_free_func(g_object_unref);
+                    for (guint i = 0; i < d->aps->len; i++) {
+                        if (g_ptr_array_index(d->aps, i) != gone->object) {
+                            g_ptr_array_add(aps, g_object_ref(g_ptr_array_index(d->aps, i)));
+                        }
+                    }
+                    d->aps = aps;
+                }
+                if (lost) {
+                    dropLink(w.device, NM_DEVICE_STATE_REASON_SUPPLICANT_DISCONNECT);
+                }
+            });
+        }
+    }
+
+    int profilePowerSave(const std::string& ssid)
+    {
+        World& w = world();
+        Lock lock(w.mx);
+        for (guint i = 0; i < w.connections->len; i++) {
+            NMConnection* connection = (NMConnection*)g_ptr_array_index(w.connections, i);
+            const char* id = stringOf(settingOf(connection, NM_TYPE_SETTING_CONNECTION), ConnectionId);
+            if (id != NULL && ssid == id) {
+                return (int)node<ConnectionNode>(connection)->powersave;
+            }
+        }
+        return -1;
+    }
+
+    size_t reapplies()
+    {
+        World& w = world();
+        Lock lock(w.mx);
+        return w.reapplies;
+    }
+
+    void setDBusConnection(GDBusConnection* connection)
+    {
+        World& w = world();
+        Lock lock(w.mx);
+        if (w.bus != NULL) {
+            g_object_unref(w.bus);
+        }
+        w.bus = connection == NULL ? NULL : (GDBusConnection*)g_object_ref(connection);
+    }
+
+    void setDaemonRunning(bool running)
+    {
+        World& w = world();
+        w.daemon.after(Clock::Duration::zero(), [running]() {
+            World& w = world();
+            {
+                Lock lock(w.mx);
+                if (w.running == running) {
+                    return;
+                }
+                w.running = running;
+                if (running) {
+                    // Old array is left to whoever still walks it
+                    GPtrArray* devices = g_ptr_array_new_with_free_func(g_object_unref);
+                    g_ptr_array_add(devices, g_object_ref(w.device));
+                    w.devices = devices;
+                }
+            }
+            if (w.client != NULL) {
+                g_object_notify(w.client, NM_CLIENT_NM_RUNNING);
+            }
+        });
+    }
+
+    void addProfile(const std::string& ssid, const std::string& password, bool autoconnect)
+    {
+        NMConnection* connection = nm_simple_connection_new();
+
+        NMSetting* base = nm_setting_connection_new();
+        char* uuid = nm_utils_uuid_generate();
+        g_object_set(base, NM_SETTING_CONNECTION_UUID, uuid, NM_SETTING_CONNECTION_ID, ssid.c_str(),
+                     NM_SETTING_CONNECTION_TYPE, NM_SETTING_WIRELESS_SETTING_NAME,
+                     NM_SETTING_CONNECTION_AUTOCONNECT, autoconnect ? TRUE : FALSE, NULL);
+        g_free(uuid);
+        nm_connection_add_setting(connection, base);
+
+        NMSetting* wireless = nm_setting_wireless_new();
+        GBytes* bytes = g_bytes_new(ssid.data(), ssid.size());
+        g_object_set(wireless, NM_SETTING_WIRELESS_SSID, bytes, NM_SETTING_WIRELESS_MODE, NM_SETTING_WIRELESS_MODE_INFRA, NULL);
+        g_bytes_unref(bytes);
+        nm_connection_add_setting(connection, wireless);
+
+        NMSetting* security = nm_setting_wireless_security_new();
+        g_object_set(security, NM_SETTING_WIRELESS_SECURITY_KEY_MGMT, "wpa-psk",
+                     NM_SETTING_WIRELESS_SECURITY_PSK, password.c_str(), NULL);
+        nm_connection_add_setting(connection, security);
+
+        NMSetting* ip4 = nm_setting_ip4_config_new();
+        g_object_set(ip4, NM_SETTING_IP_CONFIG_METHOD, NM_SETTING_IP4_CONFIG_METHOD_AUTO, NULL);
+        nm_connection_add_setting(connection, ip4);
+
+        NMRemoteConnection* remote = addRemote(connection, false);
+        g_object_unref(connection);
+
+        World& w = world();
+        Lock lock(w.mx);
+        Radio* radio = w.find(ssid);
+        if (!autoconnect || radio == NULL || !radio->config.inRange || radio->config.password != password) {
+            return;
+        }
+
+        // NM brought the link up before the client connected
+        NMActiveConnection* active = newActive(remote);
+        setAddress(active, "192.168.1.100");
+        DeviceNode* d = node<DeviceNode>(w.device);
+        d->active = active;
+        d->activeAp = radio->object;
+        d->state = NM_DEVICE_STATE_ACTIVATED;
+    }
+
+    size_t trackerAllocations()
+    {
+        World& w = world();
+        Lock lock(w.mx);
+        return w.trackerAllocations;
+    }
+
+    void resetTrackerAllocations()
+    {
+        World& w = world();
+        Lock lock(w.mx);
+        w.trackerAllocations = 0;
+    }
+
+    void trackerIdle()
+    {
+        if (!t_inPass) {
+            return;
+        }
+        t_inPass = false;
+        size_t made = allocations() - t_passStarted;
+        World& w = world();
+        Lock lock(w.mx);
+        w.trackerAllocations = std::max(w.trackerAllocations, made);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef IOT_BENCH_FAKE_NM_H
+#define IOT_BENCH_FAKE_NM_H
+
+#include <chrono>
+#include <stddef.h>
+#include <string>
+
+typedef struct _GDBusConnection GDBusConnection;
+
+// Scripted NetworkManager daemon behind the libnm API. The library's own networkmanager.cpp and
+// callbacks.cpp run on top of it. Replies and signals are delivered on GLib's default context like
+// libnm does, after latencies spent on IoT::Clock, so with a virtual clock scenarios take simulated time only.
+namespace Bench
+{
+    struct Latency
+    {
+        std::chrono::milliseconds call = std::chrono::milliseconds(20); // D-Bus round trip
+        std::chrono::milliseconds scan = std::chrono::milliseconds(3000); // From request to results
+        std::chrono::milliseconds targetedScan = std::chrono::milliseconds(800);
+        std::chrono::milliseconds associate = std::chrono::milliseconds(2500);
+        std::chrono::milliseconds dhcp = std::chrono::milliseconds(1500);
+        std::chrono::milliseconds authFailure = std::chrono::milliseconds(8000);
+        std::chrono::milliseconds apStart = std::chrono::milliseconds(2000);
+    };
+
+    struct AccessPoint
+    {
+        std::string ssid;
+        std::string password;
+        int signal = 70;
+        unsigned frequency = 2437;
+        bool inRange = true;
+        bool hidden = false; // Answers probes only, doesn't beacon its SSID
+    };
+
+    Latency& latency();
+    // Listed by the device right away, as if NM scanned before the client connected
+    void addAccessPoint(const AccessPoint& ap);
+    // Link on the access point drops at once, scan results follow on the next scan
+    void setInRange(const std::string& ssid, bool inRange);
+    // Daemon stops or starts like on a package upgrade. Links stay up, devices are listed anew once it is back
+    void setDaemonRunning(bool running);
+    // Saved station profile, active from the start when autoconnect is set and the network is in range
+    void addProfile(const std::string& ssid, const std::string& password, bool autoconnect);
+    // Power save of the profile named after the network as NM last got it, -1 without such profile
+    int profilePowerSave(const std::string& ssid);
+    // Active connections changed in place by a reapply
+    size_t reapplies();
+    // Calls the client makes are also sent over connection, which the client reports as its own,
+    // so D-Bus profiling sees them. The peer has to answer every call, NULL stops mirroring
+    void setDBusConnection(GDBusConnection* connection);
+
+    // Most allocations made by a single tracker pass since the last reset. A pass starts when the
+    // thread which created the client lists devices and ends when that thread waits on the clock
+    size_t trackerAllocations();
+    void resetTrackerAllocations();
+    // Called by the bench clock before every wait
+    void trackerIdle();
+}
+
+#endif // IOT_BENCH_FAKE_NM_H
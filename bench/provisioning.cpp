@@ -0,0 +1,489 @@
+// Drives provisioning scenarios through IoT::WiFi and the library's NetworkManager on a fake libnm
+// in virtual time and fails when a simulated latency exceeds its budget. Steady state paths are
+// then checked against allocation budgets.
+#include "allocations.h"
+#include "fakenm.h"
+#include "upstream.h"
+#include "wifi_setup.h"
+#include "clock.h"
+#include "ipc.h"
+#include "networkmanager.h"
+#include <chrono>
+#include <condition_variable>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace IoT;
+using std::chrono::milliseconds;
+
+namespace
+{
+    const char* const SetupSSID = "Setup";
+    const char* const SetupPassword = "12345678";
+
+    // Tells the fake when the tracker goes idle, so its passes can be measured
+    class BenchClock: public VirtualClock
+    {
+    public:
+        bool waitUntil(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TimePoint deadline) override
+        {
+            Bench::trackerIdle();
+            return VirtualClock::waitUntil(cv, lock, deadline);
+        }
+    };
+
+    class StateLog
+    {
+    public:
+        explicit StateLog(Clock& clock)
+            : m_clock(clock)
+        {
+        }
+
+        void push(WiFi::State state)
+        {
+            std::lock_guard<std::mutex> lock(m_mx);
+            m_states.push_back(Entry { state, m_clock.now() });
+            m_cv.notify_all();
+        }
+
+        size_t mark()
+        {
+            std::lock_guard<std::mutex> lock(m_mx);
+            return m_states.size();
+        }
+
+        // Time the state was entered, searching from cursor on. Cursor is moved past the entry
+        Clock::TimePoint waitFor(WiFi::State state, size_t& cursor)
+        {
+            std::unique_lock<std::mutex> lock(m_mx);
+            m_cv.wait(lock, [&]() {
+                for (; cursor < m_states.size(); ++cursor) {
+                    if (m_states[cursor].state == state) {
+                        return true;
+                    }
+                }
+                return false;
+            });
+            return m_states[cursor++].time;
+        }
+    private:
+        struct Entry
+        {
+            WiFi::State state;
+            Clock::TimePoint time;
+        };
+
+        Clock& m_clock;
+        std::mutex m_mx;
+        std::condition_variable m_cv;
+        std::vector<Entry> m_states;
+    };
+
+    struct Context
+    {
+        Clock& clock;
+        WiFi& wifi;
+        StateLog& states;
+    };
+
+    typedef std::function<Clock::Duration(Context&)> Run;
+
+    struct Scenario
+    {
+        const char* name;
+        milliseconds budget;
+        Run run;
+    };
+
+    void homeNetwork()
+    {
+        Bench::AccessPoint home;
+        home.ssid = "Home";
+        home.password = "secret";
+        Bench::addAccessPoint(home);
+    }
+
+    Clock::Duration coldBootToAP(Context& ctx)
+    {
+        size_t cursor = ctx.states.mark();
+        auto started = ctx.clock.now();
+        ctx.wifi.init("", SetupSSID, SetupPassword);
+        return ctx.states.waitFor(WiFi::InAPMode, cursor) - started;
+    }
+
+    Clock::Duration credentialsToConnected(Context& ctx)
+    {
+        homeNetwork();
+        coldBootToAP(ctx);
+
+        size_t cursor = ctx.states.mark();
+        auto started = ctx.clock.now();
+        ctx.wifi.tryConnect("Home", "secret");
+        return ctx.states.waitFor(WiFi::Connected, cursor) - started;
+    }
+
+    Clock::Duration hiddenToConnected(Context& ctx)
+    {
+        Bench::AccessPoint hidden;
+        hidden.ssid = "Hidden";
+        hidden.password = "secret";
+        hidden.hidden = true;
+        Bench::addAccessPoint(hidden);
+        coldBootToAP(ctx);
+
+        size_t cursor = ctx.states.mark();
+        auto started = ctx.clock.now();
+        ctx.wifi.tryConnect("Hidden", "secret");
+        return ctx.states.waitFor(WiFi::Connected, cursor) - started;
+    }
+
+    // Profile made from a probe must find the network again, though it never shows up in full scans
+    Clock::Duration hiddenReconnect(Context& ctx)
+    {
+        Bench::AccessPoint hidden;
+        hidden.ssid = "Hidden";
+        hidden.password = "secret";
+        hidden.hidden = true;
+        Bench::addAccessPoint(hidden);
+        coldBootToAP(ctx);
+
+        size_t cursor = ctx.states.mark();
+        ctx.wifi.tryConnect("Hidden", "secret");
+        ctx.states.waitFor(WiFi::Connected, cursor);
+        // Tracker confirms the upstream before the network goes away
+        ctx.clock.sleepFor(std::chrono::seconds(10));
+
+        cursor = ctx.states.mark();
+        Bench::setInRange("Hidden", false);
+        ctx.states.waitFor(WiFi::Disconnected, cursor);
+        ctx.clock.sleepFor(std::chrono::seconds(8));
+        cursor = ctx.states.mark();
+        auto back = ctx.clock.now();
+        Bench::setInRange("Hidden", true);
+        return ctx.states.waitFor(WiFi::Connected, cursor) - back;
+    }
+
+    Clock::Duration wrongPasswordToAP(Context& ctx)
+    {
+        homeNetwork();
+        coldBootToAP(ctx);
+
+        size_t cursor = ctx.states.mark();
+        auto started = ctx.clock.now();
+        ctx.wifi.tryConnect("Home", "wrong");
+        ctx.states.waitFor(WiFi::TryingToConnect, cursor);
+        return ctx.states.waitFor(WiFi::InAPMode, cursor) - started;
+    }
+
+    Clock::Duration upstreamLossRecovery(Context& ctx)
+    {
+        homeNetwork();
+        Bench::addProfile("Home", "secret", true);
+        size_t cursor = ctx.states.mark();
+        ctx.wifi.init("", SetupSSID, SetupPassword);
+        ctx.states.waitFor(WiFi::Connected, cursor);
+
+        // Access point goes away for a while, measured from its return
+        cursor = ctx.states.mark();
+        Bench::setInRange("Home", false);
+        ctx.states.waitFor(WiFi::Disconnected, cursor);
+        ctx.clock.sleepFor(std::chrono::seconds(8));
+        cursor = ctx.states.mark();
+        auto back = ctx.clock.now();
+        Bench::setInRange("Home", true);
+        return ctx.states.waitFor(WiFi::Connected, cursor) - back;
+    }
+
+    Clock::Duration daemonRestart(Context& ctx)
+    {
+        homeNetwork();
+        Bench::addProfile("Home", "secret", true);
+        size_t cursor = ctx.states.mark();
+        ctx.wifi.init("", SetupSSID, SetupPassword);
+        ctx.states.waitFor(WiFi::Connected, cursor);
+        ctx.clock.sleepFor(std::chrono::seconds(5));
+
+        Bench::setDaemonRunning(false);
+        ctx.clock.sleepFor(std::chrono::seconds(5));
+
+        // Subscribers get the connection again once the state is rebuilt, measured from NM's return
+        struct Republished
+        {
+            std::mutex mx;
+            std::condition_variable cv;
+            bool seen = false;
+        };
+        std::shared_ptr<Republished> republished = std::make_shared<Republished>();
+        NetworkManager::i().ActiveConnectionChanged.connect([republished](const std::string&, const ActiveConnection&) {
+            std::lock_guard<std::mutex> lock(republished->mx);
+            republished->seen = true;
+            republished->cv.notify_all();
+        });
+
+        auto back = ctx.clock.now();
+        Bench::setDaemonRunning(true);
+        std::unique_lock<std::mutex> lock(republished->mx);
+        republished->cv.wait(lock, [&]() { return republished->seen; });
+        return ctx.clock.now() - back;
+    }
+
+    const Scenario Scenarios[] = {
+        // Includes the scan the hotspot's channel is planned from
+        { "cold boot to AP", milliseconds(8000), coldBootToAP },
+        { "credentials to connected", milliseconds(10000), credentialsToConnected },
+        { "hidden network to connected", milliseconds(10000), hiddenToConnected },
+        { "hidden network reconnect", milliseconds(20000), hiddenReconnect },
+        { "wrong password to AP", milliseconds(15000), wrongPasswordToAP },
+        { "upstream loss recovery", milliseconds(20000), upstreamLossRecovery },
+        // Far below the tracker period, the restart notification wakes the tracker
+        { "daemon restart", milliseconds(1000), daemonRestart },
+    };
+
+    // Allocations counted on the measuring thread, the tracker reports its own passes
+    typedef std::function<size_t(Context&)> Measure;
+
+    struct AllocationCheck
+    {
+        const char* name;
+        size_t budget;
+        Measure measure;
+    };
+
+    size_t trackerPass(Context& ctx)
+    {
+        // Everything a pass may do is on: roaming, sampling and recording. Buffers settle first
+        RoamingPolicy roaming;
+        roaming.enabled = true;
+        ctx.wifi.setRoamingPolicy(roaming);
+        NetworkManager::i().setTelemetry(16, std::chrono::seconds(1));
+        NetworkManager::i().startRecording("/dev/null");
+        ctx.clock.sleepFor(std::chrono::seconds(15));
+
+        // Several passes over an unchanged connection, connectivity is probed again every cache period
+        Bench::resetTrackerAllocations();
+        ctx.clock.sleepFor(std::chrono::seconds(30));
+        return Bench::trackerAllocations();
+    }
+
+    size_t groupedScan(Context& ctx)
+    {
+        ScanQuery query;
+        query.groupBySSID = true;
+        query.limit = 10;
+        std::vector<WifiNetwork> networks;
+        ctx.wifi.availableNetworks(networks, query);
+
+        size_t before = Bench::allocations();
+        ctx.wifi.availableNetworks(networks, query);
+        return Bench::allocations() - before;
+    }
+
+    size_t statusSnapshot(Context& ctx)
+    {
+        size_t before = Bench::allocations();
+        for (int i = 0; i < 100; i++) {
+            ctx.wifi.snapshot();
+        }
+        return Bench::allocations() - before;
+    }
+
+    size_t ipcFrame(Context& ctx)
+    {
+        Connection connection;
+        connection.mode = Mode::Infrastructure;
+        connection.uuid = "0b1e4a52-8d0e-4b8f-9a3c-5f1d2e7c6a90";
+        connection.name = "Home";
+        connection.ip = "192.168.1.100";
+        Ipc::Fields fields;
+        fields.push_back("!");
+        fields.push_back("connection");
+        Ipc::putConnection(fields, connection);
+        std::string out;
+        Ipc::encode(fields, out);
+
+        size_t before = Bench::allocations();
+        for (int i = 0; i < 100; i++) {
+            out.clear();
+            Ipc::encode(fields, out);
+        }
+        return Bench::allocations() - before;
+    }
+
+    const AllocationCheck AllocationChecks[] = {
+        { "tracker pass", 0, trackerPass },
+        { "grouped scan, reused list", 8, groupedScan },
+        { "status snapshot", 0, statusSnapshot },
+        { "ipc frame, reused buffer", 0, ipcFrame },
+    };
+
+    const Clock::Duration Limit = std::chrono::minutes(10);
+
+    // Runs work on its own thread while virtual time follows the pending deadlines
+    long long drive(VirtualClock& clock, const std::function<long long()>& work)
+    {
+        struct Outcome
+        {
+            std::mutex mx;
+            bool done = false;
+            long long measured = 0;
+        };
+
+        std::shared_ptr<Outcome> outcome = std::make_shared<Outcome>();
+        std::function<long long()> run = work;
+        std::thread worker([outcome, run]() {
+            long long result = run();
+            std::lock_guard<std::mutex> lock(outcome->mx);
+            outcome->measured = result;
+            outcome->done = true;
+        });
+
+        // Threads get a moment of real time to settle before time jumps to the next deadline
+        auto started = clock.now();
+        while (clock.now() - started < Limit) {
+            std::this_thread::sleep_for(milliseconds(2));
+            {
+                std::lock_guard<std::mutex> lock(outcome->mx);
+                if (outcome->done) {
+                    break;
+                }
+            }
+            clock.advanceToNext(milliseconds(100));
+        }
+
+        bool done;
+        {
+            std::lock_guard<std::mutex> lock(outcome->mx);
+            done = outcome->done;
+        }
+        if (!done) {
+            // Stuck run shares the outcome and is left behind, the child exits right after
+            worker.detach();
+            return -1;
+        }
+        worker.join();
+        return outcome->measured;
+    }
+
+    // Objects are never destroyed, NetworkManager's threads keep using them until the child exits
+    Context& setup()
+    {
+        VirtualClock& clock = *new BenchClock();
+        Clock::setInstance(&clock);
+
+        // NM reports full connectivity on a working link, the library then probes upstream itself
+        Bench::Upstream& upstream = *new Bench::Upstream();
+        ConnectivityConfig connectivity;
+        connectivity.host = "127.0.0.1";
+        connectivity.port = upstream.port();
+        // Fake wlan0 doesn't exist, the upstream is reached over loopback
+        connectivity.bindToInterface = false;
+
+        StateLog& states = *new StateLog(clock);
+        WiFi& wifi = *new WiFi();
+        wifi.setConnectivityCheck(connectivity);
+        wifi.onStateChanged([&states](WiFi::State state) { states.push(state); });
+        return *new Context { clock, wifi, states };
+    }
+
+    long long simulate(const Scenario& scenario)
+    {
+        Context& ctx = setup();
+        return drive(static_cast<VirtualClock&>(ctx.clock), [&]() {
+            return (long long)std::chrono::duration_cast<milliseconds>(scenario.run(ctx)).count();
+        });
+    }
+
+    // Measured once the device is connected and settled
+    long long allocations(const AllocationCheck& check)
+    {
+        Context& ctx = setup();
+        return drive(static_cast<VirtualClock&>(ctx.clock), [&]() {
+            homeNetwork();
+            Bench::addProfile("Home", "secret", true);
+            size_t cursor = ctx.states.mark();
+            ctx.wifi.init("", SetupSSID, SetupPassword);
+            ctx.states.waitFor(WiFi::Connected, cursor);
+            ctx.clock.sleepFor(std::chrono::seconds(10));
+            return (long long)check.measure(ctx);
+        });
+    }
+
+    // The library keeps process wide singletons, every run gets a forked child
+    long long inChild(const std::function<long long()>& run, bool verbose)
+    {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            perror("pipe");
+            return -1;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            if (!verbose) {
+                int null = open("/dev/null", O_WRONLY);
+                dup2(null, STDOUT_FILENO);
+                dup2(null, STDERR_FILENO);
+            }
+            long long result = run();
+            ssize_t written = write(fds[1], &result, sizeof(result));
+            _exit(written == sizeof(result) ? 0 : 1);
+        }
+
+        close(fds[1]);
+        long long result = -1;
+        if (read(fds[0], &result, sizeof(result)) != sizeof(result)) {
+            result = -1;
+        }
+        close(fds[0]);
+        waitpid(pid, NULL, 0);
+        return result;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    int failed = 0;
+
+    printf("%-28s %10s %10s %10s\n", "scenario", "simulated", "budget", "wall");
+    for (const Scenario& scenario : Scenarios) {
+        auto wallStarted = std::chrono::steady_clock::now();
+        long long simulated = inChild([&]() { return simulate(scenario); }, verbose);
+        auto wall = std::chrono::duration_cast<milliseconds>(std::chrono::steady_clock::now() - wallStarted);
+
+        bool ok = simulated >= 0 && simulated <= scenario.budget.count();
+        failed += ok ? 0 : 1;
+        if (simulated < 0) {
+            printf("%-28s %10s %8lldms %8lldms TIMEOUT\n", scenario.name, "-", (long long)scenario.budget.count(), (long long)wall.count());
+        } else {
+            printf("%-28s %8lldms %8lldms %8lldms %s\n", scenario.name, simulated, (long long)scenario.budget.count(),
+                   (long long)wall.count(), ok ? "OK" : "OVER BUDGET");
+        }
+        fflush(stdout);
+    }
+
+    printf("\n%-28s %10s %10s\n", "steady state", "allocs", "budget");
+    for (const AllocationCheck& check : AllocationChecks) {
+        long long counted = inChild([&]() { return allocations(check); }, verbose);
+        bool ok = counted >= 0 && (size_t)counted <= check.budget;
+        failed += ok ? 0 : 1;
+        if (counted < 0) {
+            printf("%-28s %10s %10zu TIMEOUT\n", check.name, "-", check.budget);
+        } else {
+            printf("%-28s %10lld %10zu %s\n", check.name, counted, check.budget, ok ? "OK" : "OVER BUDGET");
+        }
+        fflush(stdout);
+    }
+
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+#include "upstream.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace Bench;
+
+Upstream::Upstream()
+    : m_listen(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0))
+    , m_stop { -1, -1 }
+    , m_port(0)
+{
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(sa);
+    if (m_listen < 0 || bind(m_listen, (sockaddr*)&sa, sizeof(sa)) != 0 || listen(m_listen, 8) != 0 ||
+        getsockname(m_listen, (sockaddr*)&sa, &len) != 0 || pipe(m_stop) != 0) {
+        return;
+    }
+
+    m_port = ntohs(sa.sin_port);
+    m_thread = std::thread([this]() { serve(); });
+}
+
+Upstream::~Upstream()
+{
+    if (m_thread.joinable()) {
+        ssize_t written = write(m_stop[1], "x", 1);
+        (void)written;
+        m_thread.join();
+    }
+    int fds[] = { m_listen, m_stop[0], m_stop[1] };
+    for (int fd : fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+unsigned short Upstream::port() const
+{
+    return m_port;
+}
+
+void Upstream::serve()
+{
+    static const char Response[] = "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    pollfd fds[2] = { { m_listen, POLLIN, 0 }, { m_stop[0], POLLIN, 0 } };
+    while (poll(fds, 2, -1) >= 0 && !(fds[1].revents & POLLIN)) {
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        int client = accept4(m_listen, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            continue;
+        }
+        // Probe sends its request at once, the answer doesn't depend on it
+        char request[1024];
+        ssize_t got = recv(client, request, sizeof(request), 0);
+        if (got > 0) {
+            ssize_t sent = send(client, Response, sizeof(Response) - 1, MSG_NOSIGNAL);
+            (void)sent;
+        }
+        close(client);
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef IOT_BENCH_UPSTREAM_H
+#define IOT_BENCH_UPSTREAM_H
+
+#include <thread>
+
+// Connectivity check endpoint on localhost, answers every request with 204 No Content
+namespace Bench
+{
+    class Upstream
+    {
+    public:
+        Upstream();
+        ~Upstream();
+
+        // Zero when the socket couldn't be opened
+        unsigned short port() const;
+    private:
+        void serve();
+
+        int m_listen;
+        int m_stop[2];
+        unsigned short m_port;
+        std::thread m_thread;
+    };
+}
+
+#endif // IOT_BENCH_UPSTREAM_H
@@ -0,0 +1,30 @@
+#include "networkdaemon.h"
+#include "networkmanager.h"
+#include "log.h"
+#include <signal.h>
+
+using namespace IoT;
+
+// Owns NetworkManager and serves it to NetworkClient processes until SIGINT/SIGTERM
+int main(int argc, char** argv)
+{
+    std::string path = argc > 1 ? argv[1] : Ipc::DefaultSocket;
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    NetworkManager::i();
+    static NetworkDaemon daemon;
+    if (!daemon.start(path)) {
+        return 1;
+    }
+
+    int signal = 0;
+    sigwait(&signals, &signal);
+    LOG_INFO << "Stopping on signal " << signal;
+    daemon.stop();
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "bootstate.h"
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace IoT;
+
+static const uint32_t Magic = 0x53545749; // IWTS
+static const uint32_t Version = 1;
+
+BootStateCache::BootStateCache()
+    : m_slots(NULL)
+    , m_fd(-1)
+{
+}
+
+BootStateCache::~BootStateCache()
+{
+    close();
+}
+
+bool BootStateCache::open(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_slots != NULL) {
+        return true;
+    }
+
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (m_fd < 0) {
+        LOG_ERROR << "Can't open state cache " << path << ": " << strerror(errno);
+        return false;
+    }
+
+    const size_t size = 2 * sizeof(Slot);
+    if (ftruncate(m_fd, size) < 0) {
+        LOG_ERROR << "Can't resize state cache " << path << ": " << strerror(errno);
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (mem == MAP_FAILED) {
+        LOG_ERROR << "Can't map state cache " << path << ": " << strerror(errno);
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    m_slots = (Slot*)mem;
+    return true;
+}
+
+void BootStateCache::close()
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_slots != NULL) {
+        munmap(m_slots, 2 * sizeof(Slot));
+        m_slots = NULL;
+    }
+
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool BootStateCache::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    return m_slots != NULL;
+}
+
+uint32_t BootStateCache::checksum(const Slot& slot)
+{
+    // FNV-1a of everything but the checksum itself
+    const unsigned char* data = (const unsigned char*)&slot;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(Slot, checksum); ++i) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+const BootStateCache::Slot* BootStateCache::newest() const
+{
+    const Slot* best = NULL;
+    for (int i = 0; i < 2; ++i) {
+        const Slot& slot = m_slots[i];
+        if (slot.magic != Magic || slot.version != Version || slot.checksum != checksum(slot)) {
+            continue;
+        }
+
+        if (best == NULL || slot.sequence > best->sequence) {
+            best = &slot;
+        }
+    }
+    return best;
+}
+
+bool BootStateCache::load(BootState& state) const
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_slots == NULL) {
+        return false;
+    }
+
+    const Slot* slot = newest();
+    if (slot == NULL) {
+        return false;
+    }
+
+    state = slot->state;
+    // Never trust strings read from disk
+    state.iface[sizeof(state.iface) - 1] = 0;
+    state.apUUID[sizeof(state.apUUID) - 1] = 0;
+    state.stationUUID[sizeof(state.stationUUID) - 1] = 0;
+    state.bssid[sizeof(state.bssid) - 1] = 0;
+    return true;
+}
+
+bool BootStateCache::store(const BootState& state)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_slots == NULL) {
+        return false;
+    }
+
+    const Slot* current = newest();
+    if (current != NULL && memcmp(&current->state, &state, sizeof(state)) == 0) {
+        return true;
+    }
+
+    Slot* target = current == &m_slots[0] ? &m_slots[1] : &m_slots[0];
+    Slot slot;
+    memset(&slot, 0, sizeof(slot));
+    slot.magic = Magic;
+    slot.version = Version;
+    slot.sequence = current == NULL ? 1 : current->sequence + 1;
+    slot.state = state;
+    slot.checksum = checksum(slot);
+
+    memcpy(target, &slot, sizeof(slot));
+    if (msync(m_slots, 2 * sizeof(Slot), MS_SYNC) < 0) {
+        LOG_ERROR << "Can't sync state cache: " << strerror(errno);
+        return false;
+    }
+    return true;
+}
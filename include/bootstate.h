@@ -0,0 +1,51 @@
+#ifndef IOT_BOOT_STATE_H
+#define IOT_BOOT_STATE_H
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+namespace IoT
+{
+    struct BootState
+    {
+        char iface[16];
+        char apUUID[37];
+        char stationUUID[37];
+        char bssid[18];
+    };
+
+    // Memory mapped file with two slots, store() always writes the older one,
+    // so a crash in the middle of the write keeps the previous state readable.
+    class BootStateCache
+    {
+    public:
+        BootStateCache();
+        ~BootStateCache();
+
+        bool open(const std::string& path);
+        void close();
+        bool isOpen() const;
+
+        bool load(BootState& state) const;
+        bool store(const BootState& state);
+    private:
+        struct Slot
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t sequence;
+            BootState state;
+            uint32_t checksum;
+        };
+
+        static uint32_t checksum(const Slot& slot);
+        const Slot* newest() const;
+    private:
+        mutable std::mutex m_mx;
+        Slot* m_slots;
+        int m_fd;
+    };
+}
+
+#endif // IOT_BOOT_STATE_H
@@ -6,14 +6,118 @@
 
 using namespace IoT;
 
+static const guint ActivationTimeout = 60000;
+static const guint ScanResultsTimeout = 10000;
+
+static void endPhase(AddConnectionData *data, Result result, const char* next)
+{
+    auto now = Clock::instance().now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - data->PhaseStarted);
+    LOG_DEBUG << "Connect phase " << data->Phase << ": " << (int)result << " in " << elapsed.count() / 1000 << "ms";
+    data->Phases.push_back(ConnectPhase { data->Phase, result, elapsed });
+    data->Phase = next;
+    data->PhaseStarted = now;
+}
+
+static void finishActivation(AddConnectionData *data, Result result)
+{
+    endPhase(data, result, NULL);
+
+    if (data->StateHandler != 0) {
+        g_signal_handler_disconnect(data->Device, data->StateHandler);
+    }
+
+    if (data->Timeout != 0) {
+        g_source_remove(data->Timeout);
+    }
+
+    if (result == Result::Connected && data->Unsaved != NULL) {
+        LOG_DEBUG << "Saving connection after it was activated";
+        nm_remote_connection_save_async(data->Unsaved, NULL, Callbacks::saved, NULL);
+    }
+
+    if (result != Result::Connected && data->Device != NULL) {
+        // Don't let NM retry on its own, caller decides what to do next
+        nm_device_disconnect_async(data->Device, NULL, NULL, NULL);
+        if (data->Remote != NULL && (result == Result::BadCredentials || result == Result::Rejected)) {
+            LOG_DEBUG << "Removing connection with wrong credentials";
+            nm_remote_connection_delete_async(data->Remote, NULL, NULL, NULL);
+        } else if (data->Remote != NULL && data->InMemory) {
+            LOG_DEBUG << "Discarding connection of failed attempt";
+            nm_remote_connection_delete_async(data->Remote, NULL, NULL, NULL);
+        }
+    }
+
+    if (data->Remote != NULL) {
+        g_object_unref(data->Remote);
+    }
+
+    if (data->Unsaved != NULL) {
+        g_object_unref(data->Unsaved);
+    }
+
+    if (data->Active != NULL) {
+        g_object_unref(data->Active);
+    }
+
+    data->data->LastConnectResult.set(result);
+    data->Outcome = result;
+    data->Done = true;
+}
+
+void Callbacks::clientCreated(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    Data* data = (Data*)user_data;
+    GError *error = NULL;
+
+    NMClient* client = nm_client_new_finish(result, &error);
+    if (error) {
+        LOG_ERROR << "Can't connect to NetworkManager: " << error->message;
+        g_error_free(error);
+    }
+
+    std::lock_guard<std::mutex> lock(data->ReadyMx);
+    data->Client = client;
+    data->Ready = true;
+    data->ReadyCv.notify_all();
+}
+
+static void finishTargetedScan(WifiScanData *data)
+{
+    if (data->handler != 0) {
+        g_signal_handler_disconnect(data->device, data->handler);
+    }
+
+    if (data->timeout != 0) {
+        g_source_remove(data->timeout);
+    }
+    data->done = true;
+}
+
 void Callbacks::scanCompleted(GObject *device, GAsyncResult *result, gpointer user_data)
 {
     NMDeviceWifi *wifi = NM_DEVICE_WIFI (device);
     WifiScanData* data = (WifiScanData*)user_data;
     GError *error = NULL;
-    std::unique_lock<std::mutex> lock(data->mx);
 
-    if (!nm_device_wifi_request_scan_finish (wifi, result, &error)) {
+    bool accepted = nm_device_wifi_request_scan_finish (wifi, result, &error);
+    if (data->results) {
+        if (!accepted) {
+            LOG_ERROR << "Error requesting scan: " << (error != NULL ? error->message : "unknown");
+            if (error != NULL) {
+                g_error_free(error);
+            }
+            finishTargetedScan(data);
+            return;
+        }
+
+        // Results come with the last-scan change
+        data->accepted = true;
+        data->timeout = g_timeout_add(ScanResultsTimeout, Callbacks::scanTimedOut, data);
+        return;
+    }
+
+    if (!accepted) {
         if (error != NULL) {
             if (data->force) {
                 std::string cmd = "iwlist ";
@@ -25,7 +129,57 @@ void Callbacks::scanCompleted(GObject *device, GAsyncResult *result, gpointer us
             g_error_free(error);
         }
     }
-    data->cv.notify_all();
+    data->done = true;
+}
+
+// Device may still be activated on the previous connection, that isn't ours
+static bool onActive(AddConnectionData *data)
+{
+    return nm_device_get_active_connection(data->Device) == data->Active;
+}
+
+// Request was accepted, the outcome is followed on the device
+static void followActivation(AddConnectionData *data, NMActiveConnection* active)
+{
+    endPhase(data, Result::Added, "activation");
+    NMRemoteConnection* remote = nm_active_connection_get_connection(active);
+    if (remote != NULL) {
+        LOG_DEBUG << "Activated: " << nm_connection_get_path(NM_CONNECTION(remote));
+    }
+    if (data->Device == NULL) {
+        finishActivation(data, Result::Connected);
+        return;
+    }
+
+    data->Active = (NMActiveConnection*)g_object_ref(active);
+    if (nm_active_connection_get_state(active) == NM_ACTIVE_CONNECTION_STATE_ACTIVATED ||
+        (onActive(data) && nm_device_get_state(data->Device) == NM_DEVICE_STATE_ACTIVATED)) {
+        finishActivation(data, Result::Connected);
+        return;
+    }
+
+    // Request is accepted, the real outcome comes with device state changes
+    NMDeviceState state = nm_device_get_state(data->Device);
+    data->Started = onActive(data) && state >= NM_DEVICE_STATE_PREPARE && state < NM_DEVICE_STATE_ACTIVATED;
+    data->StateHandler = g_signal_connect(data->Device, "state-changed", G_CALLBACK(Callbacks::deviceStateChanged), data);
+    data->Timeout = g_timeout_add(ActivationTimeout, Callbacks::activationTimedOut, data);
+}
+
+void Callbacks::lastScanChanged(GObject *device, GParamSpec *pspec, gpointer user_data)
+{
+    WifiScanData* data = (WifiScanData*)user_data;
+    if (data->accepted) {
+        finishTargetedScan(data);
+    }
+}
+
+gboolean Callbacks::scanTimedOut(gpointer user_data)
+{
+    WifiScanData* data = (WifiScanData*)user_data;
+    LOG_WARN << "Targeted scan results didn't come in time";
+    data->timeout = 0;
+    finishTargetedScan(data);
+    return G_SOURCE_REMOVE;
 }
 
 void Callbacks::connectionActivated(GObject *client, GAsyncResult *result, gpointer user_data) {
@@ -36,16 +190,105 @@ void Callbacks::connectionActivated(GObject *client, GAsyncResult *result, gpoin
 
     if (error) {
         LOG_ERROR << "Error activating connection: " << error->message;
-        data->data->LastConnectResult.set(Result::BadCredentials);
         g_error_free(error);
+        data->Device = NULL;
+        finishActivation(data, Result::InternalError);
+        return;
+    }
+
+    followActivation(data, active);
+    g_object_unref(active);
+}
+
+void Callbacks::addedAndActivated(GObject *client, GAsyncResult *result, gpointer user_data)
+{
+    AddConnectionData *data = (AddConnectionData *)user_data;
+    GError *error = NULL;
+
+#ifdef NM_VERSION_1_16
+    NMActiveConnection* active = data->InMemory ?
+        nm_client_add_and_activate_connection2_finish(NM_CLIENT(client), result, NULL, &error) :
+        nm_client_add_and_activate_connection_finish(NM_CLIENT(client), result, &error);
+#else
+    NMActiveConnection* active = nm_client_add_and_activate_connection_finish(NM_CLIENT(client), result, &error);
+#endif
+
+    if (error) {
+        LOG_ERROR << "Error adding connection: " << error->message;
+        g_error_free(error);
+        data->Device = NULL;
+        finishActivation(data, Result::BadParameters);
+        return;
+    }
+
+    // Kept to drop the profile if credentials turn out wrong
+    NMRemoteConnection* remote = nm_active_connection_get_connection(active);
+    if (remote != NULL) {
+        data->Remote = (NMRemoteConnection*)g_object_ref(remote);
+        if (data->InMemory) {
+            data->Unsaved = (NMRemoteConnection*)g_object_ref(remote);
+        }
+    }
+    data->data->LastConnectResult.set(Result::Added);
+    followActivation(data, active);
+    g_object_unref(active);
+}
+
+void Callbacks::deviceStateChanged(NMDevice *device, guint newState, guint oldState, guint reason, gpointer user_data)
+{
+    AddConnectionData *data = (AddConnectionData *)user_data;
+    LOG_DEBUG << "Device state " << oldState << " -> " << newState << " reason " << reason;
+
+    if (newState >= NM_DEVICE_STATE_PREPARE && newState < NM_DEVICE_STATE_ACTIVATED && onActive(data)) {
+        data->Started = true;
+    }
+
+    if (newState == NM_DEVICE_STATE_ACTIVATED) {
+        if (onActive(data)) {
+            finishActivation(data, Result::Connected);
+        }
+    } else if (newState == NM_DEVICE_STATE_NEED_AUTH && oldState == NM_DEVICE_STATE_CONFIG &&
+               reason == NM_DEVICE_STATE_REASON_SUPPLICANT_DISCONNECT) {
+        // Handshake failed, NM would wait for new secrets before giving up
+        finishActivation(data, Result::BadCredentials);
+    } else if (newState == NM_DEVICE_STATE_FAILED ||
+               (data->Started && newState <= NM_DEVICE_STATE_DISCONNECTED)) {
+        // Previous connection going down is not a failure, only ours after it started
+        finishActivation(data, Utility::stateReasonToResult((NMDeviceStateReason)reason));
+    }
+}
+
+gboolean Callbacks::activationTimedOut(gpointer user_data)
+{
+    AddConnectionData *data = (AddConnectionData *)user_data;
+    LOG_ERROR << "Activation timed out";
+    data->Timeout = 0;
+    finishActivation(data, Result::Timeout);
+    return G_SOURCE_REMOVE;
+}
+
+void Callbacks::runningChanged(GObject *client, GParamSpec *pspec, gpointer user_data)
+{
+    Data* data = (Data*)user_data;
+    bool running = nm_client_get_nm_running(NM_CLIENT(client));
+    {
+        std::lock_guard<std::mutex> lock(data->ReadyMx);
+        if (data->Running == running) {
+            return;
+        }
+        data->Running = running;
+        data->ReadyCv.notify_all();
+    }
+
+    if (running) {
+        LOG_INFO << "NetworkManager is running again";
     } else {
-        NMRemoteConnection* remote = nm_active_connection_get_connection(active);
-        LOG_DEBUG << "Activated: " << nm_connection_get_path(NM_CONNECTION(remote));
-        bool ok = true;
-        data->data->LastConnectResult.set(Result::Connected);
+        LOG_WARN << "NetworkManager has stopped, holding operations";
+    }
+
+    if (data->RunningChanged) {
+        data->RunningChanged(running);
     }
-    g_main_loop_quit (data->data->Loop);
-    delete data;
 }
 
 void Callbacks::addedNewConnection(GObject *client, GAsyncResult *result, gpointer user_data)
@@ -59,24 +302,112 @@ void Callbacks::addedNewConnection(GObject *client, GAsyncResult *result, gpoint
         LOG_ERROR << "Error adding connection:" << error->message;
         g_error_free(error);
         data->data->LastConnectResult.set(Result::BadParameters);
-        g_error_free(error);
-        delete data;
-        g_main_loop_quit (data->data->Loop);
+        data->Outcome = Result::BadParameters;
+        data->Done = true;
         return;
     } else {
         LOG_DEBUG << "Added: " << nm_connection_get_path(NM_CONNECTION(remote));
     }
 
     data->data->LastConnectResult.set(Result::Added);
-    if (data->Activate) {
-        LOG_DEBUG << "Activating...";
-        nm_client_activate_connection_async(NM_CLIENT(client), NM_CONNECTION(remote), 
-                                            NULL,
-                                            NULL, NULL,
-                                            Callbacks::connectionActivated,
-                                            data);
+    data->Outcome = Result::Added;
+    g_object_unref(remote);
+    data->Done = true;
+}
+
+void Callbacks::saved(GObject *connection, GAsyncResult *result, gpointer user_data)
+{
+    GError *error = NULL;
+
+    nm_remote_connection_save_finish(NM_REMOTE_CONNECTION(connection), result, &error);
+    if (error) {
+        LOG_ERROR << "Error saving connection: " << error->message;
+        g_error_free(error);
+    } else {
+        LOG_DEBUG << "Saved: " << nm_connection_get_path(NM_CONNECTION(connection));
+    }
+}
+
+void Callbacks::committed(GObject *connection, GAsyncResult *result, gpointer user_data)
+{
+    AddConnectionData* data = (AddConnectionData*)user_data;
+    GError *error = NULL;
+
+    nm_remote_connection_commit_changes_finish(NM_REMOTE_CONNECTION(connection), result, &error);
+    if (error) {
+        LOG_ERROR << "Error updating connection: " << error->message;
+        g_error_free(error);
+        data->Outcome = Result::InternalError;
+    } else {
+        data->Outcome = Result::Added;
+    }
+    data->Done = true;
+}
+
+void Callbacks::roamCommitted(GObject *connection, GAsyncResult *result, gpointer user_data)
+{
+    RoamData* data = (RoamData*)user_data;
+    GError *error = NULL;
+
+    nm_remote_connection_commit_changes_finish(NM_REMOTE_CONNECTION(connection), result, &error);
+    if (error) {
+        LOG_ERROR << "Can't update BSSID: " << error->message;
+        g_error_free(error);
+    } else {
+        nm_client_activate_connection_async(data->Client, NM_CONNECTION(connection), data->Device,
+                                            data->AccessPoint.c_str(), NULL,
+                                            Callbacks::roamed, NULL);
+    }
+
+    g_object_unref(data->Device);
+    delete data;
+}
+
+void Callbacks::powerSaveCommitted(GObject *connection, GAsyncResult *result, gpointer user_data)
+{
+    NMDevice* device = (NMDevice*)user_data;
+    GError *error = NULL;
+
+    nm_remote_connection_commit_changes_finish(NM_REMOTE_CONNECTION(connection), result, &error);
+    if (error) {
+        LOG_ERROR << "Can't update power save: " << error->message;
+        g_error_free(error);
+    } else if (device != NULL) {
+        nm_device_reapply_async(device, NM_CONNECTION(connection), 0, 0, NULL, Callbacks::reapplied, NULL);
+    }
+
+    if (device != NULL) {
+        g_object_unref(device);
+    }
+}
+
+void Callbacks::reapplied(GObject *device, GAsyncResult *result, gpointer user_data)
+{
+    GError *error = NULL;
+
+    nm_device_reapply_finish(NM_DEVICE(device), result, &error);
+    if (error) {
+        // Drivers which can't change it on a live link get it on the next activation
+        LOG_WARN << "Power save applies on next activation of " << nm_device_get_iface(NM_DEVICE(device)) << ": " << error->message;
+        g_error_free(error);
     } else {
-        g_main_loop_quit (data->data->Loop);
-        delete data;
+        LOG_DEBUG << "Reapplied " << nm_device_get_iface(NM_DEVICE(device));
     }
-}
\ No newline at end of file
+}
+
+void Callbacks::roamed(GObject *client, GAsyncResult *result, gpointer user_data)
+{
+    GError *error = NULL;
+
+    NMActiveConnection* active = nm_client_activate_connection_finish(NM_CLIENT(client), result, &error);
+    if (error) {
+        LOG_ERROR << "Error reassociating: " << error->message;
+        g_error_free(error);
+    } else {
+        LOG_DEBUG << "Reassociated";
+    }
+
+    if (active != NULL) {
+        g_object_unref(active);
+    }
+}
@@ -2,8 +2,10 @@
 #define NM_CALLBACKS_H
 
 #include <NetworkManager.h>
-#include <mutex>
-#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include "networksignals.h"
+#include "clock.h"
 
 namespace IoT {
 
@@ -22,21 +24,63 @@ namespace IoT {
     struct AddConnectionData
     {
         struct Data* data;
-        bool Activate;
+        // When set, activation is followed until the device is activated or fails
+        NMDevice* Device = NULL;
+        // Returned for this request, the device's state counts only while it is active on it
+        NMActiveConnection* Active = NULL;
+        NMRemoteConnection* Remote = NULL;
+        // Profile is added in memory only, Unsaved is written to disk once activated
+        bool InMemory = false;
+        NMRemoteConnection* Unsaved = NULL;
+        bool Started = false;
+        gulong StateHandler = 0;
+        guint Timeout = 0;
+        // Owned by the caller, callbacks set Outcome and then Done as the last access
+        Result Outcome = Result::Unknown;
+        std::atomic<bool> Done{false};
+        // Ended phases, the current one runs since PhaseStarted
+        std::vector<ConnectPhase> Phases;
+        const char* Phase = "request";
+        Clock::TimePoint PhaseStarted;
     };
 
     struct WifiScanData
     {
-        std::mutex mx;
-        std::condition_variable cv;
         bool force = false;
+        std::atomic<bool> done{false};
+        // Done once the results are in, not when NM accepted the request
+        bool results = false;
+        bool accepted = false;
+        NMDevice* device = NULL;
+        gulong handler = 0;
+        guint timeout = 0;
+    };
+
+    struct RoamData
+    {
+        NMClient* Client;
+        NMDevice* Device;
+        std::string AccessPoint;
     };
 
     struct Callbacks
     {
+        static void clientCreated(GObject *source, GAsyncResult *result, gpointer user_data);
         static void scanCompleted(GObject *device, GAsyncResult *result, gpointer user_data);
+        static void lastScanChanged(GObject *device, GParamSpec *pspec, gpointer user_data);
+        static gboolean scanTimedOut(gpointer user_data);
         static void connectionActivated(GObject *client, GAsyncResult *result, gpointer user_data);
         static void addedNewConnection(GObject *client, GAsyncResult *result, gpointer user_data);
+        static void addedAndActivated(GObject *client, GAsyncResult *result, gpointer user_data);
+        static void roamed(GObject *client, GAsyncResult *result, gpointer user_data);
+        static void roamCommitted(GObject *connection, GAsyncResult *result, gpointer user_data);
+        static void saved(GObject *connection, GAsyncResult *result, gpointer user_data);
+        static void committed(GObject *connection, GAsyncResult *result, gpointer user_data);
+        static void powerSaveCommitted(GObject *connection, GAsyncResult *result, gpointer user_data);
+        static void reapplied(GObject *device, GAsyncResult *result, gpointer user_data);
+        static void deviceStateChanged(NMDevice *device, guint newState, guint oldState, guint reason, gpointer user_data);
+        static gboolean activationTimedOut(gpointer user_data);
+        static void runningChanged(GObject *client, GParamSpec *pspec, gpointer user_data);
     };
 }
 #endif // NM_CALBACKS_H
\ No newline at end of file
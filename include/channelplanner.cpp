@@ -0,0 +1,97 @@
+#include "channelplanner.h"
+#include "log.h"
+#include <cstdlib>
+
+using namespace IoT;
+
+// Non-overlapping channels go first, so they win ties
+static const unsigned ChannelsBG[] = { 1, 6, 11, 2, 3, 4, 5, 7, 8, 9, 10 };
+// Non-DFS channels only, AP mode is usually not allowed on DFS ones
+static const unsigned ChannelsA[] = { 36, 40, 44, 48 };
+
+unsigned ChannelPlanner::frequencyToChannel(unsigned frequency, Band& band)
+{
+    if (frequency == 2484) {
+        band = Band::BG;
+        return 14;
+    }
+
+    if (frequency >= 2412 && frequency <= 2472) {
+        band = Band::BG;
+        return (frequency - 2407) / 5;
+    }
+
+    if (frequency >= 5000 && frequency <= 5900) {
+        band = Band::A;
+        return (frequency - 5000) / 5;
+    }
+
+    band = Band::Auto;
+    return 0;
+}
+
+Band ChannelPlanner::bandOf(unsigned channel)
+{
+    if (channel == 0) {
+        return Band::Auto;
+    }
+    return channel <= 14 ? Band::BG : Band::A;
+}
+
+double ChannelPlanner::score(const GPtrArray* aps, Band band, unsigned channel)
+{
+    double score = 0;
+    for (int i = 0; i < aps->len; i++) {
+        NMAccessPoint* ap = NM_ACCESS_POINT(g_ptr_array_index(aps, i));
+        if (ap == NULL) {
+            continue;
+        }
+
+        Band apBand = Band::Auto;
+        unsigned apChannel = frequencyToChannel(nm_access_point_get_frequency(ap), apBand);
+        if (apBand != band) {
+            continue;
+        }
+
+        // Every AP costs airtime, strong ones cost more
+        double weight = 1.0 + nm_access_point_get_strength(ap) / 100.0;
+        int distance = std::abs((int)apChannel - (int)channel);
+
+        if (distance == 0) {
+            score += weight;
+        } else if (band == Band::BG && distance < 5) {
+            // Partially overlapping 2.4GHz channels can't coordinate medium access and interfere
+            score += weight * 1.5 * (5 - distance) / 5.0;
+        } else if (band == Band::A && distance == 4) {
+            // Adjacent 20MHz channel, matters only for wide channels
+            score += weight * 0.25;
+        }
+    }
+    return score;
+}
+
+Channel ChannelPlanner::select(NMDeviceWifi* device, Band band)
+{
+    Channel best;
+    best.band = band == Band::Auto ? Band::BG : band;
+
+    const unsigned* candidates = ChannelsBG;
+    size_t count = sizeof(ChannelsBG) / sizeof(ChannelsBG[0]);
+    if (best.band == Band::A) {
+        candidates = ChannelsA;
+        count = sizeof(ChannelsA) / sizeof(ChannelsA[0]);
+    }
+
+    const GPtrArray* aps = nm_device_wifi_get_access_points(device);
+    double bestScore = 0;
+    for (size_t i = 0; i < count; ++i) {
+        double s = score(aps, best.band, candidates[i]);
+        if (best.number == 0 || s < bestScore) {
+            best.number = candidates[i];
+            bestScore = s;
+        }
+    }
+
+    LOG_DEBUG << "Selected channel " << best.number << " with score " << bestScore;
+    return best;
+}
@@ -0,0 +1,23 @@
+#ifndef IOT_CHANNEL_PLANNER_H
+#define IOT_CHANNEL_PLANNER_H
+
+#include <NetworkManager.h>
+#include "wifinetwork.h"
+
+namespace IoT
+{
+    struct ChannelPlanner
+    {
+        // Picks the least congested channel using last scan results of the device
+        static Channel select(NMDeviceWifi* device, Band band);
+
+        static double score(const GPtrArray* aps, Band band, unsigned channel);
+
+        static unsigned frequencyToChannel(unsigned frequency, Band& band);
+
+        // Band a channel number belongs to, 2.4GHz channels end at 14
+        static Band bandOf(unsigned channel);
+    };
+}
+
+#endif // IOT_CHANNEL_PLANNER_H
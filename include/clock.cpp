@@ -0,0 +1,107 @@
+#include "clock.h"
+#include <atomic>
+#include <thread>
+
+using namespace IoT;
+
+static SystemClock s_system;
+static std::atomic<Clock*> s_clock(&s_system);
+
+Clock& Clock::instance()
+{
+    return *s_clock.load();
+}
+
+void Clock::setInstance(Clock* clock)
+{
+    s_clock = clock != NULL ? clock : &s_system;
+}
+
+Clock::TimePoint SystemClock::now() const
+{
+    return std::chrono::steady_clock::now();
+}
+
+void SystemClock::sleepUntil(TimePoint deadline)
+{
+    std::this_thread::sleep_until(deadline);
+}
+
+bool SystemClock::waitUntil(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TimePoint deadline)
+{
+    return cv.wait_until(lock, deadline) == std::cv_status::no_timeout;
+}
+
+VirtualClock::VirtualClock()
+    : m_now(std::chrono::steady_clock::now())
+{
+}
+
+Clock::TimePoint VirtualClock::now() const
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    return m_now;
+}
+
+void VirtualClock::sleepUntil(TimePoint deadline)
+{
+    std::unique_lock<std::mutex> lock(m_mx);
+    auto pos = m_deadlines.insert(deadline);
+    m_cv.wait(lock, [this, deadline]() { return m_now >= deadline; });
+    m_deadlines.erase(pos);
+}
+
+bool VirtualClock::waitUntil(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TimePoint deadline)
+{
+    std::multiset<TimePoint>::iterator pos;
+    {
+        std::lock_guard<std::mutex> own(m_mx);
+        if (m_now >= deadline) {
+            return false;
+        }
+        pos = m_deadlines.insert(deadline);
+    }
+
+    // Notification of the foreign condition can't be told from a spurious wakeup,
+    // short real time slices let the caller recheck both
+    cv.wait_for(lock, std::chrono::milliseconds(1));
+
+    std::lock_guard<std::mutex> own(m_mx);
+    m_deadlines.erase(pos);
+    return m_now < deadline;
+}
+
+void VirtualClock::advance(Duration step)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        m_now += step;
+    }
+    m_cv.notify_all();
+}
+
+bool VirtualClock::advanceToNext(Duration limit)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        if (m_deadlines.empty()) {
+            return false;
+        }
+
+        TimePoint next = *m_deadlines.begin();
+        if (next > m_now + limit) {
+            next = m_now + limit;
+        }
+        if (next > m_now) {
+            m_now = next;
+        }
+    }
+    m_cv.notify_all();
+    return true;
+}
+
+size_t VirtualClock::waiting() const
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    return m_deadlines.size();
+}
@@ -0,0 +1,66 @@
+#ifndef IOT_CLOCK_H
+#define IOT_CLOCK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+
+namespace IoT
+{
+    // Source of time for all waits and timers of the library, replaceable to run in simulated time
+    class Clock
+    {
+    public:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+        typedef std::chrono::steady_clock::duration Duration;
+
+        virtual ~Clock() {}
+
+        virtual TimePoint now() const = 0;
+        virtual void sleepUntil(TimePoint deadline) = 0;
+        // False on timeout. May return early, callers recheck their condition
+        virtual bool waitUntil(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TimePoint deadline) = 0;
+
+        void sleepFor(Duration duration)
+        {
+            sleepUntil(now() + duration);
+        }
+
+        // Must be replaced before NetworkManager or WiFi is created. NULL restores the system clock
+        static Clock& instance();
+        static void setInstance(Clock* clock);
+    };
+
+    class SystemClock: public Clock
+    {
+    public:
+        TimePoint now() const override;
+        void sleepUntil(TimePoint deadline) override;
+        bool waitUntil(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TimePoint deadline) override;
+    };
+
+    // Time stands still until advanced, sleepers wake up once their deadline is reached
+    class VirtualClock: public Clock
+    {
+    public:
+        VirtualClock();
+
+        TimePoint now() const override;
+        void sleepUntil(TimePoint deadline) override;
+        bool waitUntil(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TimePoint deadline) override;
+
+        void advance(Duration step);
+        // Jumps to the earliest deadline of a waiting thread, but not further than limit.
+        // False when nobody waits for time
+        bool advanceToNext(Duration limit);
+        size_t waiting() const;
+    private:
+        mutable std::mutex m_mx;
+        std::condition_variable m_cv;
+        TimePoint m_now;
+        std::multiset<TimePoint> m_deadlines;
+    };
+}
+
+#endif // IOT_CLOCK_H
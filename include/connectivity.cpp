@@ -0,0 +1,429 @@
+#include "connectivity.h"
+#include "log.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace IoT;
+
+namespace
+{
+    struct Socket
+    {
+        int fd = -1;
+        ~Socket() { reset(); }
+        void reset()
+        {
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    };
+
+    // Empty iface leaves the route to the kernel
+    int openSocket(int type, const in_addr& addr, unsigned short port, const std::string& iface)
+    {
+        int fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+
+        if (!iface.empty() && setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, iface.c_str(), iface.size()) < 0) {
+            LOG_WARN << "Can't bind probe to " << iface << ": " << strerror(errno);
+            close(fd);
+            return -1;
+        }
+
+        sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        sa.sin_addr = addr;
+        if (connect(fd, (sockaddr*)&sa, sizeof(sa)) < 0 && errno != EINPROGRESS) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Read without streams, it runs on every probe of a host name
+    bool defaultNameserver(in_addr& addr)
+    {
+        char buf[4096];
+        int fd = open("/etc/resolv.conf", O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        ssize_t len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len <= 0) {
+            return false;
+        }
+        buf[len] = 0;
+
+        static const char Key[] = "nameserver";
+        for (char* line = buf; line != NULL && *line != 0; ) {
+            char* next = strchr(line, '\n');
+            if (next != NULL) {
+                *next++ = 0;
+            }
+            line += strspn(line, " \t");
+            if (strncmp(line, Key, sizeof(Key) - 1) == 0 && (line[sizeof(Key) - 1] == ' ' || line[sizeof(Key) - 1] == '\t')) {
+                char* value = line + sizeof(Key) - 1;
+                value += strspn(value, " \t");
+                value[strcspn(value, " \t\r")] = 0;
+                if (inet_pton(AF_INET, value, &addr) == 1) {
+                    return true;
+                }
+            }
+            line = next;
+        }
+        return false;
+    }
+
+    size_t buildQuery(unsigned char* buf, size_t size, const std::string& name, uint16_t id)
+    {
+        if (name.size() + 18 > size) {
+            return 0;
+        }
+
+        size_t pos = 0;
+        buf[pos++] = id >> 8;
+        buf[pos++] = id & 0xFF;
+        buf[pos++] = 0x01; // Recursion desired
+        buf[pos++] = 0x00;
+        buf[pos++] = 0x00;
+        buf[pos++] = 0x01; // One question
+        memset(buf + pos, 0, 6);
+        pos += 6;
+
+        size_t start = 0;
+        while (start <= name.size()) {
+            size_t end = name.find('.', start);
+            if (end == std::string::npos) {
+                end = name.size();
+            }
+            size_t len = end - start;
+            if (len == 0 || len > 63) {
+                return 0;
+            }
+            buf[pos++] = (unsigned char)len;
+            memcpy(buf + pos, name.data() + start, len);
+            pos += len;
+            start = end + 1;
+        }
+        buf[pos++] = 0;
+        buf[pos++] = 0x00;
+        buf[pos++] = 0x01; // A
+        buf[pos++] = 0x00;
+        buf[pos++] = 0x01; // IN
+        return pos;
+    }
+
+    bool skipName(const unsigned char* buf, size_t len, size_t& pos)
+    {
+        while (pos < len) {
+            unsigned char l = buf[pos];
+            if ((l & 0xC0) == 0xC0) {
+                pos += 2;
+                return pos <= len;
+            }
+            pos += l + 1;
+            if (l == 0) {
+                return pos <= len;
+            }
+        }
+        return false;
+    }
+
+    bool parseAnswer(const unsigned char* buf, size_t len, uint16_t id, in_addr& addr)
+    {
+        if (len < 12 || ((buf[0] << 8) | buf[1]) != id || !(buf[2] & 0x80) || (buf[3] & 0x0F) != 0) {
+            return false;
+        }
+
+        int questions = (buf[4] << 8) | buf[5];
+        int answers = (buf[6] << 8) | buf[7];
+        size_t pos = 12;
+        for (int i = 0; i < questions; ++i) {
+            if (!skipName(buf, len, pos)) {
+                return false;
+            }
+            pos += 4;
+        }
+
+        for (int i = 0; i < answers; ++i) {
+            if (!skipName(buf, len, pos) || pos + 10 > len) {
+                return false;
+            }
+            int type = (buf[pos] << 8) | buf[pos + 1];
+            size_t dataLen = (buf[pos + 8] << 8) | buf[pos + 9];
+            pos += 10;
+            if (pos + dataLen > len) {
+                return false;
+            }
+            if (type == 1 && dataLen == 4) {
+                memcpy(&addr, buf + pos, 4);
+                return true;
+            }
+            pos += dataLen;
+        }
+        return false;
+    }
+
+    int statusCode(const std::string& response)
+    {
+        // HTTP/1.1 204 No Content
+        size_t space = response.find(' ');
+        if (response.compare(0, 5, "HTTP/") != 0 || space == std::string::npos) {
+            return -1;
+        }
+        return atoi(response.c_str() + space + 1);
+    }
+}
+
+ConnectivityChecker::ConnectivityChecker()
+    : m_ids(std::random_device()())
+{
+    m_thread = std::thread([this]() { run(); });
+}
+
+ConnectivityChecker::~ConnectivityChecker()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        m_stop = true;
+        m_cv.notify_all();
+    }
+    m_thread.join();
+}
+
+void ConnectivityChecker::setConfig(const ConnectivityConfig& config)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_config = config;
+    for (auto& link : m_links) {
+        link.second.cached = false;
+        link.second.generation++;
+    }
+}
+
+ConnectivityConfig ConnectivityChecker::config() const
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    return m_config;
+}
+
+void ConnectivityChecker::onResult(std::function<void()> cb)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_onResult = std::move(cb);
+}
+
+void ConnectivityChecker::invalidate(const std::string& iface)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    auto pos = m_links.find(iface);
+    if (pos != m_links.end()) {
+        pos->second.cached = false;
+        pos->second.generation++;
+    }
+}
+
+void ConnectivityChecker::invalidate()
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    for (auto& link : m_links) {
+        link.second.cached = false;
+        link.second.generation++;
+    }
+}
+
+bool ConnectivityChecker::check(const std::string& iface, NMClient* client, bool force)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    Link& link = m_links[iface];
+    auto now = Clock::instance().now();
+    if (!force && link.cached && now - link.checked < m_config.cacheTTL) {
+        return link.available;
+    }
+
+#ifdef NM_VERSION_1_10
+    if (m_config.useNetworkManager && client != NULL &&
+        nm_client_connectivity_check_get_available(client) &&
+        nm_client_connectivity_check_get_enabled(client)) {
+        // NM checks periodically, trust it when it already knows upstream is gone
+        NMConnectivityState state = nm_client_get_connectivity(client);
+        if (state == NM_CONNECTIVITY_NONE || state == NM_CONNECTIVITY_PORTAL || state == NM_CONNECTIVITY_LIMITED) {
+            link.available = false;
+            link.cached = true;
+            link.checked = now;
+            return false;
+        }
+    }
+#endif
+
+    if (!link.requested) {
+        link.requested = true;
+        m_cv.notify_all();
+    }
+    return link.available;
+}
+
+void ConnectivityChecker::run()
+{
+    std::unique_lock<std::mutex> lock(m_mx);
+    while (!m_stop) {
+        auto pos = std::find_if(m_links.begin(), m_links.end(), [](const std::pair<const std::string, Link>& link) {
+            return link.second.requested;
+        });
+        if (pos == m_links.end()) {
+            m_cv.wait(lock);
+            continue;
+        }
+
+        // Links are never erased, the entry stays valid while unlocked
+        Link& link = pos->second;
+        unsigned generation = link.generation;
+        m_probed = m_config;
+        m_probedIface = pos->first;
+        lock.unlock();
+        bool available = probe();
+        lock.lock();
+
+        link.requested = false;
+        if (link.generation != generation) {
+            // Link changed meanwhile, the next check probes it again
+            continue;
+        }
+        link.available = available;
+        link.cached = true;
+        link.checked = Clock::instance().now();
+
+        std::function<void()> cb = m_onResult;
+        lock.unlock();
+        if (cb) {
+            cb();
+        }
+        lock.lock();
+    }
+}
+
+bool ConnectivityChecker::probe()
+{
+    const ConnectivityConfig& config = m_probed;
+    static const std::string AnyInterface;
+    const std::string& iface = config.bindToInterface ? m_probedIface : AnyInterface;
+    // Sockets are polled in real time whatever clock is used
+    auto deadline = std::chrono::steady_clock::now() + config.timeout;
+
+    Socket dns, http;
+    uint16_t id = (uint16_t)m_ids();
+    in_addr target;
+    bool requestSent = false;
+    std::string& response = m_response;
+    response.clear();
+
+    if (inet_pton(AF_INET, config.host.c_str(), &target) == 1) {
+        http.fd = openSocket(SOCK_STREAM, target, config.port, iface);
+    } else {
+        in_addr server;
+        if (!(config.dnsServer.empty() ? defaultNameserver(server) : inet_pton(AF_INET, config.dnsServer.c_str(), &server) == 1)) {
+            LOG_ERROR << "No DNS server available";
+            return false;
+        }
+
+        unsigned char query[512];
+        size_t len = buildQuery(query, sizeof(query), config.host, id);
+        dns.fd = openSocket(SOCK_DGRAM, server, 53, iface);
+        if (len == 0 || dns.fd < 0 || send(dns.fd, query, len, 0) != (ssize_t)len) {
+            LOG_ERROR << "Can't send DNS query for " << config.host;
+            return false;
+        }
+    }
+
+    while (dns.fd >= 0 || http.fd >= 0) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0) {
+            LOG_DEBUG << "Connectivity probe timed out";
+            return false;
+        }
+
+        pollfd fds[2];
+        nfds_t count = 0;
+        if (dns.fd >= 0) {
+            fds[count++] = pollfd { dns.fd, POLLIN, 0 };
+        }
+        if (http.fd >= 0) {
+            fds[count++] = pollfd { http.fd, (short)(requestSent ? POLLIN : POLLOUT), 0 };
+        }
+
+        int ready = poll(fds, count, (int)remaining);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            return false;
+        }
+
+        for (nfds_t i = 0; i < count; ++i) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+
+            if (fds[i].fd == dns.fd) {
+                unsigned char answer[512];
+                ssize_t len = recv(dns.fd, answer, sizeof(answer), 0);
+                if (len < 0 && errno == EAGAIN) {
+                    continue;
+                }
+                dns.reset();
+                if (len <= 0 || !parseAnswer(answer, len, id, target)) {
+                    LOG_DEBUG << "Can't resolve " << config.host;
+                    return false;
+                }
+                http.fd = openSocket(SOCK_STREAM, target, config.port, iface);
+                if (http.fd < 0) {
+                    return false;
+                }
+            } else if (!requestSent) {
+                int error = 0;
+                socklen_t size = sizeof(error);
+                if (getsockopt(http.fd, SOL_SOCKET, SO_ERROR, &error, &size) < 0 || error != 0) {
+                    LOG_DEBUG << "Can't connect to " << config.host << ":" << config.port;
+                    return false;
+                }
+                std::string& request = m_request;
+                request.assign("GET ").append(config.path).append(" HTTP/1.1\r\nHost: ").append(config.host);
+                request.append("\r\nConnection: close\r\n\r\n");
+                if (send(http.fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size()) {
+                    return false;
+                }
+                requestSent = true;
+            } else {
+                char buf[256];
+                ssize_t len = recv(http.fd, buf, sizeof(buf), 0);
+                if (len < 0 && errno == EAGAIN) {
+                    continue;
+                }
+                if (len > 0) {
+                    response.append(buf, len);
+                }
+                if (len <= 0 || response.find("\r\n") != std::string::npos) {
+                    http.reset();
+                    return statusCode(response) == config.expectedStatus;
+                }
+            }
+        }
+    }
+    return false;
+}
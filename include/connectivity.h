@@ -0,0 +1,67 @@
+#ifndef IOT_CONNECTIVITY_H
+#define IOT_CONNECTIVITY_H
+
+#include <NetworkManager.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "wifinetwork.h"
+#include "clock.h"
+
+namespace IoT
+{
+    // Probes upstream per interface on its own thread, callers only read the cached results
+    class ConnectivityChecker
+    {
+    public:
+        ConnectivityChecker();
+        ~ConnectivityChecker();
+
+        void setConfig(const ConnectivityConfig& config);
+        ConnectivityConfig config() const;
+        // Called on the probing thread whenever a probe of an interface finished
+        void onResult(std::function<void()> cb);
+
+        // Last result of the interface, false until its first probe finished. A stale result
+        // starts a probe in the background and is returned meanwhile
+        bool check(const std::string& iface, NMClient* client, bool force = false);
+        // Result of the interface is stale, the link behind it changed
+        void invalidate(const std::string& iface);
+        void invalidate();
+    private:
+        struct Link
+        {
+            bool cached = false;
+            bool available = false;
+            bool requested = false;
+            unsigned generation = 0; // Bumped by invalidate, a probe of an older one isn't cached
+            Clock::TimePoint checked;
+        };
+
+        void run();
+        // Resolves the host with a DNS probe and fetches the path, both share the timeout
+        bool probe();
+
+        mutable std::mutex m_mx;
+        std::condition_variable m_cv;
+        ConnectivityConfig m_config;
+        std::unordered_map<std::string, Link> m_links;
+        std::function<void()> m_onResult;
+        bool m_stop = false;
+
+        // Used by the probing thread only, buffers keep their capacity
+        ConnectivityConfig m_probed; // Snapshot of m_config for the running probe
+        std::string m_probedIface;
+        std::string m_request;
+        std::string m_response;
+        std::minstd_rand m_ids; // DNS query ids
+        std::thread m_thread;
+    };
+}
+
+#endif // IOT_CONNECTIVITY_H
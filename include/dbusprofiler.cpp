@@ -0,0 +1,196 @@
+#include "dbusprofiler.h"
+#include "log.h"
+#include <algorithm>
+
+using namespace IoT;
+
+// Innermost scope of the thread, only while profiling is attached
+static thread_local DBusProfiler::Scope* t_scope = NULL;
+
+static void worst(DBusCost& worst, const DBusCost& cost)
+{
+    worst.messages = std::max(worst.messages, cost.messages);
+    worst.calls = std::max(worst.calls, cost.calls);
+    worst.replies = std::max(worst.replies, cost.replies);
+    worst.signals = std::max(worst.signals, cost.signals);
+    worst.blocking = std::max(worst.blocking, cost.blocking);
+    worst.elapsed = std::max(worst.elapsed, cost.elapsed);
+    worst.blocked = std::max(worst.blocked, cost.blocked);
+}
+
+static void add(DBusCost& total, const DBusCost& cost)
+{
+    total.messages += cost.messages;
+    total.calls += cost.calls;
+    total.replies += cost.replies;
+    total.signals += cost.signals;
+    total.blocking += cost.blocking;
+    total.elapsed += cost.elapsed;
+    total.blocked += cost.blocked;
+}
+
+DBusProfiler::Scope::Scope(DBusProfiler& profiler, const char* operation)
+    : m_profiler(NULL)
+    , m_operation(operation)
+    , m_outer(t_scope)
+{
+    if (!profiler.m_attached || t_scope != NULL) {
+        return;
+    }
+
+    m_profiler = &profiler;
+    m_started = std::chrono::steady_clock::now();
+    t_scope = this;
+    profiler.open(this);
+}
+
+DBusProfiler::Scope::~Scope()
+{
+    if (m_profiler == NULL) {
+        return;
+    }
+
+    t_scope = m_outer;
+    m_cost.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_started);
+    m_profiler->close(this);
+}
+
+DBusProfiler::Blocking::Blocking()
+    : m_scope(t_scope)
+    , m_started(std::chrono::steady_clock::now())
+{
+}
+
+DBusProfiler::Blocking::~Blocking()
+{
+    if (m_scope == NULL) {
+        return;
+    }
+
+    auto blocked = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_started);
+    std::lock_guard<std::mutex> lock(m_scope->m_profiler->m_mx);
+    m_scope->m_cost.blocking++;
+    m_scope->m_cost.blocked += blocked;
+}
+
+DBusProfiler::DBusProfiler()
+    : m_attached(false)
+{
+}
+
+DBusProfiler::~DBusProfiler()
+{
+    detach();
+}
+
+void DBusProfiler::attach(GDBusConnection* connection)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_connection != NULL || connection == NULL) {
+        return;
+    }
+
+    m_connection = (GDBusConnection*)g_object_ref(connection);
+    m_filter = g_dbus_connection_add_filter(m_connection, DBusProfiler::filter, this, NULL);
+    m_attached = true;
+}
+
+void DBusProfiler::detach()
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_connection == NULL) {
+        return;
+    }
+
+    m_attached = false;
+    g_dbus_connection_remove_filter(m_connection, m_filter);
+    g_object_unref(m_connection);
+    m_connection = NULL;
+    m_filter = 0;
+}
+
+bool DBusProfiler::isAttached() const
+{
+    return m_attached;
+}
+
+void DBusProfiler::setBudget(const std::string& operation, const DBusBudget& budget)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_budgets[operation] = budget;
+}
+
+std::vector<DBusOperationStats> DBusProfiler::statistics() const
+{
+    std::vector<DBusOperationStats> stats;
+    std::lock_guard<std::mutex> lock(m_mx);
+    stats.reserve(m_stats.size());
+    for (const auto& op : m_stats) {
+        stats.push_back(op.second);
+    }
+    std::sort(stats.begin(), stats.end(), [](const DBusOperationStats& a, const DBusOperationStats& b) {
+        return a.operation < b.operation;
+    });
+    return stats;
+}
+
+void DBusProfiler::reset()
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_stats.clear();
+}
+
+GDBusMessage* DBusProfiler::filter(GDBusConnection*, GDBusMessage* message, gboolean incoming, gpointer data)
+{
+    ((DBusProfiler*)data)->count(g_dbus_message_get_message_type(message), incoming);
+    return message;
+}
+
+void DBusProfiler::count(GDBusMessageType type, bool incoming)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    for (Scope* scope : m_open) {
+        DBusCost& cost = scope->m_cost;
+        cost.messages++;
+        if (!incoming && type == G_DBUS_MESSAGE_TYPE_METHOD_CALL) {
+            cost.calls++;
+        } else if (incoming && (type == G_DBUS_MESSAGE_TYPE_METHOD_RETURN || type == G_DBUS_MESSAGE_TYPE_ERROR)) {
+            cost.replies++;
+        } else if (incoming && type == G_DBUS_MESSAGE_TYPE_SIGNAL) {
+            cost.signals++;
+        }
+    }
+}
+
+void DBusProfiler::open(Scope* scope)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_open.push_back(scope);
+}
+
+void DBusProfiler::close(Scope* scope)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_open.erase(std::remove(m_open.begin(), m_open.end(), scope), m_open.end());
+
+    DBusOperationStats& stats = m_stats[scope->m_operation];
+    stats.operation = scope->m_operation;
+    stats.count++;
+    add(stats.total, scope->m_cost);
+    worst(stats.worst, scope->m_cost);
+
+    auto budget = m_budgets.find(scope->m_operation);
+    if (budget == m_budgets.end()) {
+        return;
+    }
+
+    const DBusCost& cost = scope->m_cost;
+    const DBusBudget& limit = budget->second;
+    if ((limit.calls != 0 && cost.calls > limit.calls) ||
+        (limit.blocking != 0 && cost.blocking > limit.blocking) ||
+        (limit.elapsed.count() != 0 && cost.elapsed > limit.elapsed)) {
+        stats.overBudget++;
+        LOG_WARN << "D-Bus budget exceeded by " << scope->m_operation << ": " << cost.calls << " calls, "
+                 << cost.blocking << " blocking, " << cost.elapsed.count() / 1000 << "ms";
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef IOT_DBUS_PROFILER_H
+#define IOT_DBUS_PROFILER_H
+
+#include <NetworkManager.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "wifinetwork.h"
+
+namespace IoT
+{
+    // Counts D-Bus traffic of the NM client connection per library operation.
+    // Messages are seen on GDBus worker thread, so they are attributed to every scope
+    // open at that time; operations running concurrently share their traffic.
+    class DBusProfiler
+    {
+    public:
+        // Measures one operation, nested scopes on the same thread count towards the outer one
+        class Scope
+        {
+        public:
+            Scope(DBusProfiler& profiler, const char* operation);
+            ~Scope();
+        private:
+            friend class DBusProfiler;
+            DBusProfiler* m_profiler;
+            const char* m_operation;
+            DBusCost m_cost;
+            Scope* m_outer;
+            std::chrono::steady_clock::time_point m_started;
+        };
+
+        // Marks the calling thread waiting for D-Bus, charged to its current scope
+        class Blocking
+        {
+        public:
+            Blocking();
+            ~Blocking();
+        private:
+            Scope* m_scope;
+            std::chrono::steady_clock::time_point m_started;
+        };
+
+        DBusProfiler();
+        ~DBusProfiler();
+
+        void attach(GDBusConnection* connection);
+        void detach();
+        bool isAttached() const;
+
+        // Exceeding runs are logged and counted in overBudget
+        void setBudget(const std::string& operation, const DBusBudget& budget);
+        std::vector<DBusOperationStats> statistics() const;
+        void reset();
+    private:
+        static GDBusMessage* filter(GDBusConnection* connection, GDBusMessage* message, gboolean incoming, gpointer data);
+        void count(GDBusMessageType type, bool incoming);
+        void open(Scope* scope);
+        void close(Scope* scope);
+    private:
+        mutable std::mutex m_mx;
+        std::atomic<bool> m_attached;
+        GDBusConnection* m_connection = NULL;
+        guint m_filter = 0;
+        std::vector<Scope*> m_open;
+        std::unordered_map<std::string, DBusOperationStats> m_stats;
+        std::unordered_map<std::string, DBusBudget> m_budgets;
+    };
+}
+
+#endif // IOT_DBUS_PROFILER_H
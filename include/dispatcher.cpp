@@ -0,0 +1,108 @@
+#include "dispatcher.h"
+#include "log.h"
+
+using namespace IoT;
+
+Dispatcher::Dispatcher(size_t capacity, size_t threads)
+    : m_capacity(capacity)
+{
+    for (size_t i = 0; i < threads; ++i) {
+        m_threads.emplace_back(&Dispatcher::run, this);
+    }
+}
+
+Dispatcher::~Dispatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    for (std::thread& t : m_threads) {
+        t.join();
+    }
+}
+
+void Dispatcher::post(Event event)
+{
+    post(std::string(), std::move(event));
+}
+
+void Dispatcher::post(const std::string& key, Event event)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        if (!key.empty()) {
+            for (Item& item : m_queue) {
+                if (item.key == key) {
+                    item.event = std::move(event);
+                    m_coalesced++;
+                    return;
+                }
+            }
+        }
+
+        if (m_queue.size() >= m_capacity) {
+            // Keyed events carry the latest state, prefer to lose plain ones
+            auto victim = m_queue.begin();
+            for (auto it = m_queue.begin(); it != m_queue.end(); ++it) {
+                if (it->key.empty()) {
+                    victim = it;
+                    break;
+                }
+            }
+            LOG_WARN << "Event queue is full, dropping " << (victim->key.empty() ? "event" : victim->key);
+            m_queue.erase(victim);
+            m_dropped++;
+        }
+        m_queue.push_back(Item { key, std::move(event) });
+    }
+    m_cv.notify_one();
+}
+
+size_t Dispatcher::dropped() const
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    return m_dropped;
+}
+
+size_t Dispatcher::coalesced() const
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    return m_coalesced;
+}
+
+void Dispatcher::run()
+{
+    std::unique_lock<std::mutex> lock(m_mx);
+    while (true) {
+        auto next = m_queue.end();
+        m_cv.wait(lock, [this, &next]() {
+            for (next = m_queue.begin(); next != m_queue.end(); ++next) {
+                if (next->key.empty() || m_busy.count(next->key) == 0) {
+                    break;
+                }
+            }
+            return m_stop || next != m_queue.end();
+        });
+
+        if (m_stop) {
+            return;
+        }
+
+        Item item = std::move(*next);
+        m_queue.erase(next);
+        if (!item.key.empty()) {
+            m_busy.insert(item.key);
+        }
+
+        lock.unlock();
+        item.event();
+        lock.lock();
+
+        if (!item.key.empty()) {
+            m_busy.erase(item.key);
+            m_cv.notify_all();
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef IOT_DISPATCHER_H
+#define IOT_DISPATCHER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace IoT
+{
+    // Delivers events on its own threads, so producers never wait for slow subscribers
+    class Dispatcher
+    {
+    public:
+        typedef std::function<void()> Event;
+
+        explicit Dispatcher(size_t capacity = 64, size_t threads = 1);
+        ~Dispatcher();
+
+        // Queue is bounded, the oldest event is dropped on overflow, unkeyed ones first
+        void post(Event event);
+
+        // Pending event with the same key is replaced, only the latest one is delivered.
+        // Events with the same key are never delivered concurrently.
+        void post(const std::string& key, Event event);
+
+        size_t dropped() const;
+        size_t coalesced() const;
+    private:
+        struct Item
+        {
+            std::string key;
+            Event event;
+        };
+
+        void run();
+    private:
+        mutable std::mutex m_mx;
+        std::condition_variable m_cv;
+        std::deque<Item> m_queue;
+        std::unordered_set<std::string> m_busy;
+        std::vector<std::thread> m_threads;
+        size_t m_capacity;
+        size_t m_dropped = 0;
+        size_t m_coalesced = 0;
+        bool m_stop = false;
+    };
+}
+
+#endif // IOT_DISPATCHER_H
@@ -0,0 +1,266 @@
+#include "eventlog.h"
+#include "log.h"
+#include <errno.h>
+#include <string.h>
+
+using namespace IoT;
+
+static const char Magic[4] = { 'N', 'M', 'R', 'C' };
+static const uint8_t Version = 1;
+
+static void putVarint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+static void putString(std::string& out, const std::string& value)
+{
+    putVarint(out, value.size());
+    out.append(value);
+}
+
+static void putNetwork(std::string& out, const WifiNetwork& network)
+{
+    putString(out, network.ssid);
+    putString(out, network.bssid);
+    putVarint(out, (uint64_t)network.auth);
+    putVarint(out, network.encrypted ? 1 : 0);
+    putVarint(out, (uint64_t)(network.signal < 0 ? 0 : network.signal));
+    putVarint(out, network.frequency);
+}
+
+static bool getVarint(FILE* file, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(file);
+        if (c == EOF) {
+            return false;
+        }
+        value |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool getString(FILE* file, std::string& value)
+{
+    uint64_t size = 0;
+    if (!getVarint(file, size) || size > 4096) {
+        return false;
+    }
+
+    value.resize(size);
+    return size == 0 || fread(&value[0], 1, size, file) == size;
+}
+
+static bool getNetwork(FILE* file, WifiNetwork& network)
+{
+    uint64_t auth, encrypted, signal, frequency;
+    if (!getString(file, network.ssid) || !getString(file, network.bssid) ||
+        !getVarint(file, auth) || !getVarint(file, encrypted) ||
+        !getVarint(file, signal) || !getVarint(file, frequency)) {
+        return false;
+    }
+
+    network.password.clear();
+    network.auth = (Authentication)auth;
+    network.encrypted = encrypted != 0;
+    network.signal = (int)signal;
+    network.frequency = (unsigned)frequency;
+    return true;
+}
+
+EventRecorder::EventRecorder()
+    : m_open(false)
+    , m_file(NULL)
+{
+}
+
+EventRecorder::~EventRecorder()
+{
+    close();
+}
+
+bool EventRecorder::open(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_file != NULL) {
+        return true;
+    }
+
+    m_file = fopen(path.c_str(), "wbe");
+    if (m_file == NULL) {
+        LOG_ERROR << "Can't open event log " << path << ": " << strerror(errno);
+        return false;
+    }
+
+    fwrite(Magic, 1, sizeof(Magic), m_file);
+    fputc(Version, m_file);
+    m_started = std::chrono::steady_clock::now();
+    m_last = std::chrono::microseconds(0);
+    m_open = true;
+    return true;
+}
+
+void EventRecorder::close()
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_open = false;
+    if (m_file != NULL) {
+        fclose(m_file);
+        m_file = NULL;
+    }
+}
+
+bool EventRecorder::isOpen() const
+{
+    return m_open;
+}
+
+void EventRecorder::record(const RecordedEvent& event)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_file == NULL) {
+        return;
+    }
+
+    auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_started);
+    m_buffer.clear();
+    m_buffer.push_back((char)event.type);
+    putVarint(m_buffer, (time - m_last).count());
+    putString(m_buffer, event.iface);
+    m_last = time;
+
+    switch (event.type)
+    {
+        case RecordedEvent::Link:
+            putVarint(m_buffer, event.deviceState);
+            putVarint(m_buffer, event.internet ? 1 : 0);
+            putVarint(m_buffer, (uint64_t)event.connection.mode);
+            putString(m_buffer, event.connection.uuid);
+            putString(m_buffer, event.connection.name);
+            putString(m_buffer, event.connection.ip);
+            putNetwork(m_buffer, event.connection);
+            break;
+        case RecordedEvent::Scan:
+            putVarint(m_buffer, event.networks.size());
+            for (const WifiNetwork& network : event.networks) {
+                putNetwork(m_buffer, network);
+            }
+            break;
+        case RecordedEvent::ConnectResult:
+            putVarint(m_buffer, (uint64_t)event.result);
+            break;
+    }
+
+    // Flushed per event, a log from a crashed device is still usable
+    fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+    fflush(m_file);
+}
+
+EventReader::EventReader()
+    : m_file(NULL)
+    , m_time(0)
+{
+}
+
+EventReader::~EventReader()
+{
+    close();
+}
+
+bool EventReader::open(const std::string& path)
+{
+    close();
+    m_file = fopen(path.c_str(), "rbe");
+    if (m_file == NULL) {
+        LOG_ERROR << "Can't open event log " << path << ": " << strerror(errno);
+        return false;
+    }
+
+    char magic[sizeof(Magic)];
+    if (fread(magic, 1, sizeof(magic), m_file) != sizeof(magic) || memcmp(magic, Magic, sizeof(Magic)) != 0 ||
+        fgetc(m_file) != Version) {
+        LOG_ERROR << "Unsupported event log " << path;
+        close();
+        return false;
+    }
+
+    m_time = std::chrono::microseconds(0);
+    return true;
+}
+
+void EventReader::close()
+{
+    if (m_file != NULL) {
+        fclose(m_file);
+        m_file = NULL;
+    }
+}
+
+bool EventReader::next(RecordedEvent& event)
+{
+    if (m_file == NULL) {
+        return false;
+    }
+
+    int type = fgetc(m_file);
+    if (type == EOF) {
+        return false;
+    }
+
+    uint64_t delta = 0;
+    if (!getVarint(m_file, delta) || !getString(m_file, event.iface)) {
+        return false;
+    }
+    m_time += std::chrono::microseconds(delta);
+    event.time = m_time;
+    event.type = (RecordedEvent::Type)type;
+
+    uint64_t value = 0;
+    switch (event.type)
+    {
+        case RecordedEvent::Link:
+        {
+            uint64_t state, internet, mode;
+            if (!getVarint(m_file, state) || !getVarint(m_file, internet) || !getVarint(m_file, mode) ||
+                !getString(m_file, event.connection.uuid) || !getString(m_file, event.connection.name) ||
+                !getString(m_file, event.connection.ip) || !getNetwork(m_file, event.connection)) {
+                return false;
+            }
+            event.deviceState = (unsigned)state;
+            event.internet = internet != 0;
+            event.connection.mode = (Mode)mode;
+            return true;
+        }
+        case RecordedEvent::Scan:
+        {
+            if (!getVarint(m_file, value) || value > 1024) {
+                return false;
+            }
+            event.networks.resize(value);
+            for (WifiNetwork& network : event.networks) {
+                if (!getNetwork(m_file, network)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case RecordedEvent::ConnectResult:
+            if (!getVarint(m_file, value)) {
+                return false;
+            }
+            event.result = (Result)value;
+            return true;
+    }
+
+    LOG_ERROR << "Unknown event type " << type;
+    return false;
+}
@@ -0,0 +1,75 @@
+#ifndef IOT_EVENT_LOG_H
+#define IOT_EVENT_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "networksignals.h"
+
+namespace IoT
+{
+    // Input NetworkManager observed at some point of time
+    struct RecordedEvent
+    {
+        enum Type : uint8_t
+        {
+            Link = 1,      // Tracker pass over a device
+            Scan,          // Access points seen by a scan
+            ConnectResult  // Outcome of an activation or profile creation
+        };
+
+        Type type = Link;
+        std::chrono::microseconds time; // Since recording started
+        std::string iface;
+        unsigned deviceState = 0; // Raw NMDeviceState
+        bool internet = false;
+        ActiveConnection connection;
+        std::vector<WifiNetwork> networks;
+        Result result = Result::Unknown;
+    };
+
+    // Compact binary stream: varint encoded time deltas, lengths and enums
+    class EventRecorder
+    {
+    public:
+        EventRecorder();
+        ~EventRecorder();
+
+        bool open(const std::string& path);
+        void close();
+        // Cheap enough to check before collecting data for record()
+        bool isOpen() const;
+
+        // Time of the event is set by recorder
+        void record(const RecordedEvent& event);
+    private:
+        mutable std::mutex m_mx;
+        std::atomic<bool> m_open;
+        FILE* m_file;
+        std::chrono::steady_clock::time_point m_started;
+        std::chrono::microseconds m_last;
+        std::string m_buffer;
+    };
+
+    class EventReader
+    {
+    public:
+        EventReader();
+        ~EventReader();
+
+        bool open(const std::string& path);
+        void close();
+
+        // Reuses strings and vectors of event. False at the end or on corrupted data
+        bool next(RecordedEvent& event);
+    private:
+        FILE* m_file;
+        std::chrono::microseconds m_time;
+    };
+}
+
+#endif // IOT_EVENT_LOG_H
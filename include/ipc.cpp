@@ -0,0 +1,119 @@
+#include "ipc.h"
+#include <stdlib.h>
+#include <string.h>
+
+using namespace IoT;
+
+const char* const Ipc::DefaultSocket = "/run/iotwifi.sock";
+
+static void putLength(std::string& out, uint32_t value)
+{
+    out.append((const char*)&value, sizeof(value));
+}
+
+static uint32_t getLength(const std::string& in, size_t pos)
+{
+    uint32_t value;
+    memcpy(&value, in.data() + pos, sizeof(value));
+    return value;
+}
+
+void Ipc::encode(const Fields& fields, std::string& out)
+{
+    size_t start = out.size();
+    putLength(out, 0);
+    for (const std::string& field : fields) {
+        putLength(out, field.size());
+        out.append(field);
+    }
+
+    uint32_t length = out.size() - start - sizeof(uint32_t);
+    memcpy(&out[start], &length, sizeof(length));
+}
+
+bool Ipc::decode(std::string& buffer, Fields& fields, bool& ok)
+{
+    ok = true;
+    if (buffer.size() < sizeof(uint32_t)) {
+        return false;
+    }
+
+    uint32_t length = getLength(buffer, 0);
+    if (length > MaxFrame) {
+        ok = false;
+        return false;
+    }
+
+    size_t end = sizeof(uint32_t) + length;
+    if (buffer.size() < end) {
+        return false;
+    }
+
+    fields.clear();
+    for (size_t pos = sizeof(uint32_t); pos < end;) {
+        if (end - pos < sizeof(uint32_t)) {
+            ok = false;
+            return false;
+        }
+
+        uint32_t size = getLength(buffer, pos);
+        pos += sizeof(uint32_t);
+        if (size > end - pos) {
+            ok = false;
+            return false;
+        }
+        fields.emplace_back(buffer, pos, size);
+        pos += size;
+    }
+
+    buffer.erase(0, end);
+    return true;
+}
+
+void Ipc::putNetwork(Fields& fields, const WifiNetwork& network)
+{
+    fields.push_back(network.ssid);
+    fields.push_back(network.bssid);
+    fields.push_back(std::to_string((int)network.auth));
+    fields.push_back(network.encrypted ? "1" : "0");
+    fields.push_back(std::to_string(network.signal));
+    fields.push_back(std::to_string(network.frequency));
+}
+
+bool Ipc::getNetwork(const Fields& fields, size_t& pos, WifiNetwork& network)
+{
+    if (fields.size() < pos + 6) {
+        return false;
+    }
+
+    network.ssid = fields[pos];
+    network.bssid = fields[pos + 1];
+    network.auth = (Authentication)atoi(fields[pos + 2].c_str());
+    network.encrypted = fields[pos + 3] == "1";
+    network.signal = atoi(fields[pos + 4].c_str());
+    network.frequency = strtoul(fields[pos + 5].c_str(), NULL, 10);
+    pos += 6;
+    return true;
+}
+
+void Ipc::putConnection(Fields& fields, const Connection& connection)
+{
+    fields.push_back(std::to_string((int)connection.mode));
+    fields.push_back(connection.uuid);
+    fields.push_back(connection.name);
+    fields.push_back(connection.ip);
+}
+
+bool Ipc::getConnection(const Fields& fields, size_t& pos, Connection& connection)
+{
+    if (fields.size() < pos + 4) {
+        return false;
+    }
+
+    connection.mode = (Mode)atoi(fields[pos].c_str());
+    connection.uuid = fields[pos + 1];
+    connection.name = fields[pos + 2];
+    connection.ip = fields[pos + 3];
+    pos += 4;
+    return true;
+}
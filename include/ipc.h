@@ -0,0 +1,34 @@
+#ifndef IOT_IPC_H
+#define IOT_IPC_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "networksignals.h"
+
+namespace IoT
+{
+    // Framing shared by NetworkDaemon and NetworkClient. A frame is a 32 bit length followed by
+    // length prefixed fields. Requests are [id, method, args...], responses [">", id, status, results...],
+    // pushed events ["!", name, args...]
+    struct Ipc
+    {
+        typedef std::vector<std::string> Fields;
+
+        static const char* const DefaultSocket;
+        static const size_t MaxFrame = 1 << 20;
+
+        // Appends the frame to out
+        static void encode(const Fields& fields, std::string& out);
+        // Takes a complete frame from the front of buffer. False when more data is needed
+        // or the frame is malformed, ok tells which
+        static bool decode(std::string& buffer, Fields& fields, bool& ok);
+
+        static void putNetwork(Fields& fields, const WifiNetwork& network);
+        static bool getNetwork(const Fields& fields, size_t& pos, WifiNetwork& network);
+        static void putConnection(Fields& fields, const Connection& connection);
+        static bool getConnection(const Fields& fields, size_t& pos, Connection& connection);
+    };
+}
+
+#endif // IOT_IPC_H
@@ -0,0 +1,278 @@
+#include "networkclient.h"
+#include "log.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace IoT;
+
+NetworkClient::NetworkClient()
+    : m_connected(false)
+    , m_timeout(300) // Connecting tries for minutes before giving up
+{
+}
+
+NetworkClient::~NetworkClient()
+{
+    disconnect();
+}
+
+bool NetworkClient::connect(const std::string& path)
+{
+    if (m_connected) {
+        return true;
+    }
+    // Daemon may have dropped us, its reader has returned but left the thread and socket
+    disconnect();
+
+    sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(sa.sun_path)) {
+        LOG_ERROR << "Socket path is too long: " << path;
+        return false;
+    }
+    strncpy(sa.sun_path, path.c_str(), sizeof(sa.sun_path) - 1);
+
+    m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_fd < 0 || ::connect(m_fd, (sockaddr*)&sa, sizeof(sa)) < 0) {
+        LOG_ERROR << "Can't connect to " << path << ": " << strerror(errno);
+        if (m_fd >= 0) {
+            close(m_fd);
+            m_fd = -1;
+        }
+        return false;
+    }
+
+    m_connected = true;
+    m_reader = std::thread(&NetworkClient::run, this);
+    return true;
+}
+
+void NetworkClient::disconnect()
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    shutdown(m_fd, SHUT_RDWR);
+    if (m_reader.joinable()) {
+        m_reader.join();
+    }
+    close(m_fd);
+    m_fd = -1;
+}
+
+bool NetworkClient::isConnected() const
+{
+    return m_connected;
+}
+
+void NetworkClient::setTimeout(std::chrono::seconds timeout)
+{
+    m_timeout = timeout;
+}
+
+bool NetworkClient::call(const Ipc::Fields& request, Ipc::Fields& results)
+{
+    Call call;
+    Ipc::Fields fields;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        if (!m_connected) {
+            return false;
+        }
+        fields.push_back(std::to_string(m_nextId++));
+        m_calls[fields[0]] = &call;
+    }
+    fields.insert(fields.end(), request.begin(), request.end());
+
+    std::string frame;
+    Ipc::encode(fields, frame);
+    bool sent = true;
+    {
+        std::lock_guard<std::mutex> lock(m_writeMx);
+        for (size_t offset = 0; offset < frame.size();) {
+            ssize_t written = send(m_fd, frame.data() + offset, frame.size() - offset, MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                sent = false;
+                break;
+            }
+            offset += written;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(m_mx);
+    if (sent) {
+        m_cv.wait_for(lock, m_timeout, [&call]() { return call.done; });
+    }
+    m_calls.erase(fields[0]);
+
+    if (!call.done) {
+        LOG_WARN << "No answer to " << request[0];
+    }
+    results.swap(call.results);
+    return call.ok;
+}
+
+void NetworkClient::run()
+{
+    std::string buffer;
+    char data[4096];
+    while (true) {
+        ssize_t got = recv(m_fd, data, sizeof(data), 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        buffer.append(data, got);
+
+        Ipc::Fields fields;
+        bool ok = true;
+        while (Ipc::decode(buffer, fields, ok)) {
+            if (fields.size() >= 3 && fields[0] == ">") {
+                std::lock_guard<std::mutex> lock(m_mx);
+                auto pos = m_calls.find(fields[1]);
+                if (pos != m_calls.end()) {
+                    pos->second->ok = fields[2] == "ok";
+                    pos->second->results.assign(fields.begin() + 3, fields.end());
+                    pos->second->done = true;
+                    m_cv.notify_all();
+                }
+            } else if (fields.size() >= 2 && fields[0] == "!") {
+                event(fields);
+            }
+        }
+
+        if (!ok) {
+            LOG_ERROR << "Malformed frame from daemon";
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_connected = false;
+    for (auto& call : m_calls) {
+        call.second->done = true;
+    }
+    m_cv.notify_all();
+}
+
+void NetworkClient::event(const Ipc::Fields& fields)
+{
+    const std::string& name = fields[1];
+    if (name == "connection" && fields.size() > 2) {
+        ActiveConnection connection;
+        size_t pos = 3;
+        if (Ipc::getConnection(fields, pos, connection) && Ipc::getNetwork(fields, pos, connection)) {
+            ActiveConnectionChanged.emit(fields[2], connection);
+        }
+    } else if (name == "internet" && fields.size() > 2) {
+        InternetConnectionAvailable.set(fields[2] == "1");
+    } else if (name == "result" && fields.size() > 2) {
+        LastConnectResult.set((Result)atoi(fields[2].c_str()));
+    }
+}
+
+bool NetworkClient::subscribe()
+{
+    Ipc::Fields results;
+    return call(Ipc::Fields { "subscribe" }, results);
+}
+
+std::vector<std::string> NetworkClient::devices()
+{
+    Ipc::Fields results;
+    call(Ipc::Fields { "devices" }, results);
+    return results;
+}
+
+std::vector<WifiNetwork> NetworkClient::scan(const std::string& interface, bool force)
+{
+    std::vector<WifiNetwork> networks;
+    Ipc::Fields results;
+    if (call(Ipc::Fields { "scan", interface, force ? "1" : "0" }, results)) {
+        WifiNetwork network;
+        for (size_t pos = 0; Ipc::getNetwork(results, pos, network);) {
+            networks.push_back(network);
+        }
+    }
+    return networks;
+}
+
+std::vector<Connection> NetworkClient::connections()
+{
+    std::vector<Connection> connections;
+    Ipc::Fields results;
+    if (call(Ipc::Fields { "connections" }, results)) {
+        Connection connection;
+        for (size_t pos = 0; Ipc::getConnection(results, pos, connection);) {
+            connections.push_back(connection);
+        }
+    }
+    return connections;
+}
+
+Connection NetworkClient::activeConnection(const std::string& interface)
+{
+    Connection connection = {};
+    Ipc::Fields results;
+    size_t pos = 0;
+    if (call(Ipc::Fields { "active", interface }, results)) {
+        Ipc::getConnection(results, pos, connection);
+    }
+    return connection;
+}
+
+WifiNetwork NetworkClient::activeNetwork(const std::string& interface)
+{
+    ActiveConnection active;
+    Ipc::Fields results;
+    size_t pos = 0;
+    if (call(Ipc::Fields { "active", interface }, results)) {
+        Ipc::getConnection(results, pos, active) && Ipc::getNetwork(results, pos, active);
+    }
+    return active;
+}
+
+bool NetworkClient::activateConnection(const std::string& uuid, const std::string& iface)
+{
+    Ipc::Fields results;
+    if (!call(Ipc::Fields { "activate", uuid, iface }, results) || results.size() < 2) {
+        return false;
+    }
+    return results[0] == "1";
+}
+
+Result NetworkClient::connectoToNetwork(const std::string& iface, const WifiNetwork& wifi)
+{
+    Ipc::Fields results;
+    Ipc::Fields request { "connect", iface, wifi.ssid, wifi.password, std::to_string((int)wifi.auth) };
+    if (!call(request, results) || results.empty()) {
+        return Result::InternalError;
+    }
+    return (Result)atoi(results[0].c_str());
+}
+
+Result NetworkClient::createHotspot(const std::string& iface, const WifiNetwork& wifi, Channel channel, std::string* uuid)
+{
+    Ipc::Fields results;
+    Ipc::Fields request { "hotspot", iface, wifi.ssid, wifi.password, std::to_string((int)wifi.auth),
+                          std::to_string((int)channel.band), std::to_string(channel.number) };
+    if (!call(request, results) || results.size() < 2) {
+        return Result::InternalError;
+    }
+
+    if (uuid) {
+        *uuid = results[1];
+    }
+    return (Result)atoi(results[0].c_str());
+}
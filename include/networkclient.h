@@ -0,0 +1,66 @@
+#ifndef IOT_NETWORK_CLIENT_H
+#define IOT_NETWORK_CLIENT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "ipc.h"
+
+namespace IoT
+{
+    // Talks to a NetworkDaemon running in another process, doesn't need libnm.
+    // Calls block until the daemon answers, pushed state is emitted on the reader thread.
+    class NetworkClient: public NetworkSignals
+    {
+    public:
+        NetworkClient();
+        ~NetworkClient();
+
+        bool connect(const std::string& path = Ipc::DefaultSocket);
+        void disconnect();
+        bool isConnected() const;
+        // Current state is pushed right away, then on every change
+        bool subscribe();
+        void setTimeout(std::chrono::seconds timeout);
+
+        std::vector<std::string> devices();
+        std::vector<WifiNetwork> scan(const std::string& interface, bool force = false);
+        std::vector<Connection> connections();
+        Connection activeConnection(const std::string& interface);
+        WifiNetwork activeNetwork(const std::string& interface);
+        bool activateConnection(const std::string& uuid, const std::string& iface = std::string());
+        Result connectoToNetwork(const std::string& iface, const WifiNetwork& wifi);
+        Result createHotspot(const std::string& iface, const WifiNetwork& wifi, Channel channel = Channel(), std::string* uuid = NULL);
+
+        SignalSlot::Signal<std::string, ActiveConnection> ActiveConnectionChanged;
+    private:
+        struct Call
+        {
+            bool done = false;
+            bool ok = false;
+            Ipc::Fields results;
+        };
+
+        // Results are the fields after status
+        bool call(const Ipc::Fields& request, Ipc::Fields& results);
+        void run();
+        void event(const Ipc::Fields& fields);
+    private:
+        int m_fd = -1;
+        std::atomic<bool> m_connected;
+        std::thread m_reader;
+        std::mutex m_writeMx;
+        std::mutex m_mx;
+        std::condition_variable m_cv;
+        std::unordered_map<std::string, Call*> m_calls;
+        uint64_t m_nextId = 1;
+        std::chrono::seconds m_timeout;
+    };
+}
+
+#endif // IOT_NETWORK_CLIENT_H
@@ -0,0 +1,487 @@
+#include "networkdaemon.h"
+#include "networkmanager.h"
+#include "log.h"
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace IoT;
+
+static const size_t MaxClients = 32;
+static const size_t MaxPending = 256; // Frames queued for a slow client before it is dropped
+static const size_t MaxOutbox = 1024; // Frames waiting for the daemon thread, a client whose frame doesn't fit is dropped
+
+NetworkDaemon::NetworkDaemon()
+    : m_running(false)
+    , m_count(0)
+    , m_workers(64, 2)
+{
+}
+
+NetworkDaemon::~NetworkDaemon()
+{
+    stop();
+}
+
+bool NetworkDaemon::start(const std::string& path)
+{
+    if (m_running) {
+        return true;
+    }
+
+    sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(sa.sun_path)) {
+        LOG_ERROR << "Socket path is too long: " << path;
+        return false;
+    }
+    strncpy(sa.sun_path, path.c_str(), sizeof(sa.sun_path) - 1);
+
+    unlink(path.c_str());
+    m_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listen < 0 || bind(m_listen, (sockaddr*)&sa, sizeof(sa)) < 0 || listen(m_listen, 8) < 0) {
+        LOG_ERROR << "Can't listen on " << path << ": " << strerror(errno);
+        stop();
+        return false;
+    }
+    chmod(path.c_str(), 0660);
+    m_path = path;
+
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+    if (m_epoll < 0 || m_wakeup < 0) {
+        LOG_ERROR << "Can't create epoll: " << strerror(errno);
+        stop();
+        return false;
+    }
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = m_listen;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listen, &ev);
+    ev.data.fd = m_wakeup;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev);
+
+    watch();
+    LOG_INFO << "Network daemon listens on " << path;
+    m_running = true;
+    m_thread = std::thread(&NetworkDaemon::run, this);
+    return true;
+}
+
+void NetworkDaemon::stop()
+{
+    if (m_running.exchange(false)) {
+        uint64_t one = 1;
+        ssize_t written = write(m_wakeup, &one, sizeof(one));
+        (void)written;
+        m_thread.join();
+    }
+
+    for (auto& client : m_clients) {
+        close(client.first);
+    }
+    m_clients.clear();
+    m_fds.clear();
+    m_count = 0;
+
+    {
+        // Workers and signals may still send, they find the wakeup descriptor gone
+        std::lock_guard<std::mutex> lock(m_mx);
+        m_outbox.clear();
+        m_overflow.clear();
+        if (m_wakeup >= 0) {
+            close(m_wakeup);
+            m_wakeup = -1;
+        }
+    }
+
+    for (int* fd : { &m_listen, &m_epoll }) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+
+    if (!m_path.empty()) {
+        unlink(m_path.c_str());
+        m_path.clear();
+    }
+}
+
+size_t NetworkDaemon::clients() const
+{
+    return m_count;
+}
+
+void NetworkDaemon::watch()
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_watching) {
+        return;
+    }
+    m_watching = true;
+
+    NetworkManager& nm = NetworkManager::i();
+    nm.ActiveConnectionChanged.connect([this](const std::string& iface, const ActiveConnection& connection) {
+        {
+            std::lock_guard<std::mutex> lock(m_mx);
+            m_active[iface] = connection;
+        }
+
+        Ipc::Fields event { "!", "connection", iface };
+        Ipc::putConnection(event, connection);
+        Ipc::putNetwork(event, connection);
+        send(0, event);
+    });
+
+    nm.InternetConnectionAvailable.connect([this](const bool& available) {
+        send(0, Ipc::Fields { "!", "internet", available ? "1" : "0" });
+    });
+
+    nm.LastConnectResult.connect([this](const Result& result) {
+        send(0, Ipc::Fields { "!", "result", std::to_string((int)result) });
+    });
+}
+
+void NetworkDaemon::send(uint64_t client, const Ipc::Fields& fields)
+{
+    std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+    Ipc::encode(fields, *frame);
+
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_wakeup < 0) {
+        return;
+    }
+
+    if (m_outbox.size() < MaxOutbox) {
+        m_outbox.push_back({ client, frame });
+    } else {
+        m_overflow.insert(client);
+    }
+
+    uint64_t one = 1;
+    ssize_t written = write(m_wakeup, &one, sizeof(one));
+    (void)written;
+}
+
+void NetworkDaemon::run()
+{
+    epoll_event events[32];
+    while (m_running) {
+        int count = epoll_wait(m_epoll, events, 32, -1);
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == m_listen) {
+                accept();
+                continue;
+            }
+
+            if (fd == m_wakeup) {
+                uint64_t value;
+                ssize_t got = ::read(m_wakeup, &value, sizeof(value));
+                (void)got;
+                deliver();
+                continue;
+            }
+
+            auto pos = m_clients.find(fd);
+            if (pos == m_clients.end()) {
+                continue;
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                drop(fd);
+            } else if (events[i].events & EPOLLIN) {
+                read(fd, pos->second);
+            } else if (events[i].events & EPOLLOUT) {
+                flush(fd, pos->second);
+            }
+        }
+    }
+}
+
+void NetworkDaemon::accept()
+{
+    while (true) {
+        int fd = accept4(m_listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        if (m_clients.size() >= MaxClients) {
+            LOG_WARN << "Too many clients, rejecting";
+            close(fd);
+            continue;
+        }
+
+        if (!trusted(fd)) {
+            close(fd);
+            continue;
+        }
+
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+
+        Client& client = m_clients[fd];
+        client.id = m_nextId++;
+        m_fds[client.id] = fd;
+        m_count = m_clients.size();
+    }
+}
+
+bool NetworkDaemon::trusted(int fd)
+{
+    ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+        LOG_WARN << "Can't get peer credentials: " << strerror(errno);
+        return false;
+    }
+
+    // Peers the socket's 0660 mode admits. The mode is only set after bind, connections may come earlier
+    if (cred.uid == 0 || cred.uid == geteuid() || cred.gid == getegid()) {
+        return true;
+    }
+    LOG_WARN << "Rejecting client of uid " << cred.uid << ", gid " << cred.gid;
+    return false;
+}
+
+void NetworkDaemon::read(int fd, Client& client)
+{
+    char buffer[4096];
+    while (true) {
+        ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if (got > 0) {
+            client.in.append(buffer, got);
+            continue;
+        }
+
+        if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            drop(fd);
+            return;
+        }
+        break;
+    }
+
+    Ipc::Fields request;
+    bool ok = true;
+    while (Ipc::decode(client.in, request, ok)) {
+        if (request.size() < 2) {
+            ok = false;
+            break;
+        }
+
+        if (request[1] == "subscribe") {
+            if (!subscribe(fd, client, request[0])) {
+                return;
+            }
+            continue;
+        }
+
+        uint64_t id = client.id;
+        m_workers.post([this, id, request]() {
+            Ipc::Fields response { ">", request[0] };
+            execute(request, response);
+            send(id, response);
+        });
+    }
+
+    if (!ok) {
+        LOG_WARN << "Malformed request, dropping client";
+        drop(fd);
+    }
+}
+
+bool NetworkDaemon::subscribe(int fd, Client& client, const std::string& id)
+{
+    client.subscribed = true;
+
+    // Current state first, so the client doesn't wait for the next change
+    std::vector<Ipc::Fields> state;
+    state.push_back(Ipc::Fields { "!", "internet", NetworkManager::i().InternetConnectionAvailable.value ? "1" : "0" });
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        for (const auto& active : m_active) {
+            Ipc::Fields event { "!", "connection", active.first };
+            Ipc::putConnection(event, active.second);
+            Ipc::putNetwork(event, active.second);
+            state.push_back(event);
+        }
+    }
+    state.push_back(Ipc::Fields { ">", id, "ok" });
+
+    for (const Ipc::Fields& fields : state) {
+        std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+        Ipc::encode(fields, *frame);
+        client.out.push_back(frame);
+    }
+    return flush(fd, client);
+}
+
+void NetworkDaemon::deliver()
+{
+    std::vector<std::pair<uint64_t, Frame>> outbox;
+    std::unordered_set<uint64_t> overflow;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        outbox.swap(m_outbox);
+        overflow.swap(m_overflow);
+    }
+
+    // They missed a frame, a dropped client can connect again for a consistent state
+    for (uint64_t id : overflow) {
+        std::vector<int> missed;
+        if (id == 0) {
+            for (const auto& client : m_clients) {
+                if (client.second.subscribed) {
+                    missed.push_back(client.first);
+                }
+            }
+        } else if (m_fds.count(id) != 0) {
+            missed.push_back(m_fds[id]);
+        }
+
+        for (int fd : missed) {
+            LOG_WARN << "Outbox is full, dropping client " << m_clients[fd].id;
+            drop(fd);
+        }
+    }
+
+    std::vector<int> touched;
+    for (const auto& item : outbox) {
+        if (item.first == 0) {
+            // One buffer is shared by all subscribers
+            for (auto& client : m_clients) {
+                if (client.second.subscribed) {
+                    client.second.out.push_back(item.second);
+                    touched.push_back(client.first);
+                }
+            }
+            continue;
+        }
+
+        auto pos = m_fds.find(item.first);
+        if (pos != m_fds.end()) {
+            m_clients[pos->second].out.push_back(item.second);
+            touched.push_back(pos->second);
+        }
+    }
+
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    for (int fd : touched) {
+        auto pos = m_clients.find(fd);
+        if (pos != m_clients.end()) {
+            flush(fd, pos->second);
+        }
+    }
+}
+
+bool NetworkDaemon::flush(int fd, Client& client)
+{
+    while (!client.out.empty()) {
+        const std::string& frame = *client.out.front();
+        ssize_t sent = ::send(fd, frame.data() + client.offset, frame.size() - client.offset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                drop(fd);
+                return false;
+            }
+            break;
+        }
+
+        client.offset += sent;
+        if (client.offset == frame.size()) {
+            client.out.pop_front();
+            client.offset = 0;
+        }
+    }
+
+    if (client.out.size() > MaxPending) {
+        LOG_WARN << "Client " << client.id << " doesn't read, dropping";
+        drop(fd);
+        return false;
+    }
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = client.out.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT;
+    ev.data.fd = fd;
+    epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev);
+    return true;
+}
+
+void NetworkDaemon::drop(int fd)
+{
+    auto pos = m_clients.find(fd);
+    if (pos != m_clients.end()) {
+        m_fds.erase(pos->second.id);
+        m_clients.erase(pos);
+    }
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    m_count = m_clients.size();
+}
+
+void NetworkDaemon::execute(const Ipc::Fields& request, Ipc::Fields& response)
+{
+    NetworkManager& nm = NetworkManager::i();
+    const std::string& method = request[1];
+    auto arg = [&request](size_t i) { return i + 2 < request.size() ? request[i + 2] : std::string(); };
+
+    response.push_back("ok");
+    if (method == "devices") {
+        for (const std::string& device : nm.devices()) {
+            response.push_back(device);
+        }
+    } else if (method == "scan") {
+        nm.scanEach(arg(0), [&response](const WifiNetwork& network) {
+            Ipc::putNetwork(response, network);
+        }, NetworkManager::ScanFilter(), arg(1) == "1");
+    } else if (method == "connections") {
+        for (const Connection& connection : nm.connections()) {
+            Ipc::putConnection(response, connection);
+        }
+    } else if (method == "active") {
+        Ipc::putConnection(response, nm.activeConnection(arg(0)));
+        Ipc::putNetwork(response, nm.activeNetwork(arg(0)));
+    } else if (method == "activate") {
+        Result result = Result::Unknown;
+        bool started = nm.activateConnection(arg(0), arg(1), &result);
+        response.push_back(started ? "1" : "0");
+        response.push_back(std::to_string((int)result));
+    } else if (method == "connect" || method == "hotspot") {
+        WifiNetwork network;
+        network.ssid = arg(1);
+        network.password = arg(2);
+        network.auth = (Authentication)atoi(arg(3).c_str());
+        network.encrypted = network.auth != Authentication::None;
+        if (method == "connect") {
+            response.push_back(std::to_string((int)nm.connectoToNetwork(arg(0), network)));
+        } else {
+            Channel channel;
+            channel.band = (Band)atoi(arg(4).c_str());
+            channel.number = strtoul(arg(5).c_str(), NULL, 10);
+            std::string uuid;
+            response.push_back(std::to_string((int)nm.createHotspot(arg(0), network, channel, &uuid)));
+            response.push_back(uuid);
+        }
+    } else {
+        response.back() = "unknown";
+    }
+}
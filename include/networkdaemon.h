@@ -0,0 +1,79 @@
+#ifndef IOT_NETWORK_DAEMON_H
+#define IOT_NETWORK_DAEMON_H
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "dispatcher.h"
+#include "ipc.h"
+
+namespace IoT
+{
+    // Shares this process' NetworkManager with other processes over a Unix socket.
+    // Requests run on a worker pool, state changes are pushed to subscribed clients.
+    // Must live as long as NetworkManager, its signals can't be disconnected.
+    class NetworkDaemon
+    {
+    public:
+        NetworkDaemon();
+        ~NetworkDaemon();
+
+        bool start(const std::string& path = Ipc::DefaultSocket);
+        void stop();
+        size_t clients() const;
+    private:
+        typedef std::shared_ptr<const std::string> Frame;
+
+        struct Client
+        {
+            uint64_t id;
+            std::string in;
+            std::deque<Frame> out;
+            size_t offset = 0;
+            bool subscribed = false;
+        };
+
+        void run();
+        void accept();
+        // Peer runs as root, as the daemon's user or in its group
+        bool trusted(int fd);
+        // Client is dropped on errors. When these return false it was, and must not be used anymore
+        void read(int fd, Client& client);
+        bool flush(int fd, Client& client);
+        void drop(int fd);
+        void deliver();
+        bool subscribe(int fd, Client& client, const std::string& id);
+
+        void execute(const Ipc::Fields& request, Ipc::Fields& response);
+        // Thread safe, client 0 means every subscribed client. Does nothing once stopped
+        void send(uint64_t client, const Ipc::Fields& fields);
+        void watch();
+    private:
+        std::string m_path;
+        int m_listen = -1;
+        int m_epoll = -1;
+        int m_wakeup = -1; // Under m_mx, closed by stop while others may send
+        std::atomic<bool> m_running;
+        std::thread m_thread;
+        std::unordered_map<int, Client> m_clients;
+        std::unordered_map<uint64_t, int> m_fds;
+        uint64_t m_nextId = 1;
+        std::atomic<size_t> m_count;
+
+        mutable std::mutex m_mx;
+        std::vector<std::pair<uint64_t, Frame>> m_outbox;
+        std::unordered_set<uint64_t> m_overflow; // Clients whose frames didn't fit into the outbox
+        std::unordered_map<std::string, ActiveConnection> m_active;
+        bool m_watching = false;
+
+        Dispatcher m_workers;
+    };
+}
+
+#endif // IOT_NETWORK_DAEMON_H
@@ -4,81 +4,532 @@
 #include "log.h"
 #include "utilities.h"
 #include "callbacks.h"
+#include "channelplanner.h"
+#include "scanquery.h"
+#include <algorithm>
 #include <string.h>
 #include <thread>
 #include <chrono>
 
 using namespace IoT;
 
+bool NetworkManager::s_lazyStartup = true;
+
+// Long enough for a package upgrade to restart the daemon
+static const std::chrono::seconds HoldTimeout(30);
+// Bounds all probes for a network before connecting to it
+static const std::chrono::seconds FindNetworkTimeout(45);
+// Levels of the libnm lock the thread holds
+static thread_local unsigned t_libnmDepth = 0;
+
+NetworkManager::Libnm::Libnm(NetworkManager& nm)
+    : m_nm(nm)
+{
+    m_nm.m_libnmMx.lock();
+    t_libnmDepth++;
+}
+
+NetworkManager::Libnm::~Libnm()
+{
+    t_libnmDepth--;
+    m_nm.m_libnmMx.unlock();
+}
+
+NetworkManager::Unlocked::Unlocked(NetworkManager& nm)
+    : m_nm(nm)
+    , m_depth(t_libnmDepth)
+{
+    for (unsigned i = 0; i < m_depth; i++) {
+        m_nm.m_libnmMx.unlock();
+    }
+    t_libnmDepth = 0;
+}
+
+NetworkManager::Unlocked::~Unlocked()
+{
+    for (unsigned i = 0; i < m_depth; i++) {
+        m_nm.m_libnmMx.lock();
+    }
+    t_libnmDepth = m_depth;
+}
+
 NetworkManager::NetworkManager()
     : m_data(new Data())
+    , m_internet(-1)
+    , m_volatile(false)
+    , m_rebuild(false)
+    , m_recheck(false)
+    , m_stop(false)
+    , m_stopDispatch(false)
+    , m_created(Clock::instance().now())
 {
     LOG_DEBUG << "Creating NetworkManager";
-    m_data->Client = nm_client_new(NULL, NULL);
-    if (m_data->Client != nullptr)
-    {
-        LOG_DEBUG << "Connected to NetworkManager version: " << nm_client_get_version(m_data->Client);
+
+    InternetConnectionAvailable.bind(m_data->InternetConnectionAvailable);
+    LastConnectResult.bind(m_data->LastConnectResult);
+    LastConnectResult.connect([this](const Result& result) {
+        if (m_recorder.isOpen()) {
+            RecordedEvent event;
+            event.type = RecordedEvent::ConnectResult;
+            event.result = result;
+            m_recorder.record(event);
+        }
+    });
+
+    // Probe finished off the tracker, its result is published by a pass right away
+    m_connectivity.onResult([this]() {
+        m_recheck = true;
+        std::lock_guard<std::mutex> lock(m_powerMx);
+        m_powerCv.notify_all();
+    });
+
+    m_data->RunningChanged = [this](bool running) {
+        if (running) {
+            m_rebuild = true;
+            std::lock_guard<std::mutex> lock(m_powerMx);
+            m_powerCv.notify_all();
+        }
+    };
+
+    // GLib events are dispatched on their own thread, so replies and nm-running changes get in
+    // while the tracker sleeps
+    m_dispatchLoop = std::thread([this]() {
+        dispatchEvents();
+    });
+
+    // Object graph is loaded on the tracker thread, callers wait in client() only when they need it
+    m_networkTracker = std::thread([this]() {
+        startup();
+        if (m_data->Client == NULL) {
+            return;
+        }
+
+        markStartupPhase("tracker");
+
+        Clock& clock = Clock::instance();
+        auto lastTrack = clock.now() - powerSettings().trackPeriod;
+        auto nextSample = clock.now();
+        while (!m_stop) {
+            bool rebuilding = m_rebuild.exchange(false);
+            if (rebuilding) {
+                std::lock_guard<std::mutex> tracked(m_trackMx);
+                Libnm libnm(*this);
+                rebuild();
+            }
+
+            bool rechecked = m_recheck.exchange(false);
+            auto now = clock.now();
+            auto period = m_telemetry.period();
+            bool tracking = rebuilding || rechecked || now >= lastTrack + powerSettings().trackPeriod;
+            bool sampling = period.count() > 0 && now >= nextSample;
+            bool running = isRunning();
+            if (running && (tracking || sampling)) {
+                // Device array is replaced when NM restarts, so it is never cached. The whole pass
+                // sees one state of the objects
+                std::lock_guard<std::mutex> tracked(m_trackMx);
+                Libnm libnm(*this);
+                pass(nm_client_get_devices(m_data->Client), tracking, sampling, rebuilding);
+            }
+
+            if (tracking) {
+                lastTrack = now;
+            }
+
+            if (sampling) {
+                nextSample = now + period;
+            }
+
+            // Period is reread on every wakeup, so a profile switch applies right away
+            std::unique_lock<std::mutex> lock(m_powerMx);
+            auto wakeup = lastTrack + m_power.trackPeriod;
+            if (period.count() > 0 && nextSample < wakeup) {
+                wakeup = nextSample;
+            }
+            // Flags are set before the notification takes the lock, so none is missed
+            if (!m_rebuild && !m_recheck && !m_stop) {
+                clock.waitUntil(m_powerCv, lock, wakeup);
+            }
+            lock.unlock();
+            m_wakeups.hit();
+        }
+    });
+}
+
+void NetworkManager::dispatchEvents()
+{
+    GMainContext* context = g_main_context_default();
+    g_main_context_acquire(context);
+    std::vector<GPollFD> fds(8);
+    while (!m_stopDispatch) {
+        gint priority = 0;
+        gint timeout = -1;
+        g_main_context_prepare(context, &priority);
+        gint count = g_main_context_query(context, priority, &timeout, fds.data(), fds.size());
+        while (count > (gint)fds.size()) {
+            fds.resize(count);
+            count = g_main_context_query(context, priority, &timeout, fds.data(), fds.size());
+        }
+        g_poll(fds.data(), count, timeout);
+        m_wakeups.hit();
+
+        // Callbacks change libnm objects under the lock, a waiter sees its completion only once
+        // the callback returned
+        Libnm libnm(*this);
+        if (g_main_context_check(context, priority, fds.data(), count)) {
+            g_main_context_dispatch(context);
+        }
+        m_dispatchCv.notify_all();
     }
-    else
+    g_main_context_release(context);
+}
+
+void NetworkManager::pass(const GPtrArray* devices, bool tracking, bool sampling, bool refresh)
+{
+    DBusProfiler::Scope profile(m_profiler, "tracker");
+    for (int i = 0; i < devices->len; i++)
     {
-        LOG_ERROR << "Can't connect to NetworkManager";
+        NMDevice *device = NM_DEVICE(g_ptr_array_index(devices, i));
+        if (!NM_IS_DEVICE_WIFI(device))
+        {
+            continue;
+        }
+
+        if (tracking) {
+            track(device, refresh);
+        }
+
+        if (sampling) {
+            sample(device);
+        }
     }
+}
 
-    m_data->Loop = g_main_loop_new(NULL, FALSE);
+void NetworkManager::track(NMDevice* device, bool refresh)
+{
+    // Tracker's own buffers, a pass allocates only when something changed
+    std::string& iface = m_trackedIface;
+    iface = nm_device_get_iface(device);
+    auto state = nm_device_get_state(device);
+    ConnectionStatus now = Utility::deviceStateToConnectionStatus(state);
+
+    ActiveConnection& connection = m_tracked;
+    activeConnection(iface, connection);
+    activeNetwork(iface, connection);
+    bool changed = remember(iface, connection);
+
+    // Hotspot link has no upstream, station link is verified by probing
+    bool available = now == ConnectionStatus::Connected &&
+                     connection.mode != Mode::AccessPoint &&
+                     m_connectivity.check(iface, m_data->Client);
+
+    if (m_recorder.isOpen()) {
+        RecordedEvent& event = m_trackedEvent;
+        event.type = RecordedEvent::Link;
+        event.iface = iface;
+        event.deviceState = state;
+        event.internet = available;
+        event.connection = connection;
+        m_recorder.record(event);
+    }
 
-    if (!nm_client_wireless_get_enabled(m_data->Client))
-        nm_client_wireless_set_enabled(m_data->Client, TRUE);
+    publish(iface, now, connection, changed, available, refresh);
 
-    InternetConnectionAvailable.bind(m_data->InternetConnectionAvailable);
-    LastConnectResult.bind(m_data->LastConnectResult);
+    if (now == ConnectionStatus::Connected && connection.mode == Mode::Infrastructure) {
+        NMAccessPoint* target = m_roaming.evaluate(NM_DEVICE_WIFI(device));
+        if (target != NULL) {
+            roam(device, target);
+        }
+    }
+}
 
-    m_networkTracker = std::thread([this]() {
-        const GPtrArray *devicesArr = nm_client_get_devices(m_data->Client);
-        while(1) {
-            while (g_main_context_iteration(NULL, FALSE) == TRUE) {
+bool NetworkManager::remember(const std::string& iface, const ActiveConnection& connection)
+{
+    auto pos = m_activeConnections.find(iface);
+    if (pos == m_activeConnections.end()) {
+        m_activeConnections.insert({iface, connection});
+        m_connectivity.invalidate(iface);
+        return true;
+    }
+
+    if (pos->second == connection) {
+        return false;
+    }
+
+    if (pos->second.uuid != connection.uuid || pos->second.bssid != connection.bssid) {
+        m_connectivity.invalidate(iface);
+    }
+    pos->second = connection;
+    return true;
+}
+
+void NetworkManager::publish(const std::string& iface, ConnectionStatus now, const ActiveConnection& connection, bool changed, bool available, bool refresh)
+{
+    // Subscribers may block for long, deliver on dispatcher's thread
+    if (changed) {
+        m_dispatcher.post("connection:" + iface, [this, iface, connection]() {
+            ActiveConnectionChanged.emit(iface, connection);
+        });
+    }
+
+    switch (now)
+    {
+        case ConnectionStatus::Connected:
+        case ConnectionStatus::Disconnected:
+        {
+            available = available && now == ConnectionStatus::Connected;
+            // The property drops unchanged values anyway, don't queue them every pass
+            if (!refresh && m_internet == (available ? 1 : 0)) {
+                break;
             }
-            for (int i = 0; i < devicesArr->len; i++)
-            {
-                NMDevice *device = NM_DEVICE(g_ptr_array_index(devicesArr, i));
-                if (!NM_IS_DEVICE_WIFI(device))
-                {
-                    continue;
+            m_internet = available ? 1 : 0;
+            m_dispatcher.post("internet", [this, available, refresh]() {
+                // Unchanged value isn't emitted by the property, a refresh repeats it
+                if (refresh && m_data->InternetConnectionAvailable.value == available) {
+                    update();
+                } else {
+                    m_data->InternetConnectionAvailable = available;
                 }
+            });
+            break;
+        }
+        default:
+            break;
+    }
+}
 
-                std::string iface = nm_device_get_iface(device);
-                auto state = nm_device_get_state(device);
-                ConnectionStatus now = Utility::deviceStateToConnectionStatus(state);
-
-                switch (now)
-                {
-                    case ConnectionStatus::Connected:
-                    {
-                        m_data->InternetConnectionAvailable = true;
-                        break;
-                    }
-                    case ConnectionStatus::Disconnected:
-                    {
-                        m_data->InternetConnectionAvailable = false;
-                        break;
-                    }
-                }
+void NetworkManager::rebuild()
+{
+    // libnm refetches its objects on its own, only what is derived from them is dropped
+    LOG_INFO << "Rebuilding state after NetworkManager restart";
+    m_activeConnections.clear();
+    m_connectivity.invalidate();
+    {
+        std::lock_guard<std::mutex> lock(m_powerMx);
+        m_scanned.clear();
+    }
 
-                ActiveConnection connection;
-                static_cast<Connection&>(connection) = activeConnection(iface);
-                static_cast<WifiNetwork&>(connection) = activeNetwork(iface);
-                auto pos = m_activeConnections.find(iface);
-                if (pos == m_activeConnections.end()) {
-                    m_activeConnections.insert({iface, connection});
-                    ActiveConnectionChanged.emit(iface, connection);
-                }
-                else if (pos->second != connection) {
-                    pos->second = connection;
-                    ActiveConnectionChanged.emit(iface, connection);
-                }
-            }
-            std::this_thread::sleep_for(std::chrono::seconds(5));
+    if (!nm_client_wireless_get_enabled(m_data->Client)) {
+        nm_client_wireless_set_enabled(m_data->Client, TRUE);
+    }
+}
+
+bool NetworkManager::startRecording(const std::string& path)
+{
+    return m_recorder.open(path);
+}
+
+void NetworkManager::stopRecording()
+{
+    m_recorder.close();
+}
+
+void NetworkManager::inject(const RecordedEvent& event)
+{
+    switch (event.type)
+    {
+        case RecordedEvent::Link:
+        {
+            ConnectionStatus now = Utility::deviceStateToConnectionStatus((NMDeviceState)event.deviceState);
+            std::lock_guard<std::mutex> tracked(m_trackMx);
+            bool changed = remember(event.iface, event.connection);
+            publish(event.iface, now, event.connection, changed, event.internet);
+            break;
         }
-    });
+        case RecordedEvent::Scan:
+        {
+            std::lock_guard<std::mutex> lock(m_replayMx);
+            m_replayScans[event.iface] = event.networks;
+            break;
+        }
+        case RecordedEvent::ConnectResult:
+            m_data->LastConnectResult.set(event.result);
+            break;
+    }
+}
+
+ReplayReport NetworkManager::replay(const std::string& path, bool realTime)
+{
+    ReplayReport report;
+    EventReader reader;
+    if (!reader.open(path)) {
+        return report;
+    }
+
+    LOG_INFO << "Replaying " << path << (realTime ? " in real time" : "");
+    auto started = Clock::instance().now();
+    RecordedEvent event;
+    while (reader.next(event)) {
+        if (realTime) {
+            Clock::instance().sleepUntil(started + event.time);
+        }
+        inject(event);
+        report.events++;
+        report.recorded = event.time;
+    }
+
+    // Live scans answer again once the log is over
+    {
+        std::lock_guard<std::mutex> lock(m_replayMx);
+        m_replayScans.clear();
+    }
+
+    report.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::instance().now() - started);
+    LOG_INFO << "Replayed " << report.events << " events in " << report.elapsed.count() / 1000 << "ms";
+    return report;
+}
+
+void NetworkManager::sample(NMDevice* device)
+{
+    LinkSample sample;
+    sample.time = Clock::instance().now();
+    sample.status = Utility::deviceStateToConnectionStatus(nm_device_get_state(device));
+    sample.bitrate = nm_device_wifi_get_bitrate(NM_DEVICE_WIFI(device));
+    sample.signal = 0;
+    sample.frequency = 0;
+
+    NMAccessPoint* ap = nm_device_wifi_get_active_access_point(NM_DEVICE_WIFI(device));
+    if (ap != NULL) {
+        sample.signal = nm_access_point_get_strength(ap);
+        sample.frequency = nm_access_point_get_frequency(ap);
+    }
+
+    m_trackedIface = nm_device_get_iface(device);
+    m_telemetry.record(m_trackedIface, sample);
+}
+
+void NetworkManager::setTelemetry(size_t capacity, std::chrono::milliseconds period)
+{
+    m_telemetry.configure(capacity, period);
+}
+
+LinkStatistics NetworkManager::linkStatistics(const std::string& iface, std::chrono::seconds window)
+{
+    return m_telemetry.query(iface, window);
+}
+
+void NetworkManager::startup()
+{
+    {
+        Libnm libnm(*this);
+#ifdef NM_CLIENT_INSTANCE_FLAGS
+        if (s_lazyStartup) {
+            g_async_initable_new_async(NM_TYPE_CLIENT, G_PRIORITY_DEFAULT, NULL,
+                                       Callbacks::clientCreated, m_data,
+                                       NM_CLIENT_INSTANCE_FLAGS, NM_CLIENT_INSTANCE_FLAGS_NO_AUTO_FETCH_PERMISSIONS,
+                                       NULL);
+        } else
+#endif
+        nm_client_new_async(NULL, Callbacks::clientCreated, m_data);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_data->ReadyMx);
+        m_data->ReadyCv.wait(lock, [this]() { return m_data->Ready; });
+    }
+
+    Libnm libnm(*this);
+
+    if (m_data->Client == NULL) {
+        LOG_ERROR << "Can't connect to NetworkManager";
+        return;
+    }
+
+    g_signal_connect(m_data->Client, "notify::" NM_CLIENT_NM_RUNNING, G_CALLBACK(Callbacks::runningChanged), m_data);
+    {
+        std::lock_guard<std::mutex> lock(m_data->ReadyMx);
+        m_data->Running = nm_client_get_nm_running(m_data->Client);
+    }
+    if (!isRunning()) {
+        LOG_WARN << "NetworkManager isn't running, waiting for it";
+        return;
+    }
+
+    LOG_DEBUG << "Connected to NetworkManager version: " << nm_client_get_version(m_data->Client);
+    markStartupPhase("client");
+
+    if (!nm_client_wireless_get_enabled(m_data->Client)) {
+        nm_client_wireless_set_enabled(m_data->Client, TRUE);
+        markStartupPhase("wireless");
+    }
+}
+
+NMClient* NetworkManager::client()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_data->ReadyMx);
+        if (m_data->Ready && (m_data->Running || m_data->Client == NULL)) {
+            return m_data->Client;
+        }
+    }
+
+    // Readiness and restarts are delivered by callbacks, which need the libnm lock
+    Unlocked unlocked(*this);
+    std::unique_lock<std::mutex> lock(m_data->ReadyMx);
+    m_data->ReadyCv.wait(lock, [this]() { return m_data->Ready; });
+    if (m_data->Running || m_data->Client == NULL) {
+        return m_data->Client;
+    }
+
+    // Hold the operation while NM restarts, the notification wakes us up
+    Clock& clock = Clock::instance();
+    auto deadline = clock.now() + HoldTimeout;
+    while (!m_data->Running && clock.now() < deadline) {
+        clock.waitUntil(m_data->ReadyCv, lock, deadline);
+    }
+
+    if (!m_data->Running) {
+        LOG_WARN << "NetworkManager is still down, going on";
+    }
+    return m_data->Client;
+}
+
+bool NetworkManager::isRunning() const
+{
+    std::lock_guard<std::mutex> lock(m_data->ReadyMx);
+    return m_data->Running;
+}
+
+void NetworkManager::setLazyStartup(bool lazy)
+{
+    s_lazyStartup = lazy;
+}
+
+void NetworkManager::markStartupPhase(std::string name)
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::instance().now() - m_created);
+    LOG_DEBUG << "Startup phase " << name << ": " << elapsed.count() / 1000 << "ms";
+    std::lock_guard<std::mutex> lock(m_phasesMx);
+    m_phases.push_back(StartupPhase { std::move(name), elapsed });
+}
+
+std::vector<StartupPhase> NetworkManager::startupPhases() const
+{
+    std::lock_guard<std::mutex> lock(m_phasesMx);
+    return m_phases;
+}
+
+void NetworkManager::setVolatileProfiles(bool enabled)
+{
+#ifdef NM_VERSION_1_16
+    m_volatile = enabled;
+#else
+    // Without AddAndActivate2 new profiles can't be kept in memory, everything is saved as before
+    if (enabled) {
+        LOG_WARN << "Volatile profiles need libnm 1.16 or newer";
+    }
+#endif
+}
+
+std::vector<ConnectPhase> NetworkManager::connectPhases() const
+{
+    std::lock_guard<std::mutex> lock(m_phasesMx);
+    return m_connectPhases;
+}
+
+void NetworkManager::rememberPhases(std::vector<ConnectPhase> phases)
+{
+    std::lock_guard<std::mutex> lock(m_phasesMx);
+    m_connectPhases = std::move(phases);
 }
 
 void NetworkManager::update()
@@ -86,16 +537,211 @@ void NetworkManager::update()
     InternetConnectionAvailable.emit(InternetConnectionAvailable.value);
 }
 
+void NetworkManager::setRoamingPolicy(const RoamingPolicy& policy)
+{
+    m_roaming.setPolicy(policy);
+}
+
+void NetworkManager::setConnectivityCheck(const ConnectivityConfig& config)
+{
+    m_connectivity.setConfig(config);
+}
+
+void NetworkManager::setDBusProfiling(bool enabled)
+{
+    if (!enabled) {
+        m_profiler.detach();
+        return;
+    }
+
+#ifdef NM_CLIENT_DBUS_CONNECTION
+    Libnm libnm(*this);
+    if (client() != NULL) {
+        m_profiler.attach(nm_client_get_dbus_connection(client()));
+    }
+#else
+    LOG_WARN << "D-Bus profiling needs libnm 1.22 or newer";
+#endif
+}
+
+void NetworkManager::setDBusBudget(const std::string& operation, const DBusBudget& budget)
+{
+    m_profiler.setBudget(operation, budget);
+}
+
+std::vector<DBusOperationStats> NetworkManager::dbusStatistics() const
+{
+    return m_profiler.statistics();
+}
+
+void NetworkManager::resetDBusStatistics()
+{
+    m_profiler.reset();
+}
+
+void NetworkManager::setPowerSettings(const PowerSettings& settings)
+{
+    PowerSave previous;
+    {
+        std::lock_guard<std::mutex> lock(m_powerMx);
+        previous = m_power.powerSave;
+        m_power = settings;
+        m_powerCv.notify_all();
+    }
+
+    if (settings.powerSave != previous) {
+        applyPowerSave(settings.powerSave);
+    }
+}
+
+void NetworkManager::applyPowerSave(PowerSave powerSave)
+{
+    Libnm libnm(*this);
+    NMClient* nm = client();
+    if (nm == nullptr) {
+        return;
+    }
+
+    const GPtrArray* connections = nm_client_get_connections(nm);
+    const GPtrArray* devices = nm_client_get_devices(nm);
+    for (guint i = 0; i < connections->len; i++) {
+        NMRemoteConnection* remote = (NMRemoteConnection*)g_ptr_array_index(connections, i);
+        NMSettingWireless* wireless = nm_connection_get_setting_wireless(NM_CONNECTION(remote));
+        if (wireless == NULL || nm_setting_wireless_get_powersave(wireless) == (guint32)powerSave) {
+            continue;
+        }
+
+        // Active profile is reapplied on its device once NM has the change
+        NMDevice* device = NULL;
+        for (guint j = 0; j < devices->len && device == NULL; j++) {
+            NMDevice* dev = (NMDevice*)g_ptr_array_index(devices, j);
+            NMActiveConnection* active = nm_device_get_active_connection(dev);
+            if (active != NULL && nm_active_connection_get_connection(active) == remote) {
+                device = (NMDevice*)g_object_ref(dev);
+            }
+        }
+
+        LOG_DEBUG << "Power save " << (guint)powerSave << " for " << nm_connection_get_uuid(NM_CONNECTION(remote));
+        g_object_set(G_OBJECT(wireless), NM_SETTING_WIRELESS_POWERSAVE, (guint)powerSave, NULL);
+        // Volatile profiles stay in memory, saved ones keep the setting across reboots
+        nm_remote_connection_commit_changes_async(remote, !nm_remote_connection_get_unsaved(remote), NULL,
+                                                  Callbacks::powerSaveCommitted, device);
+    }
+}
+
+PowerSettings NetworkManager::powerSettings() const
+{
+    std::lock_guard<std::mutex> lock(m_powerMx);
+    return m_power;
+}
+
+unsigned NetworkManager::wakeupsPerMinute() const
+{
+    return m_wakeups.perMinute();
+}
+
+bool NetworkManager::roam(NMDevice* device, NMAccessPoint* ap)
+{
+    NMActiveConnection* active = nm_device_get_active_connection(device);
+    if (active == NULL) {
+        return false;
+    }
+
+    NMRemoteConnection* remote = nm_active_connection_get_connection(active);
+    if (remote == NULL) {
+        return false;
+    }
+
+    const char* bssid = nm_access_point_get_bssid(ap);
+    LOG_INFO << "Roaming " << nm_device_get_iface(device) << " to " << bssid;
+
+    RoamData* data = new RoamData();
+    data->Client = m_data->Client;
+    data->Device = (NMDevice*)g_object_ref(device);
+    data->AccessPoint = nm_object_get_path(NM_OBJECT(ap));
+
+    // Connections created by connectoToNetwork are pinned to BSSID, the pin is dropped and the
+    // access point is picked by the activation. Profile is written once and stays saved or volatile
+    NMSettingWireless* s = nm_connection_get_setting_wireless(NM_CONNECTION(remote));
+    if (s != NULL && nm_setting_wireless_get_bssid(s) != NULL) {
+        g_object_set(G_OBJECT(s), NM_SETTING_WIRELESS_BSSID, NULL, NULL);
+        nm_remote_connection_commit_changes_async(remote, !nm_remote_connection_get_unsaved(remote), NULL,
+                                                  Callbacks::roamCommitted, data);
+        return true;
+    }
+
+    nm_client_activate_connection_async(m_data->Client, NM_CONNECTION(remote), device,
+                                        data->AccessPoint.c_str(), NULL,
+                                        Callbacks::roamed, NULL);
+    g_object_unref(data->Device);
+    delete data;
+    return true;
+}
+
+bool NetworkManager::planHotspot(const std::string& uuid, const std::string& iface, Band band)
+{
+    Libnm libnm(*this);
+    NMRemoteConnection *remote = nm_client_get_connection_by_uuid(client(), uuid.c_str());
+    if (remote == NULL) {
+        LOG_ERROR << "Can't find hotspot " << uuid;
+        return false;
+    }
+
+    NMSettingWireless *wireless = nm_connection_get_setting_wireless(NM_CONNECTION(remote));
+    if (wireless == NULL) {
+        return false;
+    }
+
+    NMDeviceWifi *dev = requestScan(iface, false, std::vector<std::string>(), true);
+    if (dev == NULL) {
+        return false;
+    }
+
+    Channel channel = ChannelPlanner::select(dev, band);
+    const char *current = nm_setting_wireless_get_band(wireless);
+    if (nm_setting_wireless_get_channel(wireless) == channel.number && current != NULL &&
+        std::string(current) == (channel.band == Band::A ? "a" : "bg")) {
+        return true;
+    }
+
+    LOG_INFO << "Moving hotspot " << uuid << " to channel " << channel.number;
+    g_object_set(G_OBJECT(wireless),
+                 NM_SETTING_WIRELESS_BAND, channel.band == Band::A ? "a" : "bg",
+                 NM_SETTING_WIRELESS_CHANNEL, channel.number,
+                 NULL);
+
+    AddConnectionData data;
+    nm_remote_connection_commit_changes_async(remote, FALSE, NULL, Callbacks::committed, &data);
+    waitFor(data.Done);
+    return data.Outcome == Result::Added;
+}
+
+void NetworkManager::prepareHotspot(const std::string& iface)
+{
+    if (requestScan(iface, false, std::vector<std::string>(), true) != NULL) {
+        markStartupPhase("channel-scan");
+    }
+}
+
 NetworkManager::~NetworkManager()
 {
-    if (m_data->Client)
+    // Probe thread outlives the members its callback uses
+    m_connectivity.onResult(std::function<void()>());
     {
-        g_object_unref(m_data->Client);
+        std::lock_guard<std::mutex> lock(m_powerMx);
+        m_stop = true;
+        m_powerCv.notify_all();
     }
+    // Tracker may still wait for the client, which is created on the dispatch thread
+    m_networkTracker.join();
+
+    m_stopDispatch = true;
+    g_main_context_wakeup(g_main_context_default());
+    m_dispatchLoop.join();
 
-    if (m_data->Loop)
+    if (m_data->Client)
     {
-        g_main_loop_unref(m_data->Loop);
+        g_object_unref(m_data->Client);
     }
 
     delete m_data;
@@ -103,14 +749,16 @@ NetworkManager::~NetworkManager()
 
 std::vector<std::string> NetworkManager::devices()
 {
+    DBusProfiler::Scope profile(m_profiler, "devices");
+    Libnm libnm(*this);
     std::vector<std::string> devs;
-    if (m_data->Client == nullptr)
+    if (client() == nullptr)
     {
         LOG_ERROR << "Not connected to Network Manager";
         return devs;
     }
 
-    const GPtrArray *devicesArr = nm_client_get_devices(m_data->Client);
+    const GPtrArray *devicesArr = nm_client_get_devices(client());
     for (int i = 0; i < devicesArr->len; i++)
     {
         NMDevice *device = NM_DEVICE(g_ptr_array_index(devicesArr, i));
@@ -123,37 +771,20 @@ std::vector<std::string> NetworkManager::devices()
     return devs;
 }
 
-NMAccessPoint *NetworkManager::getAccessPoint(std::string iface, std::string SSID)
+NMAccessPoint *NetworkManager::getAccessPoint(const std::string& iface, const std::string& SSID)
 {
-    NMDevice *dev = nm_client_get_device_by_iface(m_data->Client, iface.c_str());
+    // Probing for the one network is quicker than a full sweep and finds hidden ones too
+    NMDeviceWifi *dev = requestScan(iface, true, std::vector<std::string>(1, SSID));
     if (dev == NULL)
     {
-        LOG_ERROR << "Can't find device " << iface;
-        return NULL;
-    }
-
-    if (!NM_IS_DEVICE_WIFI(dev))
-    {
-        LOG_ERROR << "Interface " << iface << " is not WiFi device";
         return NULL;
     }
+    return listedAccessPoint(dev, SSID);
+}
 
-    GError *err = NULL;
-    if (!nm_device_wifi_request_scan(NM_DEVICE_WIFI(dev), NULL, &err) && err->code != 6)
-    {
-        LOG_ERROR << "Can't perform scan Error:" << err->code << " " << err->message;
-        g_error_free(err);
-        return NULL;
-    }
-
-    if (err == NULL)
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-    else
-    {
-        g_error_free(err);
-    }
-
-    const GPtrArray *aps = nm_device_wifi_get_access_points(NM_DEVICE_WIFI(dev));
+NMAccessPoint *NetworkManager::listedAccessPoint(NMDeviceWifi* dev, const std::string& SSID)
+{
+    const GPtrArray *aps = nm_device_wifi_get_access_points(dev);
 
     for (int i = 0; i < aps->len; i++)
     {
@@ -172,31 +803,142 @@ NMAccessPoint *NetworkManager::getAccessPoint(std::string iface, std::string SSI
     return NULL;
 }
 
-std::vector<WifiNetwork> NetworkManager::scan(std::string interface, bool force)
+NMDeviceWifi* NetworkManager::requestScan(const std::string& interface, bool force, const std::vector<std::string>& ssids, bool fresh)
 {
-    std::vector<WifiNetwork> nets;
-    NMDevice *dev = nm_client_get_device_by_iface(m_data->Client, interface.c_str());
+    Libnm libnm(*this);
+    NMDevice *dev = nm_client_get_device_by_iface(client(), interface.c_str());
     if (dev == NULL)
     {
         LOG_ERROR << "Can't find device " << interface;
-        return nets;
+        return NULL;
     }
 
     if (!NM_IS_DEVICE_WIFI(dev))
     {
         LOG_ERROR << "Interface " << interface << " is not WiFi device";
-        return nets;
+        return NULL;
     }
 
+    bool targeted = !ssids.empty();
+    bool results = targeted || fresh;
+    auto maxAge = std::chrono::seconds(0);
+    if (!targeted) {
+        std::lock_guard<std::mutex> lock(m_powerMx);
+        maxAge = m_power.scanMaxAge;
+        auto now = Clock::instance().now();
+        auto scanned = m_scanned.find(interface);
+        if (!force && !fresh && scanned != m_scanned.end() && now - scanned->second < m_power.scanMaxAge) {
+            return NM_DEVICE_WIFI(dev);
+        }
+        m_scanned[interface] = now;
+    }
+
+    // NM rejects a scan while another one runs, concurrent callers share the first.
+    // A caller which needs results waits for it and scans afterwards, unless the running
+    // scan brings complete results too
+    ScanFlight& flight = m_scans[interface];
+    bool reusable = fresh && !force && !targeted;
+    if (reusable && !flight.running && Clock::instance().now() - flight.completed < maxAge) {
+        return NM_DEVICE_WIFI(dev);
+    }
+    while (flight.running) {
+        bool shared = reusable && flight.complete;
+        unsigned long finished = flight.finished;
+        waitFor([&flight, finished]() { return flight.finished != finished; });
+        if (!results || shared) {
+            return NM_DEVICE_WIFI(dev);
+        }
+    }
+    flight.running = true;
+    flight.complete = results && !targeted;
+
     WifiScanData data;
     data.force = force;
-    std::unique_lock<std::mutex> lock(data.mx);
-    nm_device_wifi_request_scan_async(NM_DEVICE_WIFI(dev), NULL, Callbacks::scanCompleted, &data);
+    if (results) {
+        data.results = true;
+        data.device = dev;
+        data.handler = g_signal_connect(dev, "notify::last-scan", G_CALLBACK(Callbacks::lastScanChanged), &data);
+    }
+    if (targeted) {
+        GVariantBuilder list;
+        g_variant_builder_init(&list, G_VARIANT_TYPE("aay"));
+        for (const std::string& ssid : ssids) {
+            g_variant_builder_add_value(&list, g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, ssid.data(), ssid.size(), 1));
+        }
+        GVariantBuilder options;
+        g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+        g_variant_builder_add(&options, "{sv}", "ssids", g_variant_builder_end(&list));
+
+        nm_device_wifi_request_scan_options_async(NM_DEVICE_WIFI(dev), g_variant_builder_end(&options), NULL,
+                                                  Callbacks::scanCompleted, &data);
+    } else {
+        nm_device_wifi_request_scan_async(NM_DEVICE_WIFI(dev), NULL, Callbacks::scanCompleted, &data);
+    }
+    waitFor(data.done);
 
-    data.cv.wait(lock);
+    if (flight.complete) {
+        flight.completed = Clock::instance().now();
+    }
+    flight.running = false;
+    flight.complete = false;
+    flight.finished++;
+    m_dispatchCv.notify_all();
+    return NM_DEVICE_WIFI(dev);
+}
 
-    const GPtrArray *aps = nm_device_wifi_get_access_points(NM_DEVICE_WIFI(dev));
+void NetworkManager::waitFor(const std::atomic<bool>& done)
+{
+    waitFor([&done]() { return done.load(); });
+}
+
+void NetworkManager::waitFor(const std::function<bool()>& ready)
+{
+    DBusProfiler::Blocking blocking;
+    Unlocked unlocked(*this);
+    std::unique_lock<std::recursive_mutex> lock(m_libnmMx);
+    m_dispatchCv.wait(lock, ready);
+}
+
+std::mutex& NetworkManager::operationLock(const std::string& iface)
+{
+    std::lock_guard<std::mutex> lock(m_operationsMx);
+    std::unique_ptr<std::mutex>& mx = m_operations[iface];
+    if (!mx) {
+        mx.reset(new std::mutex());
+    }
+    return *mx;
+}
+
+void NetworkManager::scanEach(const std::string& interface, const ScanVisitor& visitor, const ScanFilter& filter, bool force)
+{
+    DBusProfiler::Scope profile(m_profiler, "scan");
+    {
+        // Raw access points don't exist in a replay, filter can't be applied
+        std::lock_guard<std::mutex> lock(m_replayMx);
+        auto replayed = m_replayScans.find(interface);
+        if (replayed != m_replayScans.end()) {
+            for (const WifiNetwork& wifi : replayed->second) {
+                visitor(wifi);
+            }
+            return;
+        }
+    }
+
+    Libnm libnm(*this);
+    NMDeviceWifi *dev = requestScan(interface, force);
+    if (dev == NULL)
+    {
+        return;
+    }
 
+    const GPtrArray *aps = nm_device_wifi_get_access_points(dev);
+
+    // Reused for every AP, strings keep their buffers
+    WifiNetwork wifi;
+    bool recording = m_recorder.isOpen();
+    RecordedEvent scanned;
+    scanned.type = RecordedEvent::Scan;
+    scanned.iface = interface;
     for (int i = 0; i < aps->len; i++)
     {
         NMAccessPoint *ap = NM_ACCESS_POINT(g_ptr_array_index(aps, i));
@@ -205,56 +947,157 @@ std::vector<WifiNetwork> NetworkManager::scan(std::string interface, bool force)
             continue;
         }
 
-        bool ok = false;
-        WifiNetwork wifi = Utility::getWifiNetworkInfo(ap, ok);
-        if (!ok)
+        if (filter && !filter(ap))
+        {
+            continue;
+        }
+
+        if (!Utility::getWifiNetworkInfo(ap, wifi))
         {
             continue;
         }
-        nets.push_back(wifi);
+
+        if (recording) {
+            scanned.networks.push_back(wifi);
+        }
+        visitor(wifi);
+    }
+
+    if (recording) {
+        m_recorder.record(scanned);
+    }
+}
+
+void NetworkManager::scanInto(const std::string& interface, std::vector<WifiNetwork>& networks, bool force)
+{
+    size_t count = 0;
+    scanEach(interface, [&networks, &count](const WifiNetwork& wifi) {
+        if (count < networks.size()) {
+            networks[count] = wifi;
+        } else {
+            networks.push_back(wifi);
+        }
+        count++;
+    }, ScanFilter(), force);
+    networks.resize(count);
+}
+
+void NetworkManager::scanQuery(const std::string& interface, const ScanQuery& query, std::vector<WifiNetwork>& networks, bool force)
+{
+    ScanAggregator aggregator(query, networks);
+    scanEach(interface, [&aggregator](const WifiNetwork& wifi) {
+        aggregator.add(wifi);
+    }, ScanFilter(), force);
+    aggregator.finish();
+}
+
+void NetworkManager::scanFor(const std::string& interface, const std::vector<std::string>& ssids, std::vector<WifiNetwork>& networks)
+{
+    DBusProfiler::Scope profile(m_profiler, "scanFor");
+    Libnm libnm(*this);
+    size_t count = 0;
+    NMDeviceWifi *dev = ssids.empty() ? NULL : requestScan(interface, true, ssids);
+    if (dev != NULL) {
+        const GPtrArray *aps = nm_device_wifi_get_access_points(dev);
+        for (int i = 0; i < aps->len; i++)
+        {
+            NMAccessPoint *ap = NM_ACCESS_POINT(g_ptr_array_index(aps, i));
+            if (count == networks.size()) {
+                networks.push_back(WifiNetwork());
+            }
+
+            // Other networks seen earlier are still listed
+            WifiNetwork& wifi = networks[count];
+            if (ap != NULL && Utility::getWifiNetworkInfo(ap, wifi) &&
+                std::find(ssids.begin(), ssids.end(), wifi.ssid) != ssids.end()) {
+                count++;
+            }
+        }
     }
+    networks.resize(count);
+}
+
+std::vector<WifiNetwork> NetworkManager::scanFor(const std::string& interface, const std::vector<std::string>& ssids)
+{
+    std::vector<WifiNetwork> networks;
+    scanFor(interface, ssids, networks);
+    return networks;
+}
+
+std::vector<WifiNetwork> NetworkManager::scan(const std::string& interface, bool force)
+{
+    std::vector<WifiNetwork> nets;
+    scanInto(interface, nets, force);
     return nets;
 }
 
 std::vector<Connection> NetworkManager::connections()
 {
+    DBusProfiler::Scope profile(m_profiler, "connections");
+    Libnm libnm(*this);
     std::vector<Connection> conns;
-    const GPtrArray *available = nm_client_get_connections(m_data->Client);
+    const GPtrArray *available = nm_client_get_connections(client());
     for (int i = 0; i < available->len; ++i)
     {
         NMConnection *c = NM_CONNECTION(g_ptr_array_index(available, i));
 
-        bool ok = true;
-        Connection conn = Utility::connectionFromNM(c, ok);
-        if (ok)
+        Connection conn;
+        if (Utility::connectionFromNM(c, conn))
         {
-            conns.push_back(conn);
+            conns.push_back(std::move(conn));
         }
     }
 
     return conns;
 }
 
-Connection NetworkManager::activeConnection(std::string interface)
+Connection NetworkManager::connection(const std::string& uuid, bool& ok)
+{
+    DBusProfiler::Scope profile(m_profiler, "connection");
+    Libnm libnm(*this);
+    NMRemoteConnection *remote = nm_client_get_connection_by_uuid(client(), uuid.c_str());
+    if (remote == NULL)
+    {
+        ok = false;
+        return Connection();
+    }
+
+    ok = true;
+    return Utility::connectionFromNM(NM_CONNECTION(remote), ok);
+}
+
+Connection NetworkManager::activeConnection(const std::string& interface)
 {
     Connection c;
-    NMDevice *device = nm_client_get_device_by_iface(m_data->Client, interface.c_str());
+    activeConnection(interface, c);
+    return c;
+}
+
+void NetworkManager::activeConnection(const std::string& interface, Connection& c)
+{
+    DBusProfiler::Scope profile(m_profiler, "activeConnection");
+    Libnm libnm(*this);
+    c.mode = Mode::AdHoc;
+    c.uuid.clear();
+    c.name.clear();
+    c.ip.clear();
+
+    NMDevice *device = nm_client_get_device_by_iface(client(), interface.c_str());
     if (!NM_IS_DEVICE_WIFI(device)) {
-        return c;
+        return;
     }
     NMActiveConnection* connection = nm_device_get_active_connection(device);
 
     if (connection) {
         NMRemoteConnection* remote = nm_active_connection_get_connection(connection);
-        bool ok;
-        c = Utility::connectionFromNM(NM_CONNECTION(remote), ok);
+        Utility::connectionFromNM(NM_CONNECTION(remote), c);
         NMIPConfig* cfg = nm_active_connection_get_ip4_config(connection);
         if (cfg) {
             const GPtrArray *ips = nm_ip_config_get_addresses(cfg);
             for (int i = 0; i < ips->len; i++) {
                 NMIPAddress *ip = (NMIPAddress*)(g_ptr_array_index(ips, i));
                 if (ip != NULL) {
-                    c.ip = nm_ip_address_get_address(ip);
+                    c.ip.assign(nm_ip_address_get_address(ip));
                 }
 
                 if (!c.ip.empty()) {
@@ -263,49 +1106,79 @@ Connection NetworkManager::activeConnection(std::string interface)
             }
         }
     }
-
-    return c;
 }
 
-WifiNetwork NetworkManager::activeNetwork(std::string interface)
+WifiNetwork NetworkManager::activeNetwork(const std::string& interface)
 {
     WifiNetwork network;
-    NMDevice *device = nm_client_get_device_by_iface(m_data->Client, interface.c_str());
-    if (!NM_IS_DEVICE_WIFI(device)) {
-        return network;
-    }
+    activeNetwork(interface, network);
+    return network;
+}
 
-    bool ok = false;
-    return Utility::getCurrentNetwork(NM_DEVICE_WIFI(device), ok);
+void NetworkManager::activeNetwork(const std::string& interface, WifiNetwork& network)
+{
+    DBusProfiler::Scope profile(m_profiler, "activeNetwork");
+    Libnm libnm(*this);
+    NMDevice *device = nm_client_get_device_by_iface(client(), interface.c_str());
+    NMAccessPoint* ap = NM_IS_DEVICE_WIFI(device) ? nm_device_wifi_get_active_access_point(NM_DEVICE_WIFI(device)) : NULL;
+    if (ap == NULL || !Utility::getWifiNetworkInfo(ap, network)) {
+        // Same as a default constructed one, without giving up the buffers
+        network.ssid.clear();
+        network.bssid.clear();
+        network.password.clear();
+        network.auth = Authentication::None;
+        network.encrypted = false;
+        network.signal = 100;
+        network.frequency = 0;
+        network.count = 1;
+    }
 }
 
-bool NetworkManager::activateConnection(std::string uuid)
+bool NetworkManager::activateConnection(const std::string& uuid, const std::string& iface, Result* result)
 {
-    NMRemoteConnection *conn = nm_client_get_connection_by_uuid(m_data->Client, uuid.c_str());
+    DBusProfiler::Scope profile(m_profiler, "activateConnection");
+    // Operation lock is held across waits, so it is always taken before the libnm lock
+    std::lock_guard<std::mutex> operation(operationLock(iface));
+    Libnm libnm(*this);
+    NMRemoteConnection *conn = nm_client_get_connection_by_uuid(client(), uuid.c_str());
     if (conn == NULL)
     {
         return false;
     }
 
-    AddConnectionData *data = new AddConnectionData;
-    data->data = m_data;
-    data->Activate = true;
+    AddConnectionData data;
+    data.data = m_data;
+    if (!iface.empty())
+    {
+        data.Device = nm_client_get_device_by_iface(client(), iface.c_str());
+    }
+
+    // Profile added in memory is kept once it works
+    if (m_volatile && nm_remote_connection_get_unsaved(conn)) {
+        data.Unsaved = (NMRemoteConnection*)g_object_ref(conn);
+    }
 
-    nm_client_activate_connection_async(m_data->Client, NM_CONNECTION(conn),
-                                        NULL, NULL, NULL,
-                                        Callbacks::connectionActivated, data);
-    g_main_loop_run(m_data->Loop); // Wait
+    data.PhaseStarted = Clock::instance().now();
+    nm_client_activate_connection_async(client(), NM_CONNECTION(conn),
+                                        data.Device, NULL, NULL,
+                                        Callbacks::connectionActivated, &data);
+    waitFor(data.Done);
+    rememberPhases(std::move(data.Phases));
+    if (result != NULL) {
+        *result = data.Outcome;
+    }
     return true;
 }
 
-Result NetworkManager::connectoToNetwork(std::string iface, WifiNetwork network)
+Result NetworkManager::connectoToNetwork(const std::string& iface, const WifiNetwork& network)
 {
+    DBusProfiler::Scope profile(m_profiler, "connectoToNetwork");
+    std::lock_guard<std::mutex> operation(operationLock(iface));
+    Libnm libnm(*this);
     InternetConnectionAvailable.blockSignals(true);
     LastConnectResult = Result::Initilizaling;
 
-    auto ctx = g_main_loop_get_context(m_data->Loop);
-    int count = 0;
-    NMDevice *device = nm_client_get_device_by_iface(m_data->Client, iface.c_str());
+    NMDevice *device = nm_client_get_device_by_iface(client(), iface.c_str());
     if (!NM_IS_DEVICE_WIFI(device))
     {
         InternetConnectionAvailable.blockSignals(false);
@@ -336,7 +1209,12 @@ Result NetworkManager::connectoToNetwork(std::string iface, WifiNetwork network)
         if (mode == NM_SETTING_WIRELESS_MODE_AP)
         {
             LOG_DEBUG << "Current connection is HotSpot and scanning is not available. Deactivateing to scan";
-            if (!nm_client_deactivate_connection(m_data->Client, activeConnection, NULL, &error) || error != NULL)
+            bool deactivated;
+            {
+                DBusProfiler::Blocking blocking;
+                deactivated = nm_client_deactivate_connection(client(), activeConnection, NULL, &error);
+            }
+            if (!deactivated || error != NULL)
             {
                 LOG_DEBUG << "Can't deactivate active conenction. Error:" << error->message;
                 g_error_free(error);
@@ -344,21 +1222,29 @@ Result NetworkManager::connectoToNetwork(std::string iface, WifiNetwork network)
                 return LastConnectResult.set(Result::InternalError);
             }
 
-            nm_client_wireless_set_enabled(m_data->Client, FALSE);
-            nm_client_wireless_set_enabled(m_data->Client, TRUE);
+            DBusProfiler::Blocking blocking;
+            nm_client_wireless_set_enabled(client(), FALSE);
+            nm_client_wireless_set_enabled(client(), TRUE);
         }
     }
 
+    // Network missing from the broadcast scans so far answers probes only, its profile must say so
+    // or NM won't find it again when it reconnects
+    bool hidden = listedAccessPoint(NM_DEVICE_WIFI(device), network.ssid) == NULL;
+
+    // Each probe may wait for its results, the deadline bounds the whole search
+    Clock& clock = Clock::instance();
+    auto deadline = clock.now() + FindNetworkTimeout;
     NMAccessPoint *ap = NULL;
-    while (count < 45 && ap == NULL)
+    while (true)
     {
         LOG_DEBUG << "Trying to find network " << network.ssid;
-        while (g_main_context_pending(NULL)) {
-            g_main_context_iteration(NULL, FALSE);
-        }
         ap = getAccessPoint(iface, network.ssid);
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        count++;
+        if (ap != NULL || clock.now() + std::chrono::seconds(1) >= deadline) {
+            break;
+        }
+        Unlocked unlocked(*this);
+        clock.sleepFor(std::chrono::seconds(1));
     }
 
     if (ap == NULL)
@@ -392,6 +1278,8 @@ Result NetworkManager::connectoToNetwork(std::string iface, WifiNetwork network)
                  NM_SETTING_WIRELESS_BSSID, nm_access_point_get_bssid(ap),
                  NM_SETTING_WIRELESS_MODE, NM_SETTING_WIRELESS_MODE_INFRA,
                  NM_SETTING_WIRELESS_BAND, "bg",
+                 NM_SETTING_WIRELESS_POWERSAVE, (guint)powerSettings().powerSave,
+                 NM_SETTING_WIRELESS_HIDDEN, hidden ? TRUE : FALSE,
                  NULL);
 
     nm_connection_add_setting(connection, NM_SETTING(wireless));
@@ -451,25 +1339,40 @@ Result NetworkManager::connectoToNetwork(std::string iface, WifiNetwork network)
         return LastConnectResult.set(Result::InternalError);
     }
 
-    AddConnectionData *options = new AddConnectionData();
-    options->data = m_data;
-    options->Activate = true;
-
-    nm_client_add_connection_async(m_data->Client, connection, true, NULL, Callbacks::addedNewConnection, options);
-
-    g_main_loop_run(m_data->Loop); // Wait
+    AddConnectionData options;
+    options.data = m_data;
+    options.Device = device;
+
+    // Profile is added and activated on the found access point in one request
+    options.PhaseStarted = Clock::instance().now();
+#ifdef NM_VERSION_1_16
+    if (m_volatile) {
+        // Written to disk only after the link is up, failed attempts leave nothing behind
+        options.InMemory = true;
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+        g_variant_builder_add(&builder, "{sv}", "persist", g_variant_new_string("memory"));
+        nm_client_add_and_activate_connection2(client(), connection, device,
+                                               nm_object_get_path(NM_OBJECT(ap)),
+                                               g_variant_builder_end(&builder), NULL,
+                                               Callbacks::addedAndActivated, &options);
+    } else
+#endif
+    nm_client_add_and_activate_connection_async(client(), connection, device,
+                                                nm_object_get_path(NM_OBJECT(ap)), NULL,
+                                                Callbacks::addedAndActivated, &options);
+    waitFor(options.Done);
+    rememberPhases(std::move(options.Phases));
 
     g_object_unref(connection);
     InternetConnectionAvailable.blockSignals(false);
-    return LastConnectResult.value;
+    return options.Outcome;
 }
 
-Result NetworkManager::createHotspot(std::string iface, WifiNetwork network)
+Result NetworkManager::createHotspot(const std::string& iface, const WifiNetwork& network, Channel channel, std::string* profileUUID)
 {
-    auto ctx = g_main_loop_get_context(m_data->Loop);
-    int count = 0;
-    NMDeviceWifi *device = NULL;
-
+    DBusProfiler::Scope profile(m_profiler, "createHotspot");
+    Libnm libnm(*this);
     NMConnection *connection = nm_simple_connection_new();
 
     NMSettingConnection *settingConnection = (NMSettingConnection *)nm_setting_connection_new();
@@ -480,6 +1383,9 @@ Result NetworkManager::createHotspot(std::string iface, WifiNetwork network)
                  NM_SETTING_CONNECTION_TYPE, NM_SETTING_WIRELESS_SETTING_NAME,
                  NM_SETTING_CONNECTION_AUTOCONNECT, FALSE,
                  NULL);
+    if (profileUUID != NULL) {
+        *profileUUID = uuid;
+    }
     g_free(uuid);
     nm_connection_add_setting(connection, NM_SETTING(settingConnection));
 
@@ -489,10 +1395,28 @@ Result NetworkManager::createHotspot(std::string iface, WifiNetwork network)
     g_object_set(G_OBJECT(wireless),
                  NM_SETTING_WIRELESS_SSID, ssidBytes,
                  NM_SETTING_WIRELESS_MODE, NM_SETTING_WIRELESS_MODE_AP,
+                 NM_SETTING_WIRELESS_POWERSAVE, (guint)powerSettings().powerSave,
                  NULL);
 
     g_bytes_unref(ssidBytes);
 
+    if (channel.number == 0) {
+        // Cached results are empty at boot, the planner needs fresh ones
+        NMDeviceWifi *dev = requestScan(iface, false, std::vector<std::string>(), true);
+        if (dev != NULL) {
+            channel = ChannelPlanner::select(dev, channel.band);
+        }
+    } else if (channel.band == Band::Auto) {
+        channel.band = ChannelPlanner::bandOf(channel.number);
+    }
+
+    if (channel.number != 0) {
+        g_object_set(G_OBJECT(wireless),
+                     NM_SETTING_WIRELESS_BAND, channel.band == Band::A ? "a" : "bg",
+                     NM_SETTING_WIRELESS_CHANNEL, channel.number,
+                     NULL);
+    }
+
     nm_connection_add_setting(connection, NM_SETTING(wireless));
 
     if (network.auth == Authentication::Enterprise)
@@ -543,18 +1467,15 @@ Result NetworkManager::createHotspot(std::string iface, WifiNetwork network)
         LOG_ERROR << "Verification failed: " << error->message;
         return LastConnectResult.set(Result::BadParameters);
     }
-    else
-    {
-        AddConnectionData *options = new AddConnectionData();
-        options->data = m_data;
-        options->Activate = false;
-        nm_client_add_connection_async(m_data->Client, connection, true, NULL, Callbacks::addedNewConnection, options);
-    }
 
-    g_main_loop_run(m_data->Loop); // Wait
+    AddConnectionData options;
+    options.data = m_data;
+    // Unsaved profile is written once activateConnection brought it up
+    nm_client_add_connection_async(client(), connection, !m_volatile, NULL, Callbacks::addedNewConnection, &options);
+    waitFor(options.Done);
     g_object_unref(connection);
 
-    return m_data->LastConnectResult.value;
+    return options.Outcome;
 }
 
 NetworkManager &NetworkManager::i()
@@ -6,8 +6,21 @@
 #include <thread>
 #include <functional>
 #include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
 #include <NetworkManager.h>
 #include "networksignals.h"
+#include "roaming.h"
+#include "connectivity.h"
+#include "dispatcher.h"
+#include "telemetry.h"
+#include "eventlog.h"
+#include "clock.h"
+#include "powerprofile.h"
+#include "dbusprofiler.h"
 
 using namespace SignalSlot;
 
@@ -19,23 +32,178 @@ namespace IoT
         ~NetworkManager();
     public:
         std::vector<std::string> devices();
-        std::vector<WifiNetwork> scan(std::string interface, bool force = false);
+        typedef std::function<void(const WifiNetwork&)> ScanVisitor;
+        typedef std::function<bool(NMAccessPoint*)> ScanFilter;
+
+        std::vector<WifiNetwork> scan(const std::string& interface, bool force = false);
+        // Reuses elements of networks
+        void scanInto(const std::string& interface, std::vector<WifiNetwork>& networks, bool force = false);
+        // Filter is applied to raw access points, visitor gets only accepted ones. Both run
+        // with the libnm lock held
+        void scanEach(const std::string& interface, const ScanVisitor& visitor, const ScanFilter& filter = ScanFilter(), bool force = false);
+        // Grouped, filtered and ordered by signal, reuses elements of networks
+        void scanQuery(const std::string& interface, const ScanQuery& query, std::vector<WifiNetwork>& networks, bool force = false);
+        // Probes for the given SSIDs only, hidden networks included. Access points of these
+        // networks are returned, reusing elements of networks
+        void scanFor(const std::string& interface, const std::vector<std::string>& ssids, std::vector<WifiNetwork>& networks);
+        std::vector<WifiNetwork> scanFor(const std::string& interface, const std::vector<std::string>& ssids);
         std::vector<Connection> connections();
-        Connection activeConnection(std::string interface);
-        WifiNetwork activeNetwork(std::string interface);
-        bool activateConnection(std::string uuid);
-        Result connectoToNetwork(std::string iface, WifiNetwork wifi);
-        Result createHotspot(std::string iface, WifiNetwork wifi);
+        Connection connection(const std::string& uuid, bool& ok);
+        Connection activeConnection(const std::string& interface);
+        WifiNetwork activeNetwork(const std::string& interface);
+        // Fill the caller's objects, strings keep their buffers
+        void activeConnection(const std::string& interface, Connection& connection);
+        void activeNetwork(const std::string& interface, WifiNetwork& network);
+        // With iface set, waits until the device is activated or fails. Result is this call's own,
+        // calls on the same interface are queued
+        bool activateConnection(const std::string& uuid, const std::string& iface = std::string(), Result* result = NULL);
+        Result connectoToNetwork(const std::string& iface, const WifiNetwork& wifi);
+        Result createHotspot(const std::string& iface, const WifiNetwork& wifi, Channel channel = Channel(), std::string* uuid = NULL);
+        // Moves a hotspot profile to the least congested channel before it's activated.
+        // Only NM's copy is changed, the profile on disk keeps its first channel
+        bool planHotspot(const std::string& uuid, const std::string& iface, Band band);
+        // Runs the scan channel planning needs ahead of time, createHotspot and planHotspot
+        // share it while it runs and reuse its results for scanMaxAge
+        void prepareHotspot(const std::string& iface);
+        // New profiles are kept in memory and saved to disk only once they activated,
+        // station profiles of failed attempts are deleted
+        void setVolatileProfiles(bool enabled);
         static NetworkManager& i();
+        // Skips loading of objects the library doesn't use, must be called before first i()
+        static void setLazyStartup(bool lazy);
         void update();
+        // False while the NM daemon is down, operations are held meanwhile
+        bool isRunning() const;
+        void markStartupPhase(std::string name);
+        std::vector<StartupPhase> startupPhases() const;
+        // Result and duration of each phase of the last connect or activation
+        std::vector<ConnectPhase> connectPhases() const;
+        void setRoamingPolicy(const RoamingPolicy& policy);
+        void setConnectivityCheck(const ConnectivityConfig& config);
+        // Zero period disables link sampling
+        void setTelemetry(size_t capacity, std::chrono::milliseconds period);
+        LinkStatistics linkStatistics(const std::string& iface, std::chrono::seconds window);
+        // Captures device states, scans and connection results into a binary log
+        bool startRecording(const std::string& path);
+        void stopRecording();
+        // Feeds a recorded log to subscribers instead of live NetworkManager data,
+        // meant for offline runs where the daemon isn't reachable
+        ReplayReport replay(const std::string& path, bool realTime = false);
+        // Tracker cadence, reuse of recent scans and power save. A power save change is written
+        // into existing WiFi profiles and reapplied to active ones
+        void setPowerSettings(const PowerSettings& settings);
+        PowerSettings powerSettings() const;
+        // Tracker and GLib dispatch wakeups during the last minute
+        unsigned wakeupsPerMinute() const;
+        // Counts D-Bus messages and blocking waits per public call and tracker pass.
+        // Operations are named after the methods, the tracker pass is "tracker"
+        void setDBusProfiling(bool enabled);
+        void setDBusBudget(const std::string& operation, const DBusBudget& budget);
+        std::vector<DBusOperationStats> dbusStatistics() const;
+        void resetDBusStatistics();
 
         SignalSlot::Signal<std::string, ActiveConnection> ActiveConnectionChanged;
     private:
-        NMAccessPoint* getAccessPoint(std::string iface, std::string ssid);
+        // Held wherever libnm objects are used, the dispatch thread changes them under it.
+        // Taken again by the same thread it only counts
+        class Libnm
+        {
+        public:
+            explicit Libnm(NetworkManager& nm);
+            ~Libnm();
+        private:
+            NetworkManager& m_nm;
+        };
+
+        // Releases the thread's libnm lock entirely while it blocks, so callbacks get in
+        class Unlocked
+        {
+        public:
+            explicit Unlocked(NetworkManager& nm);
+            ~Unlocked();
+        private:
+            NetworkManager& m_nm;
+            unsigned m_depth;
+        };
+
+        // Scan state of an interface, kept once created so scans don't allocate
+        struct ScanFlight
+        {
+            bool running = false;
+            bool complete = false; // Running scan is untargeted and waits for its results
+            unsigned long finished = 0;
+            Clock::TimePoint completed; // Results of the last complete scan arrived
+        };
+
+        void startup();
+        // Runs GLib's default context until destruction, waiters are notified after every dispatch
+        void dispatchEvents();
+        NMClient* client();
+        // One tracker iteration over WiFi devices
+        void pass(const GPtrArray* devices, bool tracking, bool sampling, bool refresh);
+        // Refresh publishes the state even when it didn't change
+        void track(NMDevice* device, bool refresh);
+        // Drops state derived from NM objects after the daemon came back
+        void rebuild();
+        bool remember(const std::string& iface, const ActiveConnection& connection);
+        void rememberPhases(std::vector<ConnectPhase> phases);
+        void applyPowerSave(PowerSave powerSave);
+        void publish(const std::string& iface, ConnectionStatus now, const ActiveConnection& connection, bool changed, bool available, bool refresh = false);
+        void inject(const RecordedEvent& event);
+        void sample(NMDevice* device);
+        // With ssids, the scan probes for them and returns once the results are in. Fresh returns
+        // once the results are in as well, otherwise NM accepting the request is enough
+        NMDeviceWifi* requestScan(const std::string& interface, bool force,
+                                  const std::vector<std::string>& ssids = std::vector<std::string>(), bool fresh = false);
+        // Blocks until done is set by a callback on the dispatch thread
+        void waitFor(const std::atomic<bool>& done);
+        // Blocks until ready holds, it is checked with the libnm lock held after every dispatch
+        void waitFor(const std::function<bool()>& ready);
+        // Held while an operation changes the interface's connection
+        std::mutex& operationLock(const std::string& iface);
+        NMAccessPoint* getAccessPoint(const std::string& iface, const std::string& ssid);
+        // Looks the network up in the device's current list, doesn't scan
+        NMAccessPoint* listedAccessPoint(NMDeviceWifi* dev, const std::string& ssid);
+        bool roam(NMDevice* device, NMAccessPoint* ap);
     protected:
         struct Data* m_data;
+        std::mutex m_trackMx; // Held by tracker passes and injected events, guards what they publish from
         std::unordered_map<std::string, ActiveConnection> m_activeConnections;
+        ActiveConnection m_tracked;
+        std::string m_trackedIface;
+        RecordedEvent m_trackedEvent;
+        int m_internet; // Last posted by the tracker, -1 before the first pass
+        std::atomic<bool> m_volatile;
         std::thread m_networkTracker;
+        std::thread m_dispatchLoop; // Owns GLib's default context
+        std::recursive_mutex m_libnmMx; // See Libnm
+        std::condition_variable_any m_dispatchCv;
+        Roaming m_roaming;
+        ConnectivityChecker m_connectivity;
+        Dispatcher m_dispatcher;
+        LinkTelemetry m_telemetry;
+        DBusProfiler m_profiler;
+        EventRecorder m_recorder;
+        std::mutex m_replayMx;
+        std::unordered_map<std::string, std::vector<WifiNetwork>> m_replayScans;
+        mutable std::mutex m_powerMx;
+        std::condition_variable m_powerCv;
+        PowerSettings m_power;
+        WakeupCounter m_wakeups;
+        std::unordered_map<std::string, Clock::TimePoint> m_scanned;
+        std::unordered_map<std::string, ScanFlight> m_scans; // Under the libnm lock, running one is joined by concurrent callers
+        std::mutex m_operationsMx;
+        std::unordered_map<std::string, std::unique_ptr<std::mutex>> m_operations;
+        std::atomic<bool> m_rebuild;
+        std::atomic<bool> m_recheck; // Connectivity result came in, a pass publishes it
+        std::atomic<bool> m_stop; // Set by the destructor, the tracker returns
+        std::atomic<bool> m_stopDispatch; // Set once the tracker is joined, dispatch needs to outlive it
+
+        Clock::TimePoint m_created;
+        mutable std::mutex m_phasesMx;
+        std::vector<StartupPhase> m_phases;
+        std::vector<ConnectPhase> m_connectPhases;
+        static bool s_lazyStartup;
     };
 }
 
@@ -4,6 +4,7 @@
 #include "wifinetwork.h"
 #include <s2s.h>
 #include <s2s_property.h>
+#include <chrono>
 #include <string>
 
 namespace IoT
@@ -40,7 +41,18 @@ namespace IoT
         BadCredentials,
         Added,
         Connected,
-        Disconnected
+        Disconnected,
+        Rejected,
+        DHCPTimeout,
+        Timeout
+    };
+
+    // Step of a connect attempt: "request" until NM accepted it, then "activation"
+    struct ConnectPhase
+    {
+        std::string name;
+        Result result;
+        std::chrono::microseconds elapsed;
     };
 
     struct ActiveConnection: public Connection, public WifiNetwork
@@ -48,6 +60,7 @@ namespace IoT
         bool operator == (const ActiveConnection& src) const
         {
             return ssid == src.ssid &&
+                   bssid == src.bssid &&
                    auth == src.auth &&
                    encrypted == src.encrypted &&
                    signal == src.signal &&
@@ -1,13 +1,24 @@
 #ifndef IOT_NM_PRIVATE_DATA
 #define IOT_NM_PRIVATE_DATA
 
+#include <NetworkManager.h>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 #include "networksignals.h"
 namespace IoT
 {
     struct Data: public NetworkSignals
     {
-        NMClient* Client;
-        GMainLoop* Loop;
+        NMClient* Client = NULL;
+
+        // Client is created asynchronously, Ready is set once creation finished (even if failed)
+        std::mutex ReadyMx;
+        std::condition_variable ReadyCv;
+        bool Ready = false;
+        // NM daemon presence, guarded by ReadyMx as well
+        bool Running = true;
+        std::function<void(bool)> RunningChanged;
     };
 }
 
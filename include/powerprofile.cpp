@@ -0,0 +1,71 @@
+#include "powerprofile.h"
+#include <algorithm>
+
+using namespace IoT;
+
+PowerSettings PowerSettings::of(PowerProfile profile)
+{
+    PowerSettings settings;
+    settings.profile = profile;
+
+    switch (profile) {
+    case PowerProfile::LowLatency:
+        settings.trackPeriod = std::chrono::milliseconds(1000);
+        settings.scanMaxAge = std::chrono::seconds(0);
+        settings.powerSave = PowerSave::Disable;
+        settings.reconnect.initialDelay = std::chrono::milliseconds(200);
+        settings.reconnect.maxDelay = std::chrono::milliseconds(5000);
+        settings.reconnect.multiplier = 1.5;
+        settings.reconnect.maxAttempts = 0;
+        break;
+    case PowerProfile::Balanced:
+        break;
+    case PowerProfile::Battery:
+        settings.trackPeriod = std::chrono::milliseconds(30000);
+        settings.scanMaxAge = std::chrono::seconds(120);
+        settings.powerSave = PowerSave::Enable;
+        settings.reconnect.initialDelay = std::chrono::milliseconds(5000);
+        settings.reconnect.maxDelay = std::chrono::milliseconds(600000);
+        settings.reconnect.multiplier = 3.0;
+        settings.reconnect.maxAttempts = 4;
+        break;
+    }
+    return settings;
+}
+
+void WakeupCounter::expire(uint64_t second) const
+{
+    if (second - m_second >= Buckets) {
+        std::fill(m_buckets, m_buckets + Buckets, 0);
+    } else {
+        for (uint64_t s = m_second + 1; s <= second; ++s) {
+            m_buckets[s % Buckets] = 0;
+        }
+    }
+    m_second = second;
+}
+
+void WakeupCounter::hit()
+{
+    uint64_t second = std::chrono::duration_cast<std::chrono::seconds>(Clock::instance().now().time_since_epoch()).count();
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (second > m_second) {
+        expire(second);
+    }
+    ++m_buckets[second % Buckets];
+}
+
+unsigned WakeupCounter::perMinute() const
+{
+    uint64_t second = std::chrono::duration_cast<std::chrono::seconds>(Clock::instance().now().time_since_epoch()).count();
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (second > m_second) {
+        expire(second);
+    }
+
+    unsigned total = 0;
+    for (unsigned count : m_buckets) {
+        total += count;
+    }
+    return total;
+}
@@ -0,0 +1,55 @@
+#ifndef IOT_POWER_PROFILE_H
+#define IOT_POWER_PROFILE_H
+
+#include <chrono>
+#include <mutex>
+#include "wifinetwork.h"
+#include "clock.h"
+
+namespace IoT
+{
+    enum class PowerProfile
+    {
+        LowLatency, // Mains powered, reacts within a second
+        Balanced,   // 5 s tracker, unforced scans reuse results for 10 s, NM's power save default
+        Battery     // Rare wakeups, radio sleeps between beacons
+    };
+
+    // Values of NM_SETTING_WIRELESS_POWERSAVE
+    enum class PowerSave
+    {
+        Default = 0,
+        Ignore = 1,
+        Disable = 2,
+        Enable = 3
+    };
+
+    struct PowerSettings
+    {
+        PowerProfile profile = PowerProfile::Balanced;
+        std::chrono::milliseconds trackPeriod = std::chrono::milliseconds(5000);
+        std::chrono::seconds scanMaxAge = std::chrono::seconds(10); // Unforced scans reuse younger results
+        PowerSave powerSave = PowerSave::Default; // Written into new and existing WiFi profiles
+        ReconnectPolicy reconnect;
+
+        static PowerSettings of(PowerProfile profile);
+    };
+
+    // Wakeups over the last minute, kept in one second buckets
+    class WakeupCounter
+    {
+    public:
+        void hit();
+        unsigned perMinute() const;
+    private:
+        static const unsigned Buckets = 60;
+
+        void expire(uint64_t second) const;
+
+        mutable std::mutex m_mx;
+        mutable unsigned m_buckets[Buckets] = {};
+        mutable uint64_t m_second = 0;
+    };
+}
+
+#endif // IOT_POWER_PROFILE_H
@@ -0,0 +1,557 @@
+#include "provisioning.h"
+#include "log.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace IoT;
+
+static const size_t MaxRequest = 8192;
+static const size_t MaxClients = 64;
+static const std::chrono::seconds IdleTimeout(30);
+
+static const char* const Page =
+    "<!DOCTYPE html><html><head><meta name=\"viewport\" content=\"width=device-width\"><title>Setup</title></head>"
+    "<body><h3>Select network</h3><form method=\"post\" action=\"/connect\">"
+    "<select name=\"ssid\" id=\"ssid\"></select><br><input type=\"password\" name=\"password\" placeholder=\"Password\"><br>"
+    "<button>Connect</button></form><script>"
+    "fetch('/networks').then(r=>r.json()).then(l=>l.forEach(n=>{"
+    "var o=document.createElement('option');o.value=o.text=n.ssid;document.getElementById('ssid').add(o);}));"
+    "</script></body></html>";
+
+namespace
+{
+    const char* statusText(int status)
+    {
+        switch (status)
+        {
+            case 200: return "OK";
+            case 202: return "Accepted";
+            case 400: return "Bad Request";
+            case 404: return "Not Found";
+            default: return "Error";
+        }
+    }
+
+    const char* authName(Authentication auth)
+    {
+        switch (auth)
+        {
+            case Authentication::None: return "none";
+            case Authentication::WEP: return "wep";
+            case Authentication::WPA: return "wpa";
+            case Authentication::WPA2: return "wpa2";
+            case Authentication::Enterprise: return "enterprise";
+        }
+        return "unknown";
+    }
+
+    void appendJsonString(std::string& out, const std::string& value)
+    {
+        out.push_back('"');
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                out.push_back('\\');
+                out.push_back(c);
+            } else if ((unsigned char)c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+                out.append(escaped);
+            } else {
+                out.push_back(c);
+            }
+        }
+        out.push_back('"');
+    }
+
+    std::string urlDecode(const std::string& value)
+    {
+        std::string out;
+        out.reserve(value.size());
+        for (size_t i = 0; i < value.size(); ++i) {
+            if (value[i] == '+') {
+                out.push_back(' ');
+            } else if (value[i] == '%' && i + 2 < value.size() && isxdigit(value[i + 1]) && isxdigit(value[i + 2])) {
+                out.push_back((char)strtol(value.substr(i + 1, 2).c_str(), NULL, 16));
+                i += 2;
+            } else {
+                out.push_back(value[i]);
+            }
+        }
+        return out;
+    }
+
+    std::string formValue(const std::string& form, const std::string& key)
+    {
+        size_t pos = 0;
+        while (pos <= form.size()) {
+            size_t end = form.find('&', pos);
+            if (end == std::string::npos) {
+                end = form.size();
+            }
+
+            size_t eq = form.find('=', pos);
+            if (eq != std::string::npos && eq < end && form.compare(pos, eq - pos, key) == 0) {
+                return urlDecode(form.substr(eq + 1, end - eq - 1));
+            }
+            pos = end + 1;
+        }
+        return std::string();
+    }
+
+    bool sameNetworks(const std::vector<WifiNetwork>& l, const std::vector<WifiNetwork>& r)
+    {
+        if (l.size() != r.size()) {
+            return false;
+        }
+
+        for (size_t i = 0; i < l.size(); ++i) {
+            if (l[i].ssid != r[i].ssid || l[i].bssid != r[i].bssid || l[i].auth != r[i].auth ||
+                l[i].encrypted != r[i].encrypted || l[i].signal != r[i].signal || l[i].frequency != r[i].frequency) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+ProvisioningServer::ProvisioningServer()
+    : m_running(false)
+    , m_maxAge(30)
+    , m_worker(4, 1)
+{
+    m_page = respond(200, "text/html", Page);
+    m_accepted = respond(202, "text/plain", "Connecting\n");
+    m_networksResponse = respond(200, "application/json", "[]");
+}
+
+ProvisioningServer::~ProvisioningServer()
+{
+    stop();
+}
+
+ProvisioningServer::Response ProvisioningServer::respond(int status, const char* type, const std::string& body)
+{
+    char head[160];
+    snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nCache-Control: no-store\r\n\r\n",
+             status, statusText(status), type, body.size());
+    std::shared_ptr<std::string> response = std::make_shared<std::string>(head);
+    response->append(body);
+    return response;
+}
+
+void ProvisioningServer::setScanSource(ScanSource source, std::chrono::seconds maxAge)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_source = std::move(source);
+    m_maxAge = maxAge;
+    m_scanned = std::chrono::steady_clock::time_point();
+}
+
+void ProvisioningServer::onCredentials(CredentialsHandler handler)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_credentials = std::move(handler);
+}
+
+void ProvisioningServer::setNetworks(const std::vector<WifiNetwork>& networks)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_scanned = std::chrono::steady_clock::now();
+    if (m_rebuilds != 0 && sameNetworks(networks, m_networks)) {
+        return;
+    }
+
+    std::string json = "[";
+    for (const WifiNetwork& network : networks) {
+        if (json.size() > 1) {
+            json.push_back(',');
+        }
+        json.append("{\"ssid\":");
+        appendJsonString(json, network.ssid);
+        json.append(",\"bssid\":");
+        appendJsonString(json, network.bssid);
+        json.append(",\"signal\":");
+        json.append(std::to_string(network.signal));
+        json.append(",\"secure\":");
+        json.append(network.encrypted ? "true" : "false");
+        json.append(",\"auth\":\"");
+        json.append(authName(network.auth));
+        json.append("\",\"frequency\":");
+        json.append(std::to_string(network.frequency));
+        json.push_back('}');
+    }
+    json.push_back(']');
+
+    m_networks = networks;
+    m_networksResponse = respond(200, "application/json", json);
+    m_rebuilds++;
+}
+
+size_t ProvisioningServer::rebuilds() const
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    return m_rebuilds;
+}
+
+unsigned ProvisioningServer::wakeupsPerMinute() const
+{
+    return m_wakeups.perMinute();
+}
+
+ProvisioningServer::Response ProvisioningServer::networks()
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_source && !m_refreshing && std::chrono::steady_clock::now() - m_scanned > m_maxAge) {
+        // Scans take seconds, stale list is served until the new one is ready
+        m_refreshing = true;
+        m_worker.post("scan", [this]() { refresh(); });
+    }
+    return m_networksResponse;
+}
+
+void ProvisioningServer::refresh()
+{
+    ScanSource source;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        source = m_source;
+    }
+
+    std::vector<WifiNetwork> networks;
+    source(networks);
+    setNetworks(networks);
+
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_refreshing = false;
+}
+
+bool ProvisioningServer::start(unsigned short port, const std::string& address)
+{
+    if (m_running) {
+        return true;
+    }
+
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &sa.sin_addr) != 1) {
+        LOG_ERROR << "Invalid address " << address;
+        return false;
+    }
+
+    m_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    if (m_listen < 0 || setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+        bind(m_listen, (sockaddr*)&sa, sizeof(sa)) < 0 || listen(m_listen, 16) < 0) {
+        LOG_ERROR << "Can't listen on " << address << ":" << port << ": " << strerror(errno);
+        stop();
+        return false;
+    }
+
+    socklen_t len = sizeof(sa);
+    getsockname(m_listen, (sockaddr*)&sa, &len);
+    m_port = ntohs(sa.sin_port);
+
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epoll < 0 || m_wakeup < 0) {
+        LOG_ERROR << "Can't create epoll: " << strerror(errno);
+        stop();
+        return false;
+    }
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = m_listen;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listen, &ev);
+    ev.data.fd = m_wakeup;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev);
+
+    LOG_INFO << "Provisioning server listens on " << address << ":" << m_port;
+    m_running = true;
+    m_thread = std::thread(&ProvisioningServer::run, this);
+    return true;
+}
+
+void ProvisioningServer::stop()
+{
+    if (m_running.exchange(false)) {
+        uint64_t one = 1;
+        ssize_t written = ::write(m_wakeup, &one, sizeof(one));
+        (void)written;
+        m_thread.join();
+    }
+
+    for (auto& client : m_clients) {
+        close(client.first);
+    }
+    m_clients.clear();
+
+    for (int* fd : { &m_listen, &m_epoll, &m_wakeup }) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+bool ProvisioningServer::isRunning() const
+{
+    return m_running;
+}
+
+unsigned short ProvisioningServer::port() const
+{
+    return m_port;
+}
+
+void ProvisioningServer::run()
+{
+    epoll_event events[32];
+    while (m_running) {
+        // Sleeps until the longest idle client is due, with no clients until something happens
+        int timeout = -1;
+        if (!m_clients.empty()) {
+            auto due = std::chrono::steady_clock::time_point::max();
+            for (const auto& client : m_clients) {
+                due = std::min(due, client.second.active + IdleTimeout);
+            }
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(due - std::chrono::steady_clock::now()).count();
+            timeout = left < 0 ? 0 : (int)left + 1;
+        }
+
+        int count = epoll_wait(m_epoll, events, 32, timeout);
+        m_wakeups.hit();
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == m_listen) {
+                accept();
+                continue;
+            }
+
+            if (fd == m_wakeup) {
+                continue;
+            }
+
+            auto pos = m_clients.find(fd);
+            if (pos == m_clients.end()) {
+                continue;
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                drop(fd);
+                continue;
+            }
+
+            if (events[i].events & EPOLLIN) {
+                read(fd, pos->second);
+            } else if (events[i].events & EPOLLOUT) {
+                update(fd, pos->second);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = m_clients.begin(); it != m_clients.end();) {
+            if (now - it->second.active > IdleTimeout) {
+                close(it->first);
+                it = m_clients.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+void ProvisioningServer::accept()
+{
+    while (true) {
+        int fd = accept4(m_listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        if (m_clients.size() >= MaxClients) {
+            close(fd);
+            continue;
+        }
+
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+        m_clients[fd].active = std::chrono::steady_clock::now();
+    }
+}
+
+void ProvisioningServer::read(int fd, Client& client)
+{
+    char buffer[2048];
+    while (true) {
+        ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if (got > 0) {
+            client.in.append(buffer, got);
+            if (client.in.size() > MaxRequest) {
+                drop(fd);
+                return;
+            }
+            continue;
+        }
+
+        if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            drop(fd);
+            return;
+        }
+        break;
+    }
+
+    client.active = std::chrono::steady_clock::now();
+    if (!handle(client)) {
+        client.out.push_back(respond(400, "text/plain", "Bad request\n"));
+        client.close = true;
+    }
+    update(fd, client);
+}
+
+bool ProvisioningServer::write(int fd, Client& client)
+{
+    while (!client.out.empty()) {
+        const std::string& data = *client.out.front();
+        ssize_t sent = send(fd, data.data() + client.offset, data.size() - client.offset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        client.offset += sent;
+        if (client.offset == data.size()) {
+            client.out.erase(client.out.begin());
+            client.offset = 0;
+        }
+    }
+    return !client.close;
+}
+
+void ProvisioningServer::update(int fd, Client& client)
+{
+    if (!write(fd, client)) {
+        drop(fd);
+        return;
+    }
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = client.out.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT;
+    ev.data.fd = fd;
+    epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void ProvisioningServer::drop(int fd)
+{
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    m_clients.erase(fd);
+}
+
+bool ProvisioningServer::handle(Client& client)
+{
+    while (!client.close) {
+        size_t headerEnd = client.in.find("\r\n\r\n");
+        if (headerEnd == std::string::npos) {
+            return true;
+        }
+
+        size_t lineEnd = client.in.find("\r\n");
+        size_t methodEnd = client.in.find(' ');
+        size_t pathEnd = methodEnd == std::string::npos ? std::string::npos : client.in.find(' ', methodEnd + 1);
+        if (pathEnd == std::string::npos || pathEnd > lineEnd) {
+            return false;
+        }
+
+        std::string method = client.in.substr(0, methodEnd);
+        std::string path = client.in.substr(methodEnd + 1, pathEnd - methodEnd - 1);
+        bool keepAlive = client.in.compare(pathEnd + 1, lineEnd - pathEnd - 1, "HTTP/1.1") == 0;
+
+        size_t length = 0;
+        for (size_t pos = lineEnd + 2; pos < headerEnd;) {
+            size_t end = client.in.find("\r\n", pos);
+            std::string header = client.in.substr(pos, end - pos);
+            pos = end + 2;
+
+            size_t colon = header.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+
+            std::string name = header.substr(0, colon);
+            std::string value = header.substr(colon + 1);
+            value.erase(0, value.find_first_not_of(' '));
+            for (char& c : name) {
+                c = tolower(c);
+            }
+            for (char& c : value) {
+                c = tolower(c);
+            }
+
+            if (name == "content-length") {
+                length = strtoul(value.c_str(), NULL, 10);
+            } else if (name == "connection") {
+                keepAlive = value == "keep-alive" || (keepAlive && value != "close");
+            }
+        }
+
+        size_t total = headerEnd + 4 + length;
+        if (length > MaxRequest) {
+            return false;
+        }
+
+        if (client.in.size() < total) {
+            return true;
+        }
+
+        size_t query = path.find('?');
+        if (query != std::string::npos) {
+            path.erase(query);
+        }
+
+        if (method == "GET" && (path == "/" || path == "/index.html")) {
+            client.out.push_back(m_page);
+        } else if (method == "GET" && path == "/networks") {
+            client.out.push_back(networks());
+        } else if (method == "POST" && path == "/connect") {
+            std::string form = client.in.substr(headerEnd + 4, length);
+            std::string ssid = formValue(form, "ssid");
+            std::string password = formValue(form, "password");
+            CredentialsHandler handler;
+            {
+                std::lock_guard<std::mutex> lock(m_mx);
+                handler = m_credentials;
+            }
+
+            if (ssid.empty() || !handler) {
+                client.out.push_back(respond(400, "text/plain", "Missing ssid\n"));
+            } else {
+                // Connecting takes long and may drop the hotspot, answer first
+                m_worker.post("connect", [handler, ssid, password]() { handler(ssid, password); });
+                client.out.push_back(m_accepted);
+            }
+        } else {
+            client.out.push_back(respond(404, "text/plain", "Not found\n"));
+        }
+
+        client.in.erase(0, total);
+        client.close = !keepAlive;
+    }
+    return true;
+}
@@ -0,0 +1,97 @@
+#ifndef IOT_PROVISIONING_H
+#define IOT_PROVISIONING_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "dispatcher.h"
+#include "powerprofile.h"
+#include "wifinetwork.h"
+
+namespace IoT
+{
+    // Small HTTP/1.1 server for AP mode setup pages. One epoll thread serves all clients,
+    // the scan list is kept serialized and rebuilt only when networks change.
+    //   GET  /          - setup page
+    //   GET  /networks  - scan list as JSON
+    //   POST /connect   - form encoded ssid and password, answered before connecting
+    class ProvisioningServer
+    {
+    public:
+        typedef std::function<void(std::vector<WifiNetwork>& networks)> ScanSource;
+        typedef std::function<void(const std::string& ssid, const std::string& password)> CredentialsHandler;
+
+        ProvisioningServer();
+        ~ProvisioningServer();
+
+        // List older than maxAge is refreshed in background, clients get the current one meanwhile
+        void setScanSource(ScanSource source, std::chrono::seconds maxAge = std::chrono::seconds(30));
+        // Called on a worker thread
+        void onCredentials(CredentialsHandler handler);
+        void setNetworks(const std::vector<WifiNetwork>& networks);
+
+        // Port 0 picks a free one
+        bool start(unsigned short port, const std::string& address = "0.0.0.0");
+        void stop();
+        bool isRunning() const;
+        unsigned short port() const;
+        size_t rebuilds() const;
+        // Server thread wakeups during the last minute
+        unsigned wakeupsPerMinute() const;
+    private:
+        typedef std::shared_ptr<const std::string> Response;
+
+        struct Client
+        {
+            std::string in;
+            std::vector<Response> out;
+            size_t offset = 0;
+            bool close = false;
+            std::chrono::steady_clock::time_point active;
+        };
+
+        void run();
+        void accept();
+        void read(int fd, Client& client);
+        bool write(int fd, Client& client);
+        void update(int fd, Client& client);
+        void drop(int fd);
+        // Consumes complete requests from client's input, false on malformed one
+        bool handle(Client& client);
+        Response networks();
+        void refresh();
+
+        static Response respond(int status, const char* type, const std::string& body);
+    private:
+        int m_listen = -1;
+        int m_epoll = -1;
+        int m_wakeup = -1;
+        std::atomic<bool> m_running;
+        unsigned short m_port = 0;
+        std::thread m_thread;
+        std::unordered_map<int, Client> m_clients;
+
+        mutable std::mutex m_mx;
+        std::vector<WifiNetwork> m_networks;
+        Response m_networksResponse;
+        std::chrono::steady_clock::time_point m_scanned;
+        ScanSource m_source;
+        std::chrono::seconds m_maxAge;
+        bool m_refreshing = false;
+        CredentialsHandler m_credentials;
+        size_t m_rebuilds = 0;
+        WakeupCounter m_wakeups;
+
+        Response m_page;
+        Response m_accepted;
+        Dispatcher m_worker;
+    };
+}
+
+#endif // IOT_PROVISIONING_H
@@ -0,0 +1,155 @@
+#include "reconnect.h"
+#include "log.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace IoT;
+
+namespace
+{
+    std::shared_ptr<Dispatcher> workers(unsigned maxConcurrent)
+    {
+        return std::make_shared<Dispatcher>(16, std::max<size_t>(maxConcurrent, 1));
+    }
+}
+
+ReconnectScheduler::ReconnectScheduler()
+    : m_random(std::random_device()())
+    , m_workers(workers(m_policy.maxConcurrent))
+    , m_wheel(std::chrono::milliseconds(250))
+{
+}
+
+void ReconnectScheduler::setPolicy(const ReconnectPolicy& policy)
+{
+    std::shared_ptr<Dispatcher> previous;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        if (std::max(policy.maxConcurrent, 1u) != std::max(m_policy.maxConcurrent, 1u)) {
+            previous = std::move(m_workers);
+            m_workers = workers(policy.maxConcurrent);
+        }
+        m_policy = policy;
+    }
+    // Old pool is joined here, outside of the lock its attempts take
+}
+
+void ReconnectScheduler::setHandlers(Attempt attempt, GiveUp giveUp)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_attempt = std::move(attempt);
+    m_giveUp = std::move(giveUp);
+}
+
+std::chrono::milliseconds ReconnectScheduler::delay(unsigned attempts)
+{
+    double base = m_policy.initialDelay.count() * std::pow(m_policy.multiplier, attempts);
+    base = std::min(base, (double)m_policy.maxDelay.count());
+    std::uniform_real_distribution<double> jitter(1.0 - m_policy.jitter, 1.0 + m_policy.jitter);
+    return std::chrono::milliseconds((long long)(base * jitter(m_random)));
+}
+
+void ReconnectScheduler::arm(const std::string& uuid, Entry& entry)
+{
+    auto wait = delay(entry.attempts);
+    LOG_DEBUG << "Reconnecting " << uuid << " in " << wait.count() << "ms, attempt " << entry.attempts + 1;
+    entry.timer = m_wheel.schedule(wait, [this, uuid]() { fire(uuid); });
+}
+
+void ReconnectScheduler::schedule(const std::string& uuid)
+{
+    if (uuid.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_entries.count(uuid) != 0) {
+        return;
+    }
+    arm(uuid, m_entries[uuid]);
+}
+
+void ReconnectScheduler::cancel(const std::string& uuid)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    auto pos = m_entries.find(uuid);
+    if (pos == m_entries.end()) {
+        return;
+    }
+    m_wheel.cancel(pos->second.timer);
+    m_entries.erase(pos);
+}
+
+void ReconnectScheduler::cancelAll()
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    for (auto& entry : m_entries) {
+        m_wheel.cancel(entry.second.timer);
+    }
+    m_entries.clear();
+}
+
+bool ReconnectScheduler::scheduled(const std::string& uuid) const
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    return m_entries.count(uuid) != 0;
+}
+
+unsigned ReconnectScheduler::wakeupsPerMinute() const
+{
+    return m_wheel.wakeupsPerMinute();
+}
+
+void ReconnectScheduler::fire(const std::string& uuid)
+{
+    // Timer thread only hands the attempt over, it never blocks
+    std::shared_ptr<Dispatcher> workers;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        workers = m_workers;
+    }
+    workers->post(uuid, [this, uuid]() { attempt(uuid); });
+}
+
+void ReconnectScheduler::attempt(const std::string& uuid)
+{
+    Attempt attempt;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        if (m_entries.count(uuid) == 0) {
+            return;
+        }
+        attempt = m_attempt;
+    }
+
+    bool connected = attempt && attempt(uuid);
+
+    GiveUp giveUp;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        auto pos = m_entries.find(uuid);
+        if (pos == m_entries.end()) {
+            return;
+        }
+
+        if (connected) {
+            LOG_INFO << "Reconnected " << uuid;
+            m_entries.erase(pos);
+            return;
+        }
+
+        pos->second.attempts++;
+        if (m_policy.maxAttempts == 0 || pos->second.attempts < m_policy.maxAttempts) {
+            arm(uuid, pos->second);
+            return;
+        }
+
+        LOG_WARN << "Giving up reconnecting " << uuid << " after " << pos->second.attempts << " attempts";
+        m_entries.erase(pos);
+        giveUp = m_giveUp;
+    }
+
+    if (giveUp) {
+        giveUp(uuid);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef IOT_RECONNECT_H
+#define IOT_RECONNECT_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include "dispatcher.h"
+#include "timerwheel.h"
+#include "wifinetwork.h"
+
+namespace IoT
+{
+    // Retries connections with exponential backoff. Timers are kept in a single wheel, attempts
+    // run on a separate pool sized by the policy, so a slow attempt doesn't delay other timers.
+    class ReconnectScheduler
+    {
+    public:
+        // Returns true when connection is up again
+        typedef std::function<bool(const std::string& uuid)> Attempt;
+        typedef std::function<void(const std::string& uuid)> GiveUp;
+
+        ReconnectScheduler();
+
+        void setPolicy(const ReconnectPolicy& policy);
+        void setHandlers(Attempt attempt, GiveUp giveUp);
+
+        // No-op if the connection is already being retried
+        void schedule(const std::string& uuid);
+        void cancel(const std::string& uuid);
+        void cancelAll();
+        bool scheduled(const std::string& uuid) const;
+        // Timer thread wakeups during the last minute
+        unsigned wakeupsPerMinute() const;
+    private:
+        struct Entry
+        {
+            unsigned attempts = 0;
+            TimerWheel::TimerId timer = 0;
+        };
+
+        std::chrono::milliseconds delay(unsigned attempts);
+        void arm(const std::string& uuid, Entry& entry);
+        void fire(const std::string& uuid);
+        void attempt(const std::string& uuid);
+    private:
+        mutable std::mutex m_mx;
+        ReconnectPolicy m_policy;
+        Attempt m_attempt;
+        GiveUp m_giveUp;
+        std::unordered_map<std::string, Entry> m_entries;
+        std::mt19937 m_random;
+        // Replaced when the policy changes concurrency, attempts in flight keep the old one alive
+        std::shared_ptr<Dispatcher> m_workers;
+        TimerWheel m_wheel;
+    };
+}
+
+#endif // IOT_RECONNECT_H
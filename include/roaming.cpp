@@ -0,0 +1,105 @@
+#include "roaming.h"
+#include "log.h"
+#include <string.h>
+
+using namespace IoT;
+
+static bool sameSSID(GBytes* l, GBytes* r)
+{
+    if (l == NULL || r == NULL) {
+        return false;
+    }
+
+    gsize lSize = 0, rSize = 0;
+    const void* lData = g_bytes_get_data(l, &lSize);
+    const void* rData = g_bytes_get_data(r, &rSize);
+    return lSize == rSize && memcmp(lData, rData, lSize) == 0;
+}
+
+void Roaming::setPolicy(const RoamingPolicy& policy)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_policy = policy;
+    m_candidates.clear();
+}
+
+RoamingPolicy Roaming::policy() const
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    return m_policy;
+}
+
+NMAccessPoint* Roaming::evaluate(NMDeviceWifi* device)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (!m_policy.enabled) {
+        return NULL;
+    }
+
+    // Reused, evaluation runs on every tracker pass
+    std::string& iface = m_iface;
+    iface = nm_device_get_iface(NM_DEVICE(device));
+    NMAccessPoint* current = nm_device_wifi_get_active_access_point(device);
+    if (current == NULL) {
+        m_candidates.erase(iface);
+        return NULL;
+    }
+
+    auto now = Clock::instance().now();
+    auto roamed = m_lastRoam.find(iface);
+    if (roamed != m_lastRoam.end() && now - roamed->second < m_policy.holdOff) {
+        return NULL;
+    }
+
+    GBytes* ssid = nm_access_point_get_ssid(current);
+    const char* currentBSSID = nm_access_point_get_bssid(current);
+    int currentSignal = nm_access_point_get_strength(current);
+
+    NMAccessPoint* best = NULL;
+    int bestSignal = currentSignal;
+
+    // Access points list is NM's cached scan data, no scan is requested here
+    const GPtrArray* aps = nm_device_wifi_get_access_points(device);
+    for (int i = 0; i < aps->len; i++) {
+        NMAccessPoint* ap = NM_ACCESS_POINT(g_ptr_array_index(aps, i));
+        if (ap == NULL || ap == current) {
+            continue;
+        }
+
+        const char* bssid = nm_access_point_get_bssid(ap);
+        if (bssid == NULL || (currentBSSID != NULL && strcmp(bssid, currentBSSID) == 0)) {
+            continue;
+        }
+
+        if (!sameSSID(ssid, nm_access_point_get_ssid(ap))) {
+            continue;
+        }
+
+        int signal = nm_access_point_get_strength(ap);
+        if (signal > bestSignal) {
+            best = ap;
+            bestSignal = signal;
+        }
+    }
+
+    if (best == NULL || bestSignal - currentSignal < m_policy.threshold) {
+        m_candidates.erase(iface);
+        return NULL;
+    }
+
+    std::string bssid = nm_access_point_get_bssid(best);
+    auto candidate = m_candidates.find(iface);
+    if (candidate == m_candidates.end() || candidate->second.bssid != bssid) {
+        LOG_DEBUG << "Roaming candidate for " << iface << ": " << bssid << " (" << bestSignal << " vs " << currentSignal << ")";
+        m_candidates[iface] = Candidate { bssid, now };
+        return NULL;
+    }
+
+    if (now - candidate->second.since < m_policy.dwell) {
+        return NULL;
+    }
+
+    m_candidates.erase(candidate);
+    m_lastRoam[iface] = now;
+    return best;
+}
@@ -0,0 +1,37 @@
+#ifndef IOT_ROAMING_H
+#define IOT_ROAMING_H
+
+#include <NetworkManager.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "wifinetwork.h"
+#include "clock.h"
+
+namespace IoT
+{
+    class Roaming
+    {
+    public:
+        void setPolicy(const RoamingPolicy& policy);
+        RoamingPolicy policy() const;
+
+        // Returns access point of the same SSID which is worth to roam to, or NULL
+        NMAccessPoint* evaluate(NMDeviceWifi* device);
+    private:
+        struct Candidate
+        {
+            std::string bssid;
+            Clock::TimePoint since;
+        };
+
+        mutable std::mutex m_mx;
+        RoamingPolicy m_policy;
+        std::string m_iface;
+        std::unordered_map<std::string, Candidate> m_candidates;
+        std::unordered_map<std::string, Clock::TimePoint> m_lastRoam;
+    };
+}
+
+#endif // IOT_ROAMING_H
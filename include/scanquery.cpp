@@ -0,0 +1,64 @@
+#include "scanquery.h"
+#include <algorithm>
+
+using namespace IoT;
+
+static bool isHidden(const std::string& ssid)
+{
+    return ssid.find_first_not_of('\0') == std::string::npos;
+}
+
+static bool stronger(const WifiNetwork& l, const WifiNetwork& r)
+{
+    return l.signal > r.signal;
+}
+
+ScanAggregator::ScanAggregator(const ScanQuery& query, std::vector<WifiNetwork>& networks)
+    : m_query(query)
+    , m_networks(networks)
+{
+}
+
+void ScanAggregator::add(const WifiNetwork& network)
+{
+    if (m_query.skipHidden && isHidden(network.ssid)) {
+        return;
+    }
+
+    if (m_query.secureOnly && (network.auth == Authentication::None || network.auth == Authentication::WEP)) {
+        return;
+    }
+
+    if (m_query.groupBySSID) {
+        auto pos = m_bySSID.find(network.ssid);
+        if (pos != m_bySSID.end()) {
+            WifiNetwork& best = m_networks[pos->second];
+            unsigned count = best.count + 1;
+            if (network.signal > best.signal) {
+                best = network;
+            }
+            best.count = count;
+            return;
+        }
+        m_bySSID.emplace(network.ssid, m_count);
+    }
+
+    if (m_count < m_networks.size()) {
+        m_networks[m_count] = network;
+    } else {
+        m_networks.push_back(network);
+    }
+    m_networks[m_count].count = 1;
+    m_count++;
+}
+
+void ScanAggregator::finish()
+{
+    m_networks.resize(m_count);
+    if (m_query.limit != 0 && m_query.limit < m_count) {
+        std::partial_sort(m_networks.begin(), m_networks.begin() + m_query.limit, m_networks.end(), stronger);
+        m_networks.resize(m_query.limit);
+    } else {
+        std::sort(m_networks.begin(), m_networks.end(), stronger);
+    }
+}
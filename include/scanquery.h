@@ -0,0 +1,28 @@
+#ifndef IOT_SCAN_QUERY_H
+#define IOT_SCAN_QUERY_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "wifinetwork.h"
+
+namespace IoT
+{
+    // Applies a ScanQuery to networks as they are visited, reusing elements of the output
+    class ScanAggregator
+    {
+    public:
+        ScanAggregator(const ScanQuery& query, std::vector<WifiNetwork>& networks);
+
+        void add(const WifiNetwork& network);
+        // Orders by signal, with a limit only the kept part is sorted
+        void finish();
+    private:
+        const ScanQuery& m_query;
+        std::vector<WifiNetwork>& m_networks;
+        size_t m_count = 0;
+        std::unordered_map<std::string, size_t> m_bySSID;
+    };
+}
+
+#endif // IOT_SCAN_QUERY_H
@@ -0,0 +1,85 @@
+#ifndef IOT_SEQLOCK_H
+#define IOT_SEQLOCK_H
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+namespace IoT
+{
+    // Readers never block and never take a lock, they retry while a write is in progress.
+    // Writers are serialized with each other only.
+    template<typename T>
+    class SeqLock
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "SeqLock requires trivially copyable type");
+        static const size_t Words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    public:
+        SeqLock()
+        {
+            store(T());
+        }
+
+        T load() const
+        {
+            uint64_t buf[Words];
+            unsigned before, after;
+            do {
+                before = m_seq.load(std::memory_order_acquire);
+                for (size_t i = 0; i < Words; ++i) {
+                    buf[i] = m_data[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                after = m_seq.load(std::memory_order_relaxed);
+            } while (before != after || (before & 1));
+
+            T value;
+            memcpy(&value, buf, sizeof(T));
+            return value;
+        }
+
+        void store(const T& value)
+        {
+            std::lock_guard<std::mutex> lock(m_writer);
+            publish(value);
+        }
+
+        // Read-modify-write, f receives the current value
+        template<typename F>
+        T update(F f)
+        {
+            std::lock_guard<std::mutex> lock(m_writer);
+            uint64_t buf[Words];
+            for (size_t i = 0; i < Words; ++i) {
+                buf[i] = m_data[i].load(std::memory_order_relaxed);
+            }
+            T value;
+            memcpy(&value, buf, sizeof(T));
+            f(value);
+            publish(value);
+            return value;
+        }
+    private:
+        void publish(const T& value)
+        {
+            uint64_t buf[Words] = {};
+            memcpy(buf, &value, sizeof(T));
+
+            unsigned seq = m_seq.load(std::memory_order_relaxed);
+            m_seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < Words; ++i) {
+                m_data[i].store(buf[i], std::memory_order_relaxed);
+            }
+            m_seq.store(seq + 2, std::memory_order_release);
+        }
+    private:
+        std::atomic<unsigned> m_seq { 0 };
+        std::atomic<uint64_t> m_data[Words];
+        std::mutex m_writer;
+    };
+}
+
+#endif // IOT_SEQLOCK_H
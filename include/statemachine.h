@@ -0,0 +1,121 @@
+#ifndef IOT_STATE_MACHINE_H
+#define IOT_STATE_MACHINE_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+
+namespace IoT
+{
+    // Table driven state machine. Events are queued and processed one by one in posting order,
+    // events posted from a listener are handled after it returns.
+    template<typename State, typename Event, size_t States, size_t Events>
+    class StateMachine
+    {
+    public:
+        static const int Invalid = -1;
+        typedef int Table[States][Events]; // Target state or Invalid
+
+        typedef std::function<bool(State from, Event event)> Guard;
+        typedef std::function<void(State from, Event event, State to)> Listener;
+
+        struct Statistics
+        {
+            uint64_t events;
+            uint64_t transitions;
+            uint64_t rejected[States][Events];
+            std::chrono::nanoseconds time; // Spent in lookups and guards
+        };
+
+        StateMachine(const Table& table, State initial)
+            : m_table(table)
+            , m_state(initial)
+        {
+            memset(&m_statistics, 0, sizeof(m_statistics));
+        }
+
+        void setGuard(Guard guard)
+        {
+            std::lock_guard<std::mutex> lock(m_mx);
+            m_guard = std::move(guard);
+        }
+
+        void setListener(Listener listener)
+        {
+            std::lock_guard<std::mutex> lock(m_mx);
+            m_listener = std::move(listener);
+        }
+
+        State state() const
+        {
+            return (State)m_state.load();
+        }
+
+        Statistics statistics() const
+        {
+            std::lock_guard<std::mutex> lock(m_mx);
+            return m_statistics;
+        }
+
+        void post(Event event)
+        {
+            std::unique_lock<std::mutex> lock(m_mx);
+            m_queue.push_back(event);
+            if (m_processing) {
+                return;
+            }
+
+            m_processing = true;
+            while (!m_queue.empty()) {
+                Event next = m_queue.front();
+                m_queue.pop_front();
+
+                auto started = std::chrono::steady_clock::now();
+                State from = (State)m_state.load();
+                int to = m_table[from][next];
+                bool accepted = to != Invalid;
+                if (accepted && m_guard) {
+                    // Nobody else can process events meanwhile, state is stable
+                    Guard guard = m_guard;
+                    lock.unlock();
+                    accepted = guard(from, next);
+                    lock.lock();
+                }
+
+                m_statistics.events++;
+                if (!accepted) {
+                    m_statistics.rejected[from][next]++;
+                    m_statistics.time += std::chrono::steady_clock::now() - started;
+                    continue;
+                }
+
+                m_state = to;
+                m_statistics.transitions++;
+                m_statistics.time += std::chrono::steady_clock::now() - started;
+
+                if (to != from && m_listener) {
+                    Listener listener = m_listener;
+                    lock.unlock();
+                    listener(from, next, (State)to);
+                    lock.lock();
+                }
+            }
+            m_processing = false;
+        }
+    private:
+        const Table& m_table;
+        std::atomic<int> m_state;
+        mutable std::mutex m_mx;
+        std::deque<Event> m_queue;
+        bool m_processing = false;
+        Guard m_guard;
+        Listener m_listener;
+        Statistics m_statistics;
+    };
+}
+
+#endif // IOT_STATE_MACHINE_H
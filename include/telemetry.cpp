@@ -0,0 +1,111 @@
+#include "telemetry.h"
+#include "clock.h"
+#include <algorithm>
+
+using namespace IoT;
+
+LinkTelemetry::LinkTelemetry()
+    : m_capacity(720)
+    , m_period(std::chrono::seconds(5))
+{
+    m_scratch.reserve(m_capacity);
+}
+
+void LinkTelemetry::configure(size_t capacity, std::chrono::milliseconds period)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    m_capacity = std::max<size_t>(capacity, 1);
+    m_period = period;
+    m_rings.clear();
+    m_scratch.clear();
+    m_scratch.reserve(m_capacity);
+}
+
+std::chrono::milliseconds LinkTelemetry::period() const
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    return m_period;
+}
+
+void LinkTelemetry::record(const std::string& iface, const LinkSample& sample)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    Ring& ring = m_rings[iface];
+    if (ring.samples.empty()) {
+        ring.samples.resize(m_capacity);
+    }
+
+    ring.samples[ring.head] = sample;
+    ring.head = (ring.head + 1) % ring.samples.size();
+    ring.size = std::min(ring.size + 1, ring.samples.size());
+}
+
+template<typename F>
+MetricSummary LinkTelemetry::summarize(const Ring& ring, size_t count, F value) const
+{
+    MetricSummary summary;
+    m_scratch.clear();
+    double sum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t index = (ring.head + ring.samples.size() - 1 - i) % ring.samples.size();
+        double v = value(ring.samples[index]);
+        m_scratch.push_back(v);
+        sum += v;
+    }
+
+    if (m_scratch.empty()) {
+        return summary;
+    }
+
+    auto minmax = std::minmax_element(m_scratch.begin(), m_scratch.end());
+    summary.min = *minmax.first;
+    summary.max = *minmax.second;
+    summary.mean = sum / m_scratch.size();
+
+    auto p50 = m_scratch.begin() + (m_scratch.size() - 1) * 50 / 100;
+    std::nth_element(m_scratch.begin(), p50, m_scratch.end());
+    summary.p50 = *p50;
+
+    // Everything above p50 is already on the right side
+    auto p95 = m_scratch.begin() + (m_scratch.size() - 1) * 95 / 100;
+    std::nth_element(p50, p95, m_scratch.end());
+    summary.p95 = *p95;
+    return summary;
+}
+
+LinkStatistics LinkTelemetry::query(const std::string& iface, std::chrono::seconds window) const
+{
+    LinkStatistics stats;
+    std::lock_guard<std::mutex> lock(m_mx);
+    auto pos = m_rings.find(iface);
+    if (pos == m_rings.end()) {
+        return stats;
+    }
+
+    const Ring& ring = pos->second;
+    auto since = Clock::instance().now() - window;
+    size_t count = 0;
+    size_t connected = 0;
+    // Newest first, samples are ordered by time
+    while (count < ring.size) {
+        const LinkSample& sample = ring.samples[(ring.head + ring.samples.size() - 1 - count) % ring.samples.size()];
+        if (sample.time < since) {
+            break;
+        }
+        if (sample.status == ConnectionStatus::Connected) {
+            connected++;
+        }
+        count++;
+    }
+
+    if (count == 0) {
+        return stats;
+    }
+
+    stats.samples = count;
+    stats.connectedRatio = (double)connected / count;
+    stats.signal = summarize(ring, count, [](const LinkSample& s) { return (double)s.signal; });
+    stats.bitrate = summarize(ring, count, [](const LinkSample& s) { return (double)s.bitrate; });
+    stats.frequency = summarize(ring, count, [](const LinkSample& s) { return (double)s.frequency; });
+    return stats;
+}
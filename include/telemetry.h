@@ -0,0 +1,53 @@
+#ifndef IOT_TELEMETRY_H
+#define IOT_TELEMETRY_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "networksignals.h"
+
+namespace IoT
+{
+    struct LinkSample
+    {
+        std::chrono::steady_clock::time_point time;
+        int signal;
+        unsigned bitrate;
+        unsigned frequency;
+        ConnectionStatus status;
+    };
+
+    // Fixed size ring buffer per interface, nothing is allocated once interface is known
+    class LinkTelemetry
+    {
+    public:
+        LinkTelemetry();
+
+        // Zero period disables sampling. Drops collected samples
+        void configure(size_t capacity, std::chrono::milliseconds period);
+        std::chrono::milliseconds period() const;
+
+        void record(const std::string& iface, const LinkSample& sample);
+        LinkStatistics query(const std::string& iface, std::chrono::seconds window) const;
+    private:
+        struct Ring
+        {
+            std::vector<LinkSample> samples;
+            size_t head = 0;
+            size_t size = 0;
+        };
+
+        template<typename F>
+        MetricSummary summarize(const Ring& ring, size_t count, F value) const;
+    private:
+        mutable std::mutex m_mx;
+        std::unordered_map<std::string, Ring> m_rings;
+        size_t m_capacity;
+        std::chrono::milliseconds m_period;
+        mutable std::vector<double> m_scratch;
+    };
+}
+
+#endif // IOT_TELEMETRY_H
@@ -0,0 +1,175 @@
+#include "timerwheel.h"
+#include <algorithm>
+
+using namespace IoT;
+
+TimerWheel::TimerWheel(std::chrono::milliseconds resolution)
+    : m_resolution(resolution.count() > 0 ? resolution : std::chrono::milliseconds(1))
+    , m_clock(Clock::instance())
+    , m_start(m_clock.now())
+{
+    m_thread = std::thread(&TimerWheel::run, this);
+}
+
+TimerWheel::~TimerWheel()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+uint64_t TimerWheel::currentTick() const
+{
+    return (m_clock.now() - m_start) / m_resolution;
+}
+
+TimerWheel::TimerId TimerWheel::schedule(std::chrono::milliseconds delay, Callback callback)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    if (m_timers.empty()) {
+        // Wheel was idle and didn't move, nothing can be skipped by catching up
+        m_now = currentTick();
+    }
+
+    // Wheel's position lags while its thread sleeps, expiry is counted from the clock
+    uint64_t ticks = (delay + m_resolution - std::chrono::milliseconds(1)) / m_resolution;
+    uint64_t expires = std::max(currentTick(), m_now) + std::max<uint64_t>(ticks, 1);
+    Slot pending;
+    pending.push_back(Timer { m_nextId++, expires, std::move(callback) });
+    TimerId id = pending.front().id;
+    insert(pending, pending.begin());
+    m_cv.notify_all();
+    return id;
+}
+
+bool TimerWheel::cancel(TimerId id)
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    auto pos = m_timers.find(id);
+    if (pos == m_timers.end()) {
+        return false;
+    }
+
+    pos->second.slot->erase(pos->second.timer);
+    m_timers.erase(pos);
+    return true;
+}
+
+size_t TimerWheel::pending() const
+{
+    std::lock_guard<std::mutex> lock(m_mx);
+    return m_timers.size();
+}
+
+unsigned TimerWheel::wakeupsPerMinute() const
+{
+    return m_wakeups.perMinute();
+}
+
+void TimerWheel::insert(Slot& from, Slot::iterator timer)
+{
+    uint64_t delta = timer->expires > m_now ? timer->expires - m_now : 0;
+    unsigned level = 0;
+    while (level < Levels - 1 && delta >= (uint64_t(1) << (SlotBits * (level + 1)))) {
+        level++;
+    }
+
+    uint64_t expires = timer->expires;
+    if (level == Levels - 1 && delta >= (uint64_t(1) << (SlotBits * Levels))) {
+        // Too far in the future, will be cascaded again
+        expires = m_now + (uint64_t(1) << (SlotBits * Levels)) - 1;
+    }
+
+    Slot& slot = m_wheel[level][(expires >> (SlotBits * level)) & (Slots - 1)];
+    slot.splice(slot.end(), from, timer);
+    m_timers[timer->id] = Location { &slot, timer };
+}
+
+void TimerWheel::cascade(unsigned level)
+{
+    Slot& slot = m_wheel[level][(m_now >> (SlotBits * level)) & (Slots - 1)];
+    while (!slot.empty()) {
+        insert(slot, slot.begin());
+    }
+}
+
+uint64_t TimerWheel::nextTick() const
+{
+    uint64_t next = UINT64_MAX;
+    for (unsigned level = 0; level < Levels; ++level) {
+        // Slot of a level is served when the wheel's position at that level reaches it
+        uint64_t position = m_now >> (SlotBits * level);
+        for (unsigned i = 1; i <= Slots; ++i) {
+            if (!m_wheel[level][(position + i) & (Slots - 1)].empty()) {
+                next = std::min(next, (position + i) << (SlotBits * level));
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+void TimerWheel::advance(std::vector<Callback>& expired)
+{
+    m_now++;
+    for (unsigned level = 1; level < Levels; ++level) {
+        if ((m_now & ((uint64_t(1) << (SlotBits * level)) - 1)) != 0) {
+            break;
+        }
+        cascade(level);
+    }
+
+    Slot& slot = m_wheel[0][m_now & (Slots - 1)];
+    for (auto it = slot.begin(); it != slot.end();) {
+        if (it->expires <= m_now) {
+            expired.push_back(std::move(it->callback));
+            m_timers.erase(it->id);
+            it = slot.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void TimerWheel::run()
+{
+    std::vector<Callback> expired;
+    std::unique_lock<std::mutex> lock(m_mx);
+    while (!m_stop) {
+        if (m_timers.empty()) {
+            m_cv.wait(lock);
+            m_wakeups.hit();
+            continue;
+        }
+
+        // Ticks without anything to expire or cascade are skipped, not stepped through
+        uint64_t now = currentTick();
+        while (m_now < now && !m_timers.empty()) {
+            uint64_t next = nextTick();
+            if (next > now) {
+                m_now = now;
+                break;
+            }
+            m_now = next - 1;
+            advance(expired);
+        }
+
+        if (!expired.empty()) {
+            lock.unlock();
+            for (Callback& callback : expired) {
+                callback();
+            }
+            expired.clear();
+            lock.lock();
+            continue;
+        }
+
+        if (!m_timers.empty()) {
+            m_clock.waitUntil(m_cv, lock, m_start + nextTick() * m_resolution);
+            m_wakeups.hit();
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef IOT_TIMER_WHEEL_H
+#define IOT_TIMER_WHEEL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "clock.h"
+#include "powerprofile.h"
+
+namespace IoT
+{
+    // Hierarchical timer wheel, all timers are served by a single thread.
+    // Schedule and cancel are O(1), the thread sleeps until the earliest slot with timers.
+    class TimerWheel
+    {
+    public:
+        typedef uint64_t TimerId;
+        typedef std::function<void()> Callback;
+
+        explicit TimerWheel(std::chrono::milliseconds resolution = std::chrono::milliseconds(100));
+        ~TimerWheel();
+
+        TimerId schedule(std::chrono::milliseconds delay, Callback callback);
+        bool cancel(TimerId id);
+        size_t pending() const;
+        unsigned wakeupsPerMinute() const;
+    private:
+        static const unsigned Levels = 4;
+        static const unsigned SlotBits = 6;
+        static const unsigned Slots = 1 << SlotBits;
+
+        struct Timer
+        {
+            TimerId id;
+            uint64_t expires;
+            Callback callback;
+        };
+
+        typedef std::list<Timer> Slot;
+
+        struct Location
+        {
+            Slot* slot;
+            Slot::iterator timer;
+        };
+
+        uint64_t currentTick() const;
+        // Tick at which the nearest non-empty slot expires or cascades
+        uint64_t nextTick() const;
+        void insert(Slot& from, Slot::iterator timer);
+        void cascade(unsigned level);
+        void advance(std::vector<Callback>& expired);
+        void run();
+    private:
+        mutable std::mutex m_mx;
+        std::condition_variable m_cv;
+        std::chrono::milliseconds m_resolution;
+        Clock& m_clock;
+        Clock::TimePoint m_start;
+        uint64_t m_now = 0;
+        TimerId m_nextId = 1;
+        Slot m_wheel[Levels][Slots];
+        std::unordered_map<TimerId, Location> m_timers;
+        WakeupCounter m_wakeups;
+        bool m_stop = false;
+        std::thread m_thread;
+    };
+}
+
+#endif // IOT_TIMER_WHEEL_H
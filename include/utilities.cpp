@@ -1,60 +1,79 @@
 #include "utilities.h"
 #include "log.h"
+#include <string.h>
 using namespace IoT;
 
 
 Connection Utility::connectionFromNM(NMConnection* c, bool& ok)
 {
     Connection conn;
+    ok = connectionFromNM(c, conn);
+    return conn;
+}
+
+bool Utility::connectionFromNM(NMConnection* c, Connection& conn)
+{
     if (c == NULL) {
         LOG_ERROR << "Connection object is NULL";
-        ok = false;
-        return conn;
+        return false;
     }
 
     NMSettingWireless *s = nm_connection_get_setting_wireless(c);
     if (s == NULL) {
-        ok = false;
-        return conn;
+        return false;
     }
 
-    conn.uuid = nm_connection_get_uuid(c);
+    conn.uuid.assign(nm_connection_get_uuid(c));
 
     GBytes *ssid = nm_setting_wireless_get_ssid(s);
     if (ssid != NULL) {
-        conn.name = std::string((const char *)g_bytes_get_data(ssid, NULL), g_bytes_get_size(ssid));
+        conn.name.assign((const char *)g_bytes_get_data(ssid, NULL), g_bytes_get_size(ssid));
     } else {
         LOG_ERROR << "SSID it not available";
-        ok = false;
-        
-        return conn;
+        return false;
     }
-    std::string mode = nm_setting_wireless_get_mode(s);
-    if (mode == NM_SETTING_WIRELESS_MODE_AP) {
+
+    const char* mode = nm_setting_wireless_get_mode(s);
+    if (mode == NULL) {
+        mode = "";
+    }
+    if (strcmp(mode, NM_SETTING_WIRELESS_MODE_AP) == 0) {
         conn.mode = Mode::AccessPoint;
-    } else if (mode == NM_SETTING_WIRELESS_MODE_INFRA) {
+    } else if (strcmp(mode, NM_SETTING_WIRELESS_MODE_INFRA) == 0) {
         conn.mode = Mode::Infrastructure;
-    } else if (mode == NM_SETTING_WIRELESS_MODE_ADHOC) {
+    } else if (strcmp(mode, NM_SETTING_WIRELESS_MODE_ADHOC) == 0) {
         conn.mode = Mode::AdHoc;
     } else {
         LOG_ERROR << "Unknown mode: " << mode;
-        ok = false;
-        return conn;
+        return false;
     }
 
-    return conn;
+    return true;
 }
 
 WifiNetwork Utility::getWifiNetworkInfo(NMAccessPoint* ap, bool& ok)
 {
-    ok = false;
     WifiNetwork wifi;
+    ok = getWifiNetworkInfo(ap, wifi);
+    return wifi;
+}
+
+bool Utility::getWifiNetworkInfo(NMAccessPoint* ap, WifiNetwork& wifi)
+{
     GBytes *ssid = nm_access_point_get_ssid(ap);
     if (ssid == NULL) {
-        return wifi;
+        return false;
     }
-    wifi.ssid = std::string((const char *)g_bytes_get_data(ssid, NULL), g_bytes_get_size(ssid));
+    wifi.ssid.assign((const char *)g_bytes_get_data(ssid, NULL), g_bytes_get_size(ssid));
     wifi.signal = nm_access_point_get_strength(ap);
+    wifi.frequency = nm_access_point_get_frequency(ap);
+    const char* bssid = nm_access_point_get_bssid(ap);
+    if (bssid != NULL) {
+        wifi.bssid.assign(bssid);
+    } else {
+        wifi.bssid.clear();
+    }
+    wifi.password.clear();
 
     auto flags = nm_access_point_get_flags(ap);
     auto wpa_flags = nm_access_point_get_wpa_flags(ap);
@@ -78,8 +97,7 @@ WifiNetwork Utility::getWifiNetworkInfo(NMAccessPoint* ap, bool& ok)
     if ((wpa_flags & NM_802_11_AP_SEC_KEY_MGMT_802_1X) || (rsn_flags & NM_802_11_AP_SEC_KEY_MGMT_802_1X)) {
         wifi.auth = Authentication::Enterprise;
     }
-    ok = true;
-    return wifi;
+    return true;
 }
 
 WifiNetwork Utility::getCurrentNetwork(NMDeviceWifi* device, bool& ok)
@@ -112,4 +130,32 @@ ConnectionStatus Utility::deviceStateToConnectionStatus(NMDeviceState state)
             break;
         }
     }
-}
\ No newline at end of file
+}
+
+Result Utility::stateReasonToResult(NMDeviceStateReason reason)
+{
+    switch(reason) {
+        case NM_DEVICE_STATE_REASON_NO_SECRETS:
+        case NM_DEVICE_STATE_REASON_SUPPLICANT_DISCONNECT:
+        case NM_DEVICE_STATE_REASON_SUPPLICANT_TIMEOUT: {
+            return Result::BadCredentials;
+        }
+        case NM_DEVICE_STATE_REASON_SUPPLICANT_FAILED:
+        case NM_DEVICE_STATE_REASON_SUPPLICANT_CONFIG_FAILED: {
+            return Result::Rejected;
+        }
+        case NM_DEVICE_STATE_REASON_IP_CONFIG_UNAVAILABLE:
+        case NM_DEVICE_STATE_REASON_IP_CONFIG_EXPIRED:
+        case NM_DEVICE_STATE_REASON_DHCP_START_FAILED:
+        case NM_DEVICE_STATE_REASON_DHCP_ERROR:
+        case NM_DEVICE_STATE_REASON_DHCP_FAILED: {
+            return Result::DHCPTimeout;
+        }
+        case NM_DEVICE_STATE_REASON_SSID_NOT_FOUND: {
+            return Result::NetworkNotFound;
+        }
+        default: {
+            return Result::Disconnected;
+        }
+    }
+}
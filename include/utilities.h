@@ -9,12 +9,17 @@ namespace IoT
     struct Utility
     {
         static Connection connectionFromNM(NMConnection* c, bool& ok);
+        // Fills conn in place, strings keep their buffers
+        static bool connectionFromNM(NMConnection* c, Connection& conn);
 
         static WifiNetwork getWifiNetworkInfo(NMAccessPoint* ap, bool& ok);
+        static bool getWifiNetworkInfo(NMAccessPoint* ap, WifiNetwork& wifi);
 
         static WifiNetwork getCurrentNetwork(NMDeviceWifi* device, bool& ok);
 
         static ConnectionStatus deviceStateToConnectionStatus(NMDeviceState state);
+
+        static Result stateReasonToResult(NMDeviceStateReason reason);
     };
 }
 
@@ -1,58 +1,287 @@
 #include "wifi_setup.h"
 #include "log.h"
 #include "networkmanager.h"
+#include "provisioning.h"
 #include <algorithm>
+#include <string.h>
 
 using namespace IoT;
 
+static void copyString(char* dst, size_t size, const std::string& src)
+{
+    size_t len = std::min(size - 1, src.size());
+    memcpy(dst, src.data(), len);
+    dst[len] = 0;
+}
+
+// Setup page never rescans more often than the default, battery profile stretches it
+static std::chrono::seconds setupPageScanAge(const PowerSettings& settings)
+{
+    return std::max(settings.scanMaxAge, std::chrono::seconds(30));
+}
+
+// Setup page lists the strongest unique networks only
+static ScanQuery setupPageQuery()
+{
+    ScanQuery query;
+    query.groupBySSID = true;
+    query.skipHidden = true;
+    query.limit = 10;
+    return query;
+}
+
+static const int X = WiFi::Machine::Invalid;
+
+// Rows are current states, columns events in declaration order:
+// Reset, CheckConnectivity, StartAP, APUp, APFailed, Connect, LinkUp, LinkDown
+const WiFi::Machine::Table WiFi::s_transitions = {
+    /* Uninitialized */        { Uninitialized, CheckingConnectivity, SwitchingToAP, InAPMode, X,             TryingToConnect, Connected, X },
+    /* CheckingConnectivity */ { Uninitialized, CheckingConnectivity, SwitchingToAP, InAPMode, X,             TryingToConnect, Connected, Disconnected },
+    /* Disconnected */         { Uninitialized, CheckingConnectivity, SwitchingToAP, InAPMode, X,             TryingToConnect, Connected, Disconnected },
+    /* SwitchingToAP */        { Uninitialized, X,                    SwitchingToAP, InAPMode, Uninitialized, X,               X,         X },
+    /* InAPMode */             { Uninitialized, CheckingConnectivity, SwitchingToAP, InAPMode, X,             TryingToConnect, Connected, X },
+    /* TryingToConnect */      { Uninitialized, CheckingConnectivity, SwitchingToAP, InAPMode, X,             TryingToConnect, Connected, Disconnected },
+    /* Connected */            { Uninitialized, Connected,            SwitchingToAP, InAPMode, X,             TryingToConnect, Connected, Disconnected },
+};
+
+static const char* const StateNames[] = {
+    "Uninitialized",
+    "CheckingConnectivity",
+    "Disconnected",
+    "SwitchingToAP",
+    "InAPMode",
+    "TryingToConnect",
+    "Connected"
+};
+
+static const char* const EventNames[] = {
+    "Reset",
+    "CheckConnectivity",
+    "StartAP",
+    "APUp",
+    "APFailed",
+    "Connect",
+    "LinkUp",
+    "LinkDown"
+};
+
+WiFi::WiFi()
+{
+    m_machine.setGuard([this](State, Event event) {
+        // AP can't be brought up without its profile
+        return event != Event::StartAP || !apConnection().empty();
+    });
+    m_machine.setListener([this](State from, Event event, State to) {
+        stateChanged(from, event, to);
+    });
+}
+
+WiFi::~WiFi()
+{
+    // Its worker calls back into this object, it must be gone before the members it uses
+    m_provisioning.reset();
+}
+
 void WiFi::init(std::string iface, std::string apSSID, std::string apPassword, bool autoSwitchInAPMode)
 {
-    stateChanged(State::Uninitialized);
-    m_apSSID = apSSID;
-    m_apPassword = apPassword;
+    m_machine.post(Event::Reset);
+    m_apSSID = std::move(apSSID);
+    m_apPassword = std::move(apPassword);
+
+    BootState boot;
+    bool cached = m_cache.load(boot);
+
+    m_iface = std::move(iface);
+    if (m_iface.empty() && cached && boot.iface[0] != 0) {
+        m_iface = boot.iface;
+        LOG_DEBUG << "Using cached wifi device " << m_iface;
+    }
 
-    m_iface = iface;
     if (m_iface.empty()) {
         auto allDevs = NetworkManager::i().devices();
         if (allDevs.empty()) {
             LOG_ERROR << "No WiFi device available in the system";
-            stateChanged(State::Uninitialized);
+            m_machine.post(Event::Reset);
             return;
         }
         m_iface = allDevs[0];
         LOG_DEBUG << "Selected " << m_iface << " as wifi device!";
     }
+    NetworkManager::i().markStartupPhase("device");
+
+    bool resuming = cached && m_iface == boot.iface;
+    if (!resuming && autoSwitchInAPMode && m_apChannel.number == 0) {
+        // Channel scan is the longest step before the hotspot is up, it runs while profiles are looked up
+        std::string device = m_iface;
+        m_worker.post([device]() {
+            NetworkManager::i().prepareHotspot(device);
+        });
+    }
+
+    m_autoSwitch = autoSwitchInAPMode;
+    m_reconnect.setHandlers([this](const std::string& uuid) {
+        Result result = Result::Unknown;
+        if (!NetworkManager::i().activateConnection(uuid, m_iface, &result) || result != Result::Connected) {
+            return false;
+        }
+        // Link is back, next tracker pass confirms the upstream
+        m_machine.post(Event::CheckConnectivity);
+        return true;
+    }, [this](const std::string&) {
+        if (m_autoSwitch) {
+            switchToAPMode();
+        }
+    });
+
     NetworkManager::i().InternetConnectionAvailable.connect([this, autoSwitchInAPMode](const bool& ok) {
         if (state() == State::TryingToConnect || state() == State::Connected || state() == State::CheckingConnectivity) {
-            if (ok && NetworkManager::i().activeConnection(m_iface).uuid != m_apConnectionID) {
-                stateChanged(State::Connected);
+            std::string station = stationConnection();
+            if (ok && NetworkManager::i().activeConnection(m_iface).uuid != apConnection()) {
+                m_machine.post(Event::LinkUp);
+            } else if (state() == State::Connected && !station.empty()) {
+                // Upstream was there, retry before giving the network up
+                m_machine.post(Event::LinkDown);
+                m_reconnect.schedule(station);
             } else if(autoSwitchInAPMode) {
                 switchToAPMode();
             }
         }
     });
 
-    NetworkManager::i().ActiveConnectionChanged.connect([this](std::string iface, ActiveConnection connection){
+    NetworkManager::i().ActiveConnectionChanged.connect([this](const std::string& iface, const ActiveConnection& connection){
         if (iface != m_iface) {
             return;
         }
         if (connection.mode == Mode::AccessPoint) {
-            stateChanged(State::InAPMode);
-        } else if(connection.mode == Mode::Infrastructure && connection.signal > 0) {
-            stateChanged(State::Connected);
+            m_machine.post(Event::APUp);
+        } else if(connection.mode == Mode::Infrastructure && !connection.ip.empty()) {
+            // Active connection shows up as soon as activation starts, the link is up once it has an address
+            m_machine.post(Event::LinkUp);
+            m_reconnect.cancel(connection.uuid);
+            rememberStation(connection.uuid, connection.bssid);
         }
-        m_currentSSID = connection.ssid;
-        m_currentIP = connection.ip;
-        m_signal = connection.signal;
+        m_status.update([&connection](Status& status) {
+            copyString(status.ssid, sizeof(status.ssid), connection.ssid);
+            copyString(status.ip, sizeof(status.ip), connection.ip);
+            status.signal = connection.signal;
+        });
     });
 
     NetworkManager::i().update();
 
-    if (state() != State::Connected)
-        stateChanged(State::CheckingConnectivity);
+    // First tracker pass may have published the link before the handlers were connected
+    ActiveConnection current;
+    NetworkManager::i().activeConnection(m_iface, current);
+    NetworkManager::i().activeNetwork(m_iface, current);
+    if (current.mode == Mode::Infrastructure && !current.ip.empty()) {
+        rememberStation(current.uuid, current.bssid);
+    }
+
+    if (resuming) {
+        // Cached profiles are checked while NM is still starting up, init doesn't wait for it
+        m_worker.post([this, boot, autoSwitchInAPMode]() {
+            if (!resumeFromCache(boot)) {
+                m_machine.post(Event::CheckConnectivity);
+                findAPConnection(autoSwitchInAPMode);
+            }
+        });
+        return;
+    }
+
+    m_machine.post(Event::CheckConnectivity);
     findAPConnection(autoSwitchInAPMode);
 }
 
+bool WiFi::setStateCache(const std::string& path)
+{
+    return m_cache.open(path);
+}
+
+bool WiFi::resumeFromCache(const BootState& boot)
+{
+    // UUID lookups are served from NMClient's cache, no D-Bus round trips
+    bool ok = false;
+    Connection ap = NetworkManager::i().connection(boot.apUUID, ok);
+    if (!ok || ap.mode != Mode::AccessPoint || ap.name != m_apSSID) {
+        LOG_WARN << "Cached AP connection is not valid anymore";
+        return false;
+    }
+    rememberAP(ap.uuid, false);
+    NetworkManager::i().markStartupPhase("ap-profile");
+
+    Connection station = NetworkManager::i().connection(boot.stationUUID, ok);
+    if (!ok || station.mode != Mode::Infrastructure) {
+        LOG_DEBUG << "No cached station connection";
+        return false;
+    }
+
+    rememberStation(station.uuid, boot.bssid);
+    if (NetworkManager::i().activeConnection(m_iface).uuid == station.uuid) {
+        m_machine.post(Event::CheckConnectivity);
+        return true;
+    }
+
+    LOG_DEBUG << "Activating cached connection " << station.name;
+    m_machine.post(Event::Connect);
+    Result result = Result::Unknown;
+    if (!NetworkManager::i().activateConnection(station.uuid, m_iface, &result) || result != Result::Connected) {
+        LOG_WARN << "Can't activate cached connection " << station.uuid;
+        rememberStation(std::string(), std::string());
+        return false;
+    }
+    NetworkManager::i().markStartupPhase("station");
+    return true;
+}
+
+void WiFi::rememberStation(const std::string& uuid, const std::string& bssid)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_cacheMx);
+        if (m_stationConnectionID == uuid && m_stationBSSID == bssid) {
+            return;
+        }
+        m_stationConnectionID = uuid;
+        m_stationBSSID = bssid;
+    }
+    updateCache();
+}
+
+std::string WiFi::stationConnection()
+{
+    std::lock_guard<std::mutex> lock(m_cacheMx);
+    return m_stationConnectionID;
+}
+
+void WiFi::rememberAP(const std::string& uuid, bool planned)
+{
+    std::lock_guard<std::mutex> lock(m_cacheMx);
+    m_cachedIface = m_iface;
+    m_apConnectionID = uuid;
+    m_apPlanned = planned;
+}
+
+std::string WiFi::apConnection()
+{
+    std::lock_guard<std::mutex> lock(m_cacheMx);
+    return m_apConnectionID;
+}
+
+void WiFi::updateCache()
+{
+    if (!m_cache.isOpen()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_cacheMx);
+    BootState boot;
+    memset(&boot, 0, sizeof(boot));
+    copyString(boot.iface, sizeof(boot.iface), m_cachedIface);
+    copyString(boot.apUUID, sizeof(boot.apUUID), m_apConnectionID);
+    copyString(boot.stationUUID, sizeof(boot.stationUUID), m_stationConnectionID);
+    copyString(boot.bssid, sizeof(boot.bssid), m_stationBSSID);
+    m_cache.store(boot);
+}
+
 void WiFi::updateInternetConnectivity(bool connected)
 {
     NetworkManager::i().InternetConnectionAvailable.set(connected);
@@ -60,58 +289,72 @@ void WiFi::updateInternetConnectivity(bool connected)
 
 void WiFi::switchToAPMode()
 {
-    if (m_apConnectionID.empty()) {
+    std::string uuid;
+    bool planned = false;
+    {
+        std::lock_guard<std::mutex> lock(m_cacheMx);
+        uuid = m_apConnectionID;
+        planned = m_apPlanned;
+        m_apPlanned = false;
+    }
+    if (uuid.empty()) {
         LOG_ERROR << "No AP mode specified, can't switch to AP";
-        stateChanged(IoT::WiFi::Uninitialized);
+        m_machine.post(Event::Reset);
         return;
     }
 
-    stateChanged(State::SwitchingToAP);
+    m_reconnect.cancelAll();
+    m_machine.post(Event::StartAP);
+
+    if (m_apChannel.number == 0 && !planned) {
+        // Neighbours change between activations, the profile's channel may be crowded by now
+        NetworkManager::i().planHotspot(uuid, m_iface, m_apChannel.band);
+    }
 
-    if(!NetworkManager::i().activateConnection(m_apConnectionID) || NetworkManager::i().LastConnectResult.value != Result::Connected) {
-        LOG_ERROR << "Can't activate connection " << m_apConnectionID;
-        stateChanged(IoT::WiFi::Uninitialized);
+    Result result = Result::Unknown;
+    if(!NetworkManager::i().activateConnection(uuid, m_iface, &result) || result != Result::Connected) {
+        LOG_ERROR << "Can't activate connection " << uuid;
+        m_machine.post(Event::APFailed);
         return;
     }
-    stateChanged(State::InAPMode);
+    m_machine.post(Event::APUp);
 }
 
 void WiFi::findAPConnection(bool autoSwitchInAPMode)
 {
+    std::string uuid;
+    bool planned = false;
     for(const IoT::Connection& c : NetworkManager::i().connections()) {
         if (c.mode != IoT::Mode::AccessPoint || c.name != m_apSSID) {
             continue;
         }
 
-        m_apConnectionID = c.uuid;
+        uuid = c.uuid;
         break;
     }
 
-    if (m_apConnectionID.empty()) {
+    if (uuid.empty()) {
         LOG_WARN << "There is no AP mode connection, creating one";
         WifiNetwork net;
         net.ssid = m_apSSID;
         net.password = m_apPassword;
         net.auth = IoT::Authentication::WPA2;
-        if(NetworkManager::i().createHotspot(m_iface, net) != Result::Added) {
+        if(NetworkManager::i().createHotspot(m_iface, net, m_apChannel, &uuid) != Result::Added) {
             LOG_ERROR << "Can't create access point connection";
-            stateChanged(State::Uninitialized);
+            rememberAP(std::string(), false);
+            m_machine.post(Event::Reset);
             return;
         }
+        planned = true;
     }
 
-    for(const IoT::Connection& c : NetworkManager::i().connections()) {
-        if (c.mode != IoT::Mode::AccessPoint || c.name != m_apSSID) {
-            continue;
-        }
-
-        m_apConnectionID = c.uuid;
-        break;
-    }
-
-    LOG_DEBUG << "AP mode connection: " << m_apConnectionID;
+    LOG_DEBUG << "AP mode connection: " << uuid;
+    NetworkManager::i().markStartupPhase("ap-profile");
+    rememberAP(uuid, planned);
+    updateCache();
     if (!NetworkManager::i().InternetConnectionAvailable.value && autoSwitchInAPMode) {
         switchToAPMode();
+        NetworkManager::i().markStartupPhase("ap-mode");
     }
 }
 
@@ -119,67 +362,195 @@ void WiFi::onStateChanged(std::function<void(WiFi::State)> cb) {
     m_onStateChanged = std::move(cb);
 }
 
+WiFi::Status WiFi::snapshot() const
+{
+    return m_status.load();
+}
+
 WiFi::State WiFi::state() const
 {
-    return m_state;
+    return m_status.load().state;
 }
 
-void WiFi::stateChanged(State newState)
+WiFi::Machine::Statistics WiFi::transitionStatistics() const
 {
-    m_state = newState;
-    if(newState == State::Uninitialized) LOG_DEBUG << "State == " << "State::Uninitialized";
-    if(newState == State::CheckingConnectivity) LOG_DEBUG << "State == " << "State::CheckingConnectivity";
-    if(newState == State::Disconnected) LOG_DEBUG << "State == " << "State::Disconnected";
-    if(newState == State::SwitchingToAP) LOG_DEBUG << "State == " << "State::SwitchingToAP";
-    if(newState == State::InAPMode) LOG_DEBUG << "State == " << "State::InAPMode";
-    if(newState == State::TryingToConnect) LOG_DEBUG << "State == " << "State::TryingToConnect";
-    if(newState == State::Connected) LOG_DEBUG << "State == " << "State::Connected";
-    m_onStateChanged(m_state);
+    return m_machine.statistics();
+}
+
+void WiFi::stateChanged(State from, Event event, State to)
+{
+    m_status.update([to](Status& status) { status.state = to; });
+    LOG_DEBUG << "State " << StateNames[from] << " -> " << StateNames[to] << " on " << EventNames[event];
+    if (m_onStateChanged) {
+        m_onStateChanged(to);
+    }
 }
 
 std::vector<WifiNetwork> WiFi::availableNetworks(bool scan)
 {
-    std::vector<WifiNetwork> networks = NetworkManager::i().scan(m_iface, scan);
-    std::sort(networks.begin(), networks.end(), [](const WifiNetwork& l, const WifiNetwork& r) { return l.signal > r.signal; });
+    std::vector<WifiNetwork> networks;
+    availableNetworks(networks, scan);
     return networks;
 }
 
-void WiFi::tryConnect(std::string ssid, std::string password)
+void WiFi::availableNetworks(std::vector<WifiNetwork>& networks, bool scan)
+{
+    NetworkManager::i().scanInto(m_iface, networks, scan);
+    std::sort(networks.begin(), networks.end(), [](const WifiNetwork& l, const WifiNetwork& r) { return l.signal > r.signal; });
+}
+
+void WiFi::availableNetworks(std::vector<WifiNetwork>& networks, const ScanQuery& query, bool scan)
+{
+    NetworkManager::i().scanQuery(m_iface, query, networks, scan);
+}
+
+void WiFi::setupPageNetworks(std::vector<WifiNetwork>& networks)
+{
+    // Radio serves the hotspot, a forced scan would fail over to iwlist on the dispatch thread
+    bool scan = state() != State::InAPMode && state() != State::SwitchingToAP;
+    availableNetworks(networks, setupPageQuery(), scan);
+}
+
+std::vector<WifiNetwork> WiFi::scanFor(const std::vector<std::string>& ssids)
+{
+    return NetworkManager::i().scanFor(m_iface, ssids);
+}
+
+void WiFi::forEachNetwork(const std::function<void(const WifiNetwork&)>& visitor, bool scan)
+{
+    NetworkManager::i().scanEach(m_iface, visitor, NetworkManager::ScanFilter(), scan);
+}
+
+void WiFi::tryConnect(const std::string& ssid, const std::string& password)
 {
     auto lastConnection = NetworkManager::i().activeConnection(m_iface).uuid;
-    stateChanged(State::TryingToConnect);
+    m_reconnect.cancelAll();
+    m_machine.post(Event::Connect);
     WifiNetwork net;
     net.ssid = ssid;
     net.password = password;
     net.auth = Authentication::WPA2;
-    if(Result::Connected != NetworkManager::i().connectoToNetwork(m_iface, net))
+    Result result = NetworkManager::i().connectoToNetwork(m_iface, net);
+    if(Result::Connected != result)
     {
-        stateChanged(State::Disconnected);
-        NetworkManager::i().activateConnection(lastConnection);
+        LOG_ERROR << "Can't connect to " << ssid << ", result: " << (int)result;
+        m_machine.post(Event::LinkDown);
+        if (lastConnection.empty() ? m_autoSwitch : lastConnection == apConnection()) {
+            switchToAPMode();
+        } else {
+            m_reconnect.schedule(lastConnection);
+        }
     }
     else
     {
-        stateChanged(State::Connected);
+        m_machine.post(Event::LinkUp);
     }
 }
 
-bool WiFi::connectToNetwork(std::string uuid)
+bool WiFi::connectToNetwork(const std::string& uuid)
 {
     return NetworkManager::i().activateConnection(uuid);
 }
 
+void WiFi::setRoamingPolicy(const RoamingPolicy& policy)
+{
+    NetworkManager::i().setRoamingPolicy(policy);
+}
+
+void WiFi::setHotspotChannel(Channel channel)
+{
+    m_apChannel = channel;
+}
+
+void WiFi::setConnectivityCheck(const ConnectivityConfig& config)
+{
+    NetworkManager::i().setConnectivityCheck(config);
+}
+
+void WiFi::setReconnectPolicy(const ReconnectPolicy& policy)
+{
+    m_reconnect.setPolicy(policy);
+}
+
+void WiFi::setVolatileProfiles(bool enabled)
+{
+    NetworkManager::i().setVolatileProfiles(enabled);
+}
+
+std::vector<StartupPhase> WiFi::startupPhases() const
+{
+    return NetworkManager::i().startupPhases();
+}
+
+std::vector<ConnectPhase> WiFi::connectPhases() const
+{
+    return NetworkManager::i().connectPhases();
+}
+
+LinkStatistics WiFi::linkStatistics(std::chrono::seconds window) const
+{
+    return NetworkManager::i().linkStatistics(m_iface, window);
+}
+
+void WiFi::setPowerProfile(PowerProfile profile)
+{
+    PowerSettings settings = PowerSettings::of(profile);
+    NetworkManager::i().setPowerSettings(settings);
+    m_reconnect.setPolicy(settings.reconnect);
+    if (m_provisioning) {
+        m_provisioning->setScanSource([this](std::vector<WifiNetwork>& networks) {
+            setupPageNetworks(networks);
+        }, setupPageScanAge(settings));
+    }
+}
+
+PowerProfile WiFi::powerProfile() const
+{
+    return NetworkManager::i().powerSettings().profile;
+}
+
+unsigned WiFi::wakeupsPerMinute() const
+{
+    unsigned wakeups = NetworkManager::i().wakeupsPerMinute() + m_reconnect.wakeupsPerMinute();
+    if (m_provisioning) {
+        wakeups += m_provisioning->wakeupsPerMinute();
+    }
+    return wakeups;
+}
+
+bool WiFi::startProvisioning(unsigned short port)
+{
+    if (!m_provisioning) {
+        m_provisioning.reset(new ProvisioningServer());
+        m_provisioning->setScanSource([this](std::vector<WifiNetwork>& networks) {
+            setupPageNetworks(networks);
+        }, setupPageScanAge(NetworkManager::i().powerSettings()));
+        m_provisioning->onCredentials([this](const std::string& ssid, const std::string& password) {
+            tryConnect(ssid, password);
+        });
+    }
+    return m_provisioning->start(port);
+}
+
+void WiFi::stopProvisioning()
+{
+    if (m_provisioning) {
+        m_provisioning->stop();
+    }
+}
+
 std::string WiFi::currentSSID() const
 {
-    return m_currentSSID;
+    return m_status.load().ssid;
 }
 
 int WiFi::wifiSignal() const
 {
-    return m_signal;
+    return m_status.load().signal;
 }
 
 
 std::string WiFi::currentIP() const
 {
-    return m_currentIP;
+    return m_status.load().ip;
 }
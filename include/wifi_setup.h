@@ -5,10 +5,20 @@
 #include <memory>
 #include <vector>
 #include <functional>
+#include <mutex>
 #include "wifinetwork.h"
+#include "networksignals.h"
+#include "seqlock.h"
+#include "bootstate.h"
+#include "dispatcher.h"
+#include "reconnect.h"
+#include "statemachine.h"
+#include "powerprofile.h"
 
 namespace IoT
 {
+    class ProvisioningServer;
+
     class WiFi
     {
     public:
@@ -21,9 +31,37 @@ namespace IoT
             SwitchingToAP,
             InAPMode,
             TryingToConnect,
-            Connected
+            Connected,
+            StatesCount
+        };
+
+        enum Event
+        {
+            Reset,
+            CheckConnectivity,
+            StartAP,
+            APUp,
+            APFailed,
+            Connect,
+            LinkUp,
+            LinkDown,
+            EventsCount
+        };
+
+        typedef StateMachine<State, Event, StatesCount, EventsCount> Machine;
+
+        struct Status
+        {
+            State state;
+            char ssid[33];
+            char ip[46];
+            int signal;
         };
 
+        WiFi();
+        ~WiFi();
+
+        // Arguments are kept, pass temporaries to move them in
         void init(std::string iface,
                   std::string apSSID,
                   std::string apPassword,
@@ -34,33 +72,89 @@ namespace IoT
         void start();
 
         std::vector<IoT::WifiNetwork> availableNetworks(bool scan = true);
+        // Reuses the buffer, sorted by signal
+        void availableNetworks(std::vector<IoT::WifiNetwork>& networks, bool scan = true);
+        // Only what the query asks for, grouping and top K avoid sorting duplicates
+        void availableNetworks(std::vector<IoT::WifiNetwork>& networks, const ScanQuery& query, bool scan = true);
+        // Looks for known networks only, finds hidden ones too
+        std::vector<IoT::WifiNetwork> scanFor(const std::vector<std::string>& ssids);
+        // Streams networks without collecting them, in scan order
+        void forEachNetwork(const std::function<void(const IoT::WifiNetwork&)>& visitor, bool scan = true);
 
-        void tryConnect(std::string ssid,
-                        std::string password);
+        void tryConnect(const std::string& ssid,
+                        const std::string& password);
 
-        bool connectToNetwork(std::string uuid);
+        bool connectToNetwork(const std::string& uuid);
+
+        void setRoamingPolicy(const RoamingPolicy& policy);
+        void setHotspotChannel(Channel channel);
+        // Remembers interface and profiles between reboots, must be called before init
+        bool setStateCache(const std::string& path);
+        void setConnectivityCheck(const ConnectivityConfig& config);
+        void setReconnectPolicy(const ReconnectPolicy& policy);
+        // Spares flash from profiles of failed attempts, see NetworkManager::setVolatileProfiles
+        void setVolatileProfiles(bool enabled);
+        // Switches tracker cadence, scan reuse, power save of new profiles and reconnect policy.
+        // Can be changed at any time, a later setReconnectPolicy overrides the reconnect part
+        void setPowerProfile(PowerProfile profile);
+        PowerProfile powerProfile() const;
+        // Wakeups of the library's threads during the last minute: tracker, GLib dispatch,
+        // reconnect timers and the setup page server
+        unsigned wakeupsPerMinute() const;
+        std::vector<StartupPhase> startupPhases() const;
+        std::vector<ConnectPhase> connectPhases() const;
+        LinkStatistics linkStatistics(std::chrono::seconds window) const;
+        // Built-in setup page with scan list, submitted credentials go to tryConnect
+        bool startProvisioning(unsigned short port = 80);
+        void stopProvisioning();
 
         void onStateChanged(std::function<void(State)> state);
         void updateInternetConnectivity(bool conencted);
 
+        // Consistent view of the status, never blocks. Safe to call from any thread
+        Status snapshot() const;
+
         State state() const;
+        // Accepted transitions, rejected events per state and time spent deciding
+        Machine::Statistics transitionStatistics() const;
         std::string currentSSID() const;
         std::string currentIP() const;
         int wifiSignal() const;
     private:
-        void stateChanged(State newState);
+        void stateChanged(State from, Event event, State to);
         void findAPConnection(bool autoSwitchInAPMode);
+        bool resumeFromCache(const BootState& boot);
+        void rememberStation(const std::string& uuid, const std::string& bssid);
+        std::string stationConnection();
+        // Publishes the AP profile found on the worker to the other threads and updateCache
+        void rememberAP(const std::string& uuid, bool planned);
+        std::string apConnection();
+        void updateCache();
+        // Provisioning scan source, NM's cached list is served while in AP mode
+        void setupPageNetworks(std::vector<IoT::WifiNetwork>& networks);
     private:
         std::function<void(State)> m_onStateChanged;
         std::string m_iface;
         std::string m_apSSID;
         std::string m_apPassword;
+        Channel m_apChannel;
+
+        SeqLock<Status> m_status;
+        BootStateCache m_cache;
+        std::mutex m_cacheMx; // Guards the fields below, they are read off the worker thread
+        std::string m_cachedIface;
         std::string m_apConnectionID;
+        bool m_apPlanned = false; // Profile created from a fresh scan, no need to plan it again
+        std::string m_stationConnectionID;
+        std::string m_stationBSSID;
+        bool m_autoSwitch = true;
+        ReconnectScheduler m_reconnect;
+        std::unique_ptr<ProvisioningServer> m_provisioning;
 
-        std::string m_currentSSID;
-        std::string m_currentIP;
-        int m_signal;
-        State m_state;
+        static const Machine::Table s_transitions;
+        Machine m_machine{s_transitions, Uninitialized};
+        // Resumes from the cache, declared last so it is joined before the members it uses
+        Dispatcher m_worker{4, 1};
     };
 }
 
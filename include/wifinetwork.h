@@ -2,6 +2,7 @@
 #define IOT_WIFI_NETWORK_H
 
 #include <string>
+#include <chrono>
 
 namespace IoT
 {
@@ -17,15 +18,131 @@ namespace IoT
     struct WifiNetwork
     {
         std::string ssid;
+        std::string bssid;
         std::string password;
         Authentication auth;
         bool encrypted = 0;
         int signal = 100;
+        unsigned frequency = 0;
+        unsigned count = 1; // Access points merged into this entry by a grouping scan query
         const bool operator == (const WifiNetwork& wifi)
         {
             return ssid == wifi.ssid && auth == wifi.auth && encrypted == wifi.encrypted;
         }
     };
+
+    struct ScanQuery
+    {
+        bool groupBySSID = false; // One entry per SSID with its strongest access point
+        bool skipHidden = false;  // Empty or all zero SSIDs
+        bool secureOnly = false;  // Drops open and WEP networks
+        size_t limit = 0;         // Strongest ones only, 0 - all
+    };
+
+    enum class Band
+    {
+        Auto,
+        BG,
+        A
+    };
+
+    struct Channel
+    {
+        Band band = Band::Auto;
+        unsigned number = 0; // 0 - pick the least congested one
+    };
+
+    struct ConnectivityConfig
+    {
+        std::string host = "connectivity-check.ubuntu.com"; // Name or IPv4 address
+        unsigned short port = 80;
+        std::string path = "/";
+        int expectedStatus = 204;
+        std::string dnsServer; // Empty - first nameserver from /etc/resolv.conf
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(800);
+        std::chrono::seconds cacheTTL = std::chrono::seconds(10);
+        bool useNetworkManager = true;
+        // Probe leaves through the checked interface, not the default route. Binding needs
+        // CAP_NET_RAW before Linux 5.7
+        bool bindToInterface = true;
+    };
+
+    struct StartupPhase
+    {
+        std::string name;
+        std::chrono::microseconds elapsed; // Since NetworkManager creation
+    };
+
+    struct MetricSummary
+    {
+        double min = 0;
+        double max = 0;
+        double mean = 0;
+        double p50 = 0;
+        double p95 = 0;
+    };
+
+    struct LinkStatistics
+    {
+        size_t samples = 0;
+        double connectedRatio = 0;
+        MetricSummary signal;
+        MetricSummary bitrate; // Kbit/s
+        MetricSummary frequency; // MHz
+    };
+
+    struct ReconnectPolicy
+    {
+        std::chrono::milliseconds initialDelay = std::chrono::milliseconds(1000);
+        std::chrono::milliseconds maxDelay = std::chrono::milliseconds(60000);
+        double multiplier = 2.0;
+        double jitter = 0.2; // +/- part of the delay
+        unsigned maxAttempts = 6; // Then give up, 0 - never
+        unsigned maxConcurrent = 1; // Connections attempted at once
+    };
+
+    struct ReplayReport
+    {
+        size_t events = 0;
+        std::chrono::microseconds recorded = std::chrono::microseconds(0); // Span of the recording
+        std::chrono::microseconds elapsed = std::chrono::microseconds(0); // Time replay took
+    };
+
+    struct DBusCost
+    {
+        size_t messages = 0; // Sent and received
+        size_t calls = 0;    // Method calls sent
+        size_t replies = 0;  // Returns and errors received
+        size_t signals = 0;
+        size_t blocking = 0; // Waits of the calling thread for a reply or completion
+        std::chrono::microseconds elapsed = std::chrono::microseconds(0);
+        std::chrono::microseconds blocked = std::chrono::microseconds(0);
+    };
+
+    // Zero means no limit
+    struct DBusBudget
+    {
+        size_t calls = 0;
+        size_t blocking = 0;
+        std::chrono::milliseconds elapsed = std::chrono::milliseconds(0);
+    };
+
+    struct DBusOperationStats
+    {
+        std::string operation;
+        size_t count = 0;
+        size_t overBudget = 0;
+        DBusCost total;
+        DBusCost worst; // Per field maximum of a single run
+    };
+
+    struct RoamingPolicy
+    {
+        bool enabled = false;
+        int threshold = 15; // Signal gain (in percents) required to roam
+        std::chrono::seconds dwell = std::chrono::seconds(15);
+        std::chrono::seconds holdOff = std::chrono::seconds(60);
+    };
 }
 
 #endif // IOT_WIFI_NETWORK_H
\ No newline at end of file
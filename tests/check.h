@@ -0,0 +1,49 @@
+#ifndef IOT_TESTS_CHECK_H
+#define IOT_TESTS_CHECK_H
+
+// Checks shared by the tests, each of which is a single translation unit
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <thread>
+
+namespace Tests
+{
+    inline int& failures()
+    {
+        static int count = 0;
+        return count;
+    }
+
+    // Polls condition until it holds or the timeout passes
+    inline bool eventually(const std::function<bool()>& condition,
+                           std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!condition()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    // Prints the verdict and returns main's exit code
+    inline int result()
+    {
+        printf("%s\n", failures() == 0 ? "OK" : "FAILED");
+        return failures() == 0 ? 0 : 1;
+    }
+}
+
+// Failures are counted, the test goes on
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            Tests::failures()++; \
+        } \
+    } while (0)
+
+#endif // IOT_TESTS_CHECK_H
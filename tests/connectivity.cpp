@@ -0,0 +1,180 @@
+// ConnectivityChecker probing a local endpoint through the loopback interface
+#include "connectivity.h"
+#include "check.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <netinet/in.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace IoT;
+
+namespace
+{
+    // Answers every request with the status it is given
+    class Endpoint
+    {
+    public:
+        explicit Endpoint(int status)
+            : m_status(status)
+            , m_requests(0)
+            , m_port(0)
+        {
+            m_listen = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_in sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sin_family = AF_INET;
+            sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t len = sizeof(sa);
+            if (m_listen >= 0 && bind(m_listen, (sockaddr*)&sa, sizeof(sa)) == 0 && listen(m_listen, 4) == 0 &&
+                getsockname(m_listen, (sockaddr*)&sa, &len) == 0) {
+                m_port = ntohs(sa.sin_port);
+            }
+            m_thread = std::thread([this]() { serve(); });
+        }
+
+        ~Endpoint()
+        {
+            // Wakes up accept
+            shutdown(m_listen, SHUT_RDWR);
+            m_thread.join();
+            close(m_listen);
+        }
+
+        unsigned short port() const
+        {
+            return m_port;
+        }
+
+        unsigned requests() const
+        {
+            return m_requests;
+        }
+    private:
+        void serve()
+        {
+            while (1) {
+                int fd = accept(m_listen, NULL, NULL);
+                if (fd < 0) {
+                    return;
+                }
+                char buf[512];
+                if (recv(fd, buf, sizeof(buf), 0) > 0) {
+                    m_requests++;
+                    std::string response = "HTTP/1.1 " + std::to_string(m_status) + " Status\r\nContent-Length: 0\r\n\r\n";
+                    send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+                }
+                close(fd);
+            }
+        }
+
+        int m_status;
+        std::atomic<unsigned> m_requests;
+        int m_listen;
+        unsigned short m_port;
+        std::thread m_thread;
+    };
+
+    ConnectivityConfig local(const Endpoint& endpoint)
+    {
+        ConnectivityConfig config;
+        config.host = "127.0.0.1";
+        config.port = endpoint.port();
+        config.useNetworkManager = false;
+        config.bindToInterface = true;
+        config.cacheTTL = std::chrono::seconds(60);
+        return config;
+    }
+
+    // Result of the probe the check started
+    bool probed(ConnectivityChecker& checker, std::atomic<unsigned>& results, const std::string& iface, bool force = false)
+    {
+        unsigned before = results;
+        checker.check(iface, NULL, force);
+        CHECK(Tests::eventually([&]() { return results != before; }));
+        return checker.check(iface, NULL);
+    }
+
+    void available()
+    {
+        Endpoint endpoint(204);
+        CHECK(endpoint.port() != 0);
+        // Outlives the checker, its thread may still report
+        std::atomic<unsigned> results(0);
+        ConnectivityChecker checker;
+        checker.onResult([&results]() { results++; });
+        checker.setConfig(local(endpoint));
+
+        CHECK(probed(checker, results, "lo"));
+        CHECK(endpoint.requests() == 1);
+
+        // Cached until the TTL passes
+        CHECK(checker.check("lo", NULL));
+        CHECK(endpoint.requests() == 1);
+
+        CHECK(probed(checker, results, "lo", true));
+        CHECK(endpoint.requests() == 2);
+    }
+
+    void unexpectedStatus()
+    {
+        Endpoint endpoint(200);
+        std::atomic<unsigned> results(0);
+        ConnectivityChecker checker;
+        checker.onResult([&results]() { results++; });
+        checker.setConfig(local(endpoint));
+
+        CHECK(!probed(checker, results, "lo"));
+        CHECK(endpoint.requests() == 1);
+    }
+
+    void unreachable()
+    {
+        unsigned short port = 0;
+        {
+            Endpoint closed(204);
+            port = closed.port();
+        }
+        std::atomic<unsigned> results(0);
+        ConnectivityChecker checker;
+        checker.onResult([&results]() { results++; });
+        ConnectivityConfig config;
+        config.host = "127.0.0.1";
+        config.port = port;
+        config.useNetworkManager = false;
+        checker.setConfig(config);
+
+        CHECK(!probed(checker, results, "lo"));
+    }
+
+    // Probes leave through the checked interface, one the endpoint isn't reachable on fails
+    void boundToInterface()
+    {
+        Endpoint endpoint(204);
+        std::atomic<unsigned> results(0);
+        ConnectivityChecker checker;
+        checker.onResult([&results]() { results++; });
+        ConnectivityConfig config = local(endpoint);
+        checker.setConfig(config);
+
+        CHECK(!probed(checker, results, "nosuch0"));
+        CHECK(endpoint.requests() == 0);
+
+        config.bindToInterface = false;
+        checker.setConfig(config);
+        CHECK(probed(checker, results, "nosuch0"));
+        CHECK(endpoint.requests() == 1);
+    }
+}
+
+int main()
+{
+    available();
+    unexpectedStatus();
+    unreachable();
+    boundToInterface();
+    return Tests::result();
+}
@@ -0,0 +1,258 @@
+// D-Bus profiling over a private peer to peer connection, the peer answers every call
+#include "networkmanager.h"
+#include "dbusprofiler.h"
+#include "fakenm.h"
+#include "check.h"
+#include <chrono>
+#include <gio/gio.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <thread>
+
+using namespace IoT;
+
+namespace
+{
+    GDBusConnection* s_client = NULL;
+    GDBusConnection* s_server = NULL;
+
+    GDBusMessage* answer(GDBusConnection* connection, GDBusMessage* message, gboolean incoming, gpointer)
+    {
+        if (!incoming || g_dbus_message_get_message_type(message) != G_DBUS_MESSAGE_TYPE_METHOD_CALL) {
+            return message;
+        }
+
+        GDBusMessage* reply = g_dbus_message_new_method_reply(message);
+        g_dbus_connection_send_message(connection, reply, G_DBUS_SEND_MESSAGE_FLAGS_NONE, NULL, NULL);
+        g_object_unref(reply);
+        g_object_unref(message);
+        return NULL;
+    }
+
+    GIOStream* stream(int fd)
+    {
+        GSocket* socket = g_socket_new_from_fd(fd, NULL);
+        GSocketConnection* connection = g_socket_connection_factory_create_connection(socket);
+        g_object_unref(socket);
+        return G_IO_STREAM(connection);
+    }
+
+    bool connectPeers()
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            return false;
+        }
+
+        GIOStream* server = stream(fds[0]);
+        GIOStream* client = stream(fds[1]);
+        gchar* guid = g_dbus_generate_guid();
+        // Both ends authenticate at once
+        std::thread accepting([server, guid]() {
+            s_server = g_dbus_connection_new_sync(server, guid, G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_SERVER,
+                                                  NULL, NULL, NULL);
+        });
+        s_client = g_dbus_connection_new_sync(client, NULL, G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                              NULL, NULL, NULL);
+        accepting.join();
+        g_free(guid);
+        g_object_unref(server);
+        g_object_unref(client);
+        if (s_server == NULL || s_client == NULL) {
+            return false;
+        }
+
+        g_dbus_connection_add_filter(s_server, answer, NULL, NULL);
+        return true;
+    }
+
+    void disconnectPeers()
+    {
+        g_dbus_connection_close_sync(s_client, NULL, NULL);
+        g_object_unref(s_client);
+        g_object_unref(s_server);
+    }
+
+    bool call()
+    {
+        GVariant* reply = g_dbus_connection_call_sync(s_client, NULL, "/", "org.example.Peer", "Ping", NULL, NULL,
+                                                      G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+        if (reply == NULL) {
+            return false;
+        }
+        g_variant_unref(reply);
+        return true;
+    }
+
+    // Reaches the client before the reply of a following call
+    void signal()
+    {
+        g_dbus_connection_emit_signal(s_server, NULL, "/", "org.example.Peer", "Changed", NULL, NULL);
+    }
+
+    const DBusOperationStats* find(const std::vector<DBusOperationStats>& stats, const std::string& operation)
+    {
+        for (const DBusOperationStats& op : stats) {
+            if (op.operation == operation) {
+                return &op;
+            }
+        }
+        return NULL;
+    }
+
+    void countsTraffic()
+    {
+        DBusProfiler profiler;
+        profiler.attach(s_client);
+        CHECK(profiler.isAttached());
+
+        // Outside of a scope, not counted
+        CHECK(call());
+        {
+            DBusProfiler::Scope scope(profiler, "ping");
+            signal();
+            CHECK(call());
+            CHECK(call());
+            {
+                DBusProfiler::Scope nested(profiler, "nested");
+                CHECK(call());
+            }
+        }
+
+        std::vector<DBusOperationStats> stats = profiler.statistics();
+        CHECK(stats.size() == 1);
+        const DBusOperationStats* ping = find(stats, "ping");
+        CHECK(ping != NULL);
+        if (ping != NULL) {
+            CHECK(ping->count == 1);
+            CHECK(ping->overBudget == 0);
+            CHECK(ping->total.calls == 3);
+            CHECK(ping->total.replies == 3);
+            CHECK(ping->total.signals == 1);
+            CHECK(ping->total.messages == 7);
+            CHECK(ping->worst.calls == 3);
+        }
+    }
+
+    void budgets()
+    {
+        DBusProfiler profiler;
+        profiler.attach(s_client);
+        DBusBudget calls;
+        calls.calls = 1;
+        profiler.setBudget("ping", calls);
+        DBusBudget blocking;
+        blocking.blocking = 1;
+        profiler.setBudget("wait", blocking);
+
+        {
+            DBusProfiler::Scope scope(profiler, "ping");
+            CHECK(call());
+        }
+        {
+            DBusProfiler::Scope scope(profiler, "ping");
+            CHECK(call());
+            CHECK(call());
+        }
+        {
+            DBusProfiler::Scope scope(profiler, "wait");
+            for (int i = 0; i < 2; i++) {
+                DBusProfiler::Blocking waiting;
+                CHECK(call());
+            }
+        }
+
+        std::vector<DBusOperationStats> stats = profiler.statistics();
+        const DBusOperationStats* ping = find(stats, "ping");
+        CHECK(ping != NULL);
+        if (ping != NULL) {
+            CHECK(ping->count == 2);
+            CHECK(ping->overBudget == 1);
+            CHECK(ping->total.calls == 3);
+            CHECK(ping->worst.calls == 2);
+        }
+        const DBusOperationStats* wait = find(stats, "wait");
+        CHECK(wait != NULL);
+        if (wait != NULL) {
+            CHECK(wait->overBudget == 1);
+            CHECK(wait->total.blocking == 2);
+        }
+
+        profiler.reset();
+        CHECK(profiler.statistics().empty());
+    }
+
+    void detached()
+    {
+        DBusProfiler profiler;
+        profiler.attach(s_client);
+        profiler.detach();
+        CHECK(!profiler.isAttached());
+        {
+            DBusProfiler::Scope scope(profiler, "ping");
+            CHECK(call());
+        }
+        CHECK(profiler.statistics().empty());
+    }
+
+    // Calls of the fake libnm are mirrored over the peer connection
+    void networkManager()
+    {
+        NetworkManager& nm = NetworkManager::i();
+        Bench::setDBusConnection(s_client);
+        nm.setDBusProfiling(true);
+        // Fake daemon answers after its call latency on the system clock
+        DBusBudget budget;
+        budget.elapsed = std::chrono::milliseconds(1);
+        nm.setDBusBudget("scan", budget);
+
+        nm.scan("wlan0", true);
+        nm.connections();
+
+        std::vector<DBusOperationStats> stats = nm.dbusStatistics();
+        const DBusOperationStats* scan = find(stats, "scan");
+        CHECK(scan != NULL);
+        if (scan != NULL) {
+            CHECK(scan->count == 1);
+            CHECK(scan->total.calls == 1);
+            CHECK(scan->total.replies == 1);
+            CHECK(scan->total.blocking >= 1);
+            CHECK(scan->overBudget == 1);
+        }
+        // Served from the client's cache
+        const DBusOperationStats* connections = find(stats, "connections");
+        CHECK(connections != NULL);
+        if (connections != NULL) {
+            CHECK(connections->count == 1);
+            CHECK(connections->total.calls == 0);
+            CHECK(connections->overBudget == 0);
+        }
+
+        nm.resetDBusStatistics();
+        nm.setDBusProfiling(false);
+        nm.scan("wlan0", true);
+        CHECK(find(nm.dbusStatistics(), "scan") == NULL);
+        Bench::setDBusConnection(NULL);
+    }
+}
+
+int main()
+{
+    Bench::AccessPoint home;
+    home.ssid = "Home";
+    home.password = "secret";
+    Bench::addAccessPoint(home);
+
+    if (!connectPeers()) {
+        fprintf(stderr, "Can't connect the D-Bus peers\n");
+        return 1;
+    }
+
+    countsTraffic();
+    budgets();
+    detached();
+    networkManager();
+
+    disconnectPeers();
+    return Tests::result();
+}
@@ -0,0 +1,173 @@
+// NetworkDaemon and NetworkClient over a socket in a temporary directory. NetworkManager runs on
+// the benchmark's fake libnm, so no NM daemon is needed
+#include "networkdaemon.h"
+#include "networkclient.h"
+#include "networkmanager.h"
+#include "ipc.h"
+#include "check.h"
+#include <chrono>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace IoT;
+
+namespace
+{
+    bool waitForClients(NetworkDaemon& daemon, size_t count)
+    {
+        return Tests::eventually([&daemon, count]() { return daemon.clients() == count; });
+    }
+
+    int rawConnect(const std::string& path)
+    {
+        sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        strncpy(sa.sun_path, path.c_str(), sizeof(sa.sun_path) - 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (sockaddr*)&sa, sizeof(sa)) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    void callsAndSubscription(NetworkDaemon& daemon, const std::string& path)
+    {
+        NetworkClient client;
+        CHECK(client.connect(path));
+        CHECK(waitForClients(daemon, 1));
+
+        std::vector<std::string> devices = client.devices();
+        CHECK(devices.size() == 1 && devices[0] == "wlan0");
+        CHECK(client.subscribe());
+
+        client.disconnect();
+        CHECK(waitForClients(daemon, 0));
+    }
+
+    // Subscription's state can't be sent to a client which stopped reading, the client is dropped
+    // while its remaining requests are still buffered
+    void clientGoneWhileSubscribing(NetworkDaemon& daemon, const std::string& path)
+    {
+        int fd = rawConnect(path);
+        CHECK(fd >= 0);
+        CHECK(waitForClients(daemon, 1));
+
+        shutdown(fd, SHUT_RD);
+        std::string frames;
+        Ipc::encode(Ipc::Fields { "1", "subscribe" }, frames);
+        Ipc::encode(Ipc::Fields { "2", "devices" }, frames);
+        Ipc::encode(Ipc::Fields { "3", "connections" }, frames);
+        CHECK(send(fd, frames.data(), frames.size(), MSG_NOSIGNAL) == (ssize_t)frames.size());
+        CHECK(waitForClients(daemon, 0));
+        close(fd);
+
+        // Daemon keeps serving others
+        NetworkClient client;
+        CHECK(client.connect(path));
+        CHECK(client.devices().size() == 1);
+    }
+
+    // Client dropped by a daemon restart connects again with the same object
+    void reconnectAfterRestart(NetworkDaemon& daemon, const std::string& path)
+    {
+        NetworkClient client;
+        CHECK(client.connect(path));
+        CHECK(waitForClients(daemon, 1));
+
+        daemon.stop();
+        CHECK(Tests::eventually([&client]() { return !client.isConnected(); }));
+
+        CHECK(daemon.start(path));
+        CHECK(client.connect(path));
+        CHECK(client.devices().size() == 1);
+    }
+
+    // Next frame the daemon pushed, false when none came within the timeout
+    bool nextFrame(int fd, std::string& buffer, Ipc::Fields& fields)
+    {
+        bool ok = true;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (!Ipc::decode(buffer, fields, ok)) {
+            pollfd pfd { fd, POLLIN, 0 };
+            if (!ok || std::chrono::steady_clock::now() > deadline || poll(&pfd, 1, 100) < 0) {
+                return false;
+            }
+            char chunk[512];
+            ssize_t got = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (got == 0) {
+                return false;
+            }
+            if (got > 0) {
+                buffer.append(chunk, got);
+            }
+        }
+        return true;
+    }
+
+    // Events signalled while the daemon is stopped aren't kept for clients of its next start
+    void eventsWhileStopped(NetworkDaemon& daemon, const std::string& path)
+    {
+        daemon.stop();
+        NetworkManager& nm = NetworkManager::i();
+        nm.LastConnectResult.set(Result::Timeout);
+        nm.LastConnectResult.set(Result::Unknown);
+        CHECK(daemon.start(path));
+
+        int fd = rawConnect(path);
+        CHECK(fd >= 0);
+        std::string frames;
+        Ipc::encode(Ipc::Fields { "1", "subscribe" }, frames);
+        CHECK(send(fd, frames.data(), frames.size(), MSG_NOSIGNAL) == (ssize_t)frames.size());
+
+        std::string buffer;
+        Ipc::Fields fields;
+        bool subscribed = false;
+        while (!subscribed && nextFrame(fd, buffer, fields)) {
+            subscribed = fields.size() >= 2 && fields[0] == ">" && fields[1] == "1";
+        }
+        CHECK(subscribed);
+
+        // Anything queued meanwhile would be delivered with this one
+        nm.InternetConnectionAvailable.set(!nm.InternetConnectionAvailable.value);
+        bool internet = false;
+        while (!internet && nextFrame(fd, buffer, fields)) {
+            CHECK(fields.size() < 2 || fields[1] != "result");
+            internet = fields.size() >= 2 && fields[1] == "internet";
+        }
+        CHECK(internet);
+        close(fd);
+        CHECK(waitForClients(daemon, 0));
+    }
+}
+
+int main()
+{
+    char dir[] = "/tmp/iotwifi-test-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string path = std::string(dir) + "/daemon.sock";
+
+    NetworkManager::i();
+    // Lives as long as NetworkManager, its signals stay connected
+    NetworkDaemon& daemon = *new NetworkDaemon();
+    CHECK(daemon.start(path));
+
+    callsAndSubscription(daemon, path);
+    clientGoneWhileSubscribing(daemon, path);
+    reconnectAfterRestart(daemon, path);
+    eventsWhileStopped(daemon, path);
+
+    daemon.stop();
+    rmdir(dir);
+
+    return Tests::result();
+}
@@ -0,0 +1,58 @@
+// Power profile switch reaching profiles NM already has, on the benchmark's fake libnm
+#include "networkmanager.h"
+#include "powerprofile.h"
+#include "fakenm.h"
+#include "check.h"
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+
+using namespace IoT;
+using Tests::eventually;
+
+namespace
+{
+    void switchProfiles()
+    {
+        NetworkManager& nm = NetworkManager::i();
+        CHECK(Bench::profilePowerSave("Home") == (int)PowerSave::Default);
+
+        nm.setPowerSettings(PowerSettings::of(PowerProfile::Battery));
+        CHECK(eventually([]() { return Bench::profilePowerSave("Home") == (int)PowerSave::Enable; }));
+        CHECK(eventually([]() { return Bench::profilePowerSave("Office") == (int)PowerSave::Enable; }));
+        // Only the active one is changed on its link
+        CHECK(eventually([]() { return Bench::reapplies() == 1; }));
+
+        nm.setPowerSettings(PowerSettings::of(PowerProfile::LowLatency));
+        CHECK(eventually([]() { return Bench::profilePowerSave("Home") == (int)PowerSave::Disable; }));
+        CHECK(eventually([]() { return Bench::reapplies() == 2; }));
+
+        // Same power save, nothing to write
+        PowerSettings settings = PowerSettings::of(PowerProfile::LowLatency);
+        settings.trackPeriod = std::chrono::milliseconds(2000);
+        nm.setPowerSettings(settings);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        CHECK(Bench::reapplies() == 2);
+    }
+
+    void wakeups()
+    {
+        // Dispatch thread woke at least for the replies above
+        CHECK(NetworkManager::i().wakeupsPerMinute() > 0);
+    }
+}
+
+int main()
+{
+    Bench::AccessPoint home;
+    home.ssid = "Home";
+    home.password = "secret";
+    Bench::addAccessPoint(home);
+    Bench::addProfile("Home", "secret", true);
+    Bench::addProfile("Office", "secret", false);
+
+    switchProfiles();
+    wakeups();
+
+    return Tests::result();
+}
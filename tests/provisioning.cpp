@@ -0,0 +1,170 @@
+// ProvisioningServer answering real HTTP requests on localhost
+#include "provisioning.h"
+#include "check.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace IoT;
+
+namespace
+{
+    int connectTo(unsigned short port)
+    {
+        sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (sockaddr*)&sa, sizeof(sa)) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Reads until the server closes or responses stop coming for a while
+    std::string exchange(int fd, const std::string& request)
+    {
+        std::string response;
+        if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size()) {
+            return response;
+        }
+
+        pollfd pfd { fd, POLLIN, 0 };
+        char buffer[4096];
+        while (poll(&pfd, 1, 500) > 0) {
+            ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+            if (got <= 0) {
+                break;
+            }
+            response.append(buffer, got);
+        }
+        return response;
+    }
+
+    std::string request(unsigned short port, const std::string& text)
+    {
+        int fd = connectTo(port);
+        if (fd < 0) {
+            return std::string();
+        }
+        std::string response = exchange(fd, text);
+        close(fd);
+        return response;
+    }
+
+    bool contains(const std::string& text, const std::string& part)
+    {
+        return text.find(part) != std::string::npos;
+    }
+
+    void pages(ProvisioningServer& server)
+    {
+        std::string page = request(server.port(), "GET / HTTP/1.0\r\n\r\n");
+        CHECK(contains(page, "HTTP/1.1 200 OK"));
+        CHECK(contains(page, "<form"));
+
+        CHECK(contains(request(server.port(), "GET /missing HTTP/1.0\r\n\r\n"), "HTTP/1.1 404"));
+        CHECK(contains(request(server.port(), "garbage\r\n\r\n"), "HTTP/1.1 400"));
+    }
+
+    void networkList(ProvisioningServer& server)
+    {
+        WifiNetwork network;
+        network.ssid = "Home \"5G\"";
+        network.signal = 70;
+        network.encrypted = true;
+        network.auth = Authentication::WPA2;
+        std::vector<WifiNetwork> networks(1, network);
+
+        size_t rebuilds = server.rebuilds();
+        server.setNetworks(networks);
+        server.setNetworks(networks);
+        CHECK(server.rebuilds() == rebuilds + 1);
+
+        std::string list = request(server.port(), "GET /networks HTTP/1.0\r\n\r\n");
+        CHECK(contains(list, "application/json"));
+        CHECK(contains(list, "\"ssid\":\"Home \\\"5G\\\"\""));
+        CHECK(contains(list, "\"auth\":\"wpa2\""));
+    }
+
+    void keepAlive(ProvisioningServer& server)
+    {
+        int fd = connectTo(server.port());
+        CHECK(fd >= 0);
+        std::string responses = exchange(fd, "GET /networks HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n");
+        close(fd);
+        CHECK(contains(responses, "application/json"));
+        CHECK(contains(responses, "text/html"));
+    }
+
+    void credentials(ProvisioningServer& server)
+    {
+        std::mutex mx;
+        std::condition_variable cv;
+        std::string ssid, password;
+        server.onCredentials([&](const std::string& s, const std::string& p) {
+            std::lock_guard<std::mutex> lock(mx);
+            ssid = s;
+            password = p;
+            cv.notify_all();
+        });
+
+        std::string body = "ssid=My+Net&password=p%40ss";
+        std::string response = request(server.port(), "POST /connect HTTP/1.0\r\nContent-Length: " +
+                                       std::to_string(body.size()) + "\r\n\r\n" + body);
+        CHECK(contains(response, "HTTP/1.1 202"));
+        {
+            std::unique_lock<std::mutex> lock(mx);
+            cv.wait_for(lock, std::chrono::seconds(2), [&]() { return !ssid.empty(); });
+            CHECK(ssid == "My Net");
+            CHECK(password == "p@ss");
+        }
+
+        CHECK(contains(request(server.port(), "POST /connect HTTP/1.0\r\nContent-Length: 6\r\n\r\nssid=&"), "HTTP/1.1 400"));
+        server.onCredentials(ProvisioningServer::CredentialsHandler());
+    }
+
+    // Stale list is served while the scan source runs in the background
+    void backgroundScan(ProvisioningServer& server)
+    {
+        size_t rebuilds = server.rebuilds();
+        server.setScanSource([](std::vector<WifiNetwork>& networks) {
+            WifiNetwork network;
+            network.ssid = "Scanned";
+            networks.assign(1, network);
+        }, std::chrono::seconds(0));
+
+        CHECK(contains(request(server.port(), "GET /networks HTTP/1.0\r\n\r\n"), "200 OK"));
+        Tests::eventually([&server, rebuilds]() { return server.rebuilds() != rebuilds; }, std::chrono::milliseconds(2000));
+        CHECK(contains(request(server.port(), "GET /networks HTTP/1.0\r\n\r\n"), "\"ssid\":\"Scanned\""));
+    }
+}
+
+int main()
+{
+    ProvisioningServer server;
+    CHECK(server.start(0, "127.0.0.1"));
+    CHECK(server.port() != 0);
+
+    pages(server);
+    networkList(server);
+    keepAlive(server);
+    credentials(server);
+    backgroundScan(server);
+
+    server.stop();
+    CHECK(!server.isRunning());
+
+    return Tests::result();
+}
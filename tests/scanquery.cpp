@@ -0,0 +1,138 @@
+// ScanAggregator: filtering, grouping by SSID, top K and reuse of the output list
+#include "scanquery.h"
+#include "allocations.h"
+#include "check.h"
+#include <string>
+#include <vector>
+
+using namespace IoT;
+
+namespace
+{
+    WifiNetwork network(const std::string& ssid, int signal, Authentication auth = Authentication::WPA2,
+                        const std::string& bssid = std::string())
+    {
+        WifiNetwork wifi;
+        wifi.ssid = ssid;
+        wifi.bssid = bssid;
+        wifi.auth = auth;
+        wifi.encrypted = auth != Authentication::None;
+        wifi.signal = signal;
+        return wifi;
+    }
+
+    void run(const ScanQuery& query, const std::vector<WifiNetwork>& visited, std::vector<WifiNetwork>& networks)
+    {
+        ScanAggregator aggregator(query, networks);
+        for (const WifiNetwork& wifi : visited) {
+            aggregator.add(wifi);
+        }
+        aggregator.finish();
+    }
+
+    void ordersBySignal()
+    {
+        std::vector<WifiNetwork> visited = { network("A", 30), network("B", 90), network("C", 60) };
+        std::vector<WifiNetwork> networks;
+        run(ScanQuery(), visited, networks);
+        CHECK(networks.size() == 3);
+        if (networks.size() == 3) {
+            CHECK(networks[0].ssid == "B" && networks[1].ssid == "C" && networks[2].ssid == "A");
+            CHECK(networks[0].count == 1);
+        }
+    }
+
+    void groupsBySSID()
+    {
+        std::vector<WifiNetwork> visited = {
+            network("Home", 40, Authentication::WPA2, "00:00:00:00:00:01"),
+            network("Home", 80, Authentication::WPA2, "00:00:00:00:00:02"),
+            network("Cafe", 50),
+            network("Home", 60, Authentication::WPA2, "00:00:00:00:00:03"),
+        };
+        ScanQuery query;
+        query.groupBySSID = true;
+        std::vector<WifiNetwork> networks;
+        run(query, visited, networks);
+        CHECK(networks.size() == 2);
+        if (networks.size() == 2) {
+            CHECK(networks[0].ssid == "Home");
+            CHECK(networks[0].signal == 80);
+            CHECK(networks[0].bssid == "00:00:00:00:00:02");
+            CHECK(networks[0].count == 3);
+            CHECK(networks[1].ssid == "Cafe" && networks[1].count == 1);
+        }
+    }
+
+    void filters()
+    {
+        std::vector<WifiNetwork> visited = {
+            network("", 90),
+            network(std::string(3, '\0'), 90),
+            network("Open", 80, Authentication::None),
+            network("Legacy", 70, Authentication::WEP),
+            network("Secure", 60),
+        };
+
+        ScanQuery hidden;
+        hidden.skipHidden = true;
+        std::vector<WifiNetwork> networks;
+        run(hidden, visited, networks);
+        CHECK(networks.size() == 3);
+
+        ScanQuery secure;
+        secure.skipHidden = true;
+        secure.secureOnly = true;
+        run(secure, visited, networks);
+        CHECK(networks.size() == 1);
+        CHECK(!networks.empty() && networks[0].ssid == "Secure");
+    }
+
+    void limit()
+    {
+        std::vector<WifiNetwork> visited;
+        for (int i = 0; i < 8; i++) {
+            visited.push_back(network("Net" + std::to_string(i), 10 * (i + 1)));
+        }
+        ScanQuery query;
+        query.limit = 2;
+        std::vector<WifiNetwork> networks;
+        run(query, visited, networks);
+        CHECK(networks.size() == 2);
+        if (networks.size() == 2) {
+            CHECK(networks[0].ssid == "Net7" && networks[1].ssid == "Net6");
+        }
+
+        // Limit above the number of networks keeps them all
+        query.limit = 20;
+        run(query, visited, networks);
+        CHECK(networks.size() == 8);
+    }
+
+    // Elements left from the previous run are overwritten, the list doesn't grow again
+    void reusesOutput()
+    {
+        std::vector<WifiNetwork> visited = { network("A", 30), network("B", 90), network("C", 60) };
+        std::vector<WifiNetwork> networks(5, network("Stale", 100));
+        ScanQuery query;
+        query.secureOnly = true;
+        run(query, visited, networks);
+        CHECK(networks.size() == 3);
+        CHECK(!networks.empty() && networks[0].ssid == "B");
+
+        size_t before = Bench::allocations();
+        run(query, visited, networks);
+        CHECK(Bench::allocations() == before);
+        CHECK(networks.size() == 3);
+    }
+}
+
+int main()
+{
+    ordersBySignal();
+    groupsBySSID();
+    filters();
+    limit();
+    reusesOutput();
+    return Tests::result();
+}
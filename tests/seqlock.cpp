@@ -0,0 +1,122 @@
+// SeqLock: readers see whole values only, never a mix of two writes
+#include "seqlock.h"
+#include "check.h"
+#include <atomic>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+using namespace IoT;
+
+namespace
+{
+    // Spans several words and ends in a partial one
+    struct Sample
+    {
+        uint32_t serial;
+        uint32_t copies[8];
+        uint8_t tail[3];
+    };
+
+    Sample sample(uint32_t serial)
+    {
+        Sample s;
+        s.serial = serial;
+        for (uint32_t& copy : s.copies) {
+            copy = serial;
+        }
+        for (uint8_t& byte : s.tail) {
+            byte = (uint8_t)serial;
+        }
+        return s;
+    }
+
+    bool whole(const Sample& s)
+    {
+        for (uint32_t copy : s.copies) {
+            if (copy != s.serial) {
+                return false;
+            }
+        }
+        for (uint8_t byte : s.tail) {
+            if (byte != (uint8_t)s.serial) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void storeAndUpdate()
+    {
+        SeqLock<Sample> lock;
+        Sample initial = lock.load();
+        CHECK(initial.serial == 0 && whole(initial));
+
+        lock.store(sample(7));
+        CHECK(lock.load().serial == 7);
+        CHECK(whole(lock.load()));
+
+        Sample updated = lock.update([](Sample& s) {
+            s = sample(s.serial + 1);
+        });
+        CHECK(updated.serial == 8);
+        CHECK(lock.load().serial == 8);
+        CHECK(whole(lock.load()));
+    }
+
+    // Readers run against a writer and an updater, every value they get must be one that was written
+    void concurrentReaders()
+    {
+        SeqLock<Sample> lock;
+        std::atomic<bool> stop(false);
+        std::atomic<unsigned> torn(0);
+        std::atomic<unsigned> backwards(0);
+        std::atomic<unsigned long> reads(0);
+
+        std::vector<std::thread> readers;
+        for (int r = 0; r < 3; r++) {
+            readers.push_back(std::thread([&]() {
+                uint32_t last = 0;
+                while (!stop) {
+                    Sample s = lock.load();
+                    if (!whole(s)) {
+                        torn++;
+                    }
+                    if (s.serial < last) {
+                        backwards++;
+                    }
+                    last = s.serial;
+                    reads++;
+                }
+            }));
+        }
+
+        const uint32_t Writes = 200000;
+        std::thread writer([&]() {
+            for (uint32_t i = 1; i <= Writes; i++) {
+                if (i % 2 == 0) {
+                    lock.store(sample(i));
+                } else {
+                    lock.update([i](Sample& s) { s = sample(i); });
+                }
+            }
+        });
+        writer.join();
+        stop = true;
+        for (std::thread& reader : readers) {
+            reader.join();
+        }
+
+        CHECK(torn == 0);
+        CHECK(backwards == 0);
+        CHECK(reads > 0);
+        CHECK(lock.load().serial == Writes);
+    }
+}
+
+int main()
+{
+    storeAndUpdate();
+    concurrentReaders();
+    return Tests::result();
+}
@@ -0,0 +1,139 @@
+// StateMachine: table lookups, guard, listener ordering and statistics
+#include "statemachine.h"
+#include "check.h"
+#include <thread>
+#include <vector>
+
+using namespace IoT;
+
+namespace
+{
+    enum State { Idle, Running, Done, StatesCount };
+    enum Event { Start, Stop, Finish, EventsCount };
+
+    typedef StateMachine<State, Event, StatesCount, EventsCount> Machine;
+
+    const Machine::Table Transitions = {
+        //  Start             Stop              Finish
+        { Running,          Machine::Invalid, Machine::Invalid }, // Idle
+        { Running,          Idle,             Done             }, // Running
+        { Machine::Invalid, Machine::Invalid, Machine::Invalid }, // Done
+    };
+
+    struct Transition
+    {
+        State from;
+        Event event;
+        State to;
+    };
+
+    void tableAndStatistics()
+    {
+        Machine machine(Transitions, Idle);
+        machine.post(Stop);
+        CHECK(machine.state() == Idle);
+
+        machine.post(Start);
+        CHECK(machine.state() == Running);
+        // Same state again, counted but not reported
+        machine.post(Start);
+        machine.post(Finish);
+        CHECK(machine.state() == Done);
+        machine.post(Start);
+        CHECK(machine.state() == Done);
+
+        Machine::Statistics stats = machine.statistics();
+        CHECK(stats.events == 5);
+        CHECK(stats.transitions == 3);
+        CHECK(stats.rejected[Idle][Stop] == 1);
+        CHECK(stats.rejected[Done][Start] == 1);
+    }
+
+    void listenerOrder()
+    {
+        Machine machine(Transitions, Idle);
+        std::vector<Transition> seen;
+        int depth = 0;
+        bool nested = false;
+        machine.setListener([&](State from, Event event, State to) {
+            nested = nested || depth != 0;
+            depth++;
+            seen.push_back(Transition { from, event, to });
+            if (to == Running) {
+                // Queued, handled once this listener returned
+                machine.post(Start);
+                machine.post(Finish);
+                CHECK(machine.state() == Running);
+            }
+            depth--;
+        });
+
+        machine.post(Start);
+        CHECK(!nested);
+        CHECK(machine.state() == Done);
+        CHECK(seen.size() == 2);
+        if (seen.size() == 2) {
+            CHECK(seen[0].from == Idle && seen[0].event == Start && seen[0].to == Running);
+            CHECK(seen[1].from == Running && seen[1].event == Finish && seen[1].to == Done);
+        }
+        CHECK(machine.statistics().transitions == 3);
+    }
+
+    void guard()
+    {
+        Machine machine(Transitions, Idle);
+        bool allowed = false;
+        unsigned asked = 0;
+        machine.setGuard([&](State from, Event event) {
+            asked++;
+            return event != Start || allowed;
+        });
+
+        machine.post(Start);
+        CHECK(machine.state() == Idle);
+        CHECK(machine.statistics().rejected[Idle][Start] == 1);
+
+        allowed = true;
+        machine.post(Start);
+        CHECK(machine.state() == Running);
+        // Invalid transitions don't reach the guard
+        machine.post(Stop);
+        machine.post(Stop);
+        CHECK(machine.state() == Idle);
+        CHECK(asked == 3);
+    }
+
+    // Every event is handled exactly once whichever thread posts it
+    void concurrentPosting()
+    {
+        Machine machine(Transitions, Idle);
+        const int Threads = 4;
+        const int Posts = 10000;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < Threads; t++) {
+            threads.push_back(std::thread([&machine, t]() {
+                for (int i = 0; i < Posts; i++) {
+                    machine.post((i + t) % 2 == 0 ? Start : Stop);
+                }
+            }));
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        Machine::Statistics stats = machine.statistics();
+        uint64_t rejected = stats.rejected[Idle][Stop];
+        CHECK(stats.events == (uint64_t)Threads * Posts);
+        CHECK(stats.transitions + rejected == stats.events);
+        CHECK(machine.state() == Idle || machine.state() == Running);
+    }
+}
+
+int main()
+{
+    tableAndStatistics();
+    listenerOrder();
+    guard();
+    concurrentPosting();
+    return Tests::result();
+}
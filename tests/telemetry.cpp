@@ -0,0 +1,109 @@
+// LinkTelemetry on a virtual clock: ring buffer, time window and summaries
+#include "telemetry.h"
+#include "clock.h"
+#include "allocations.h"
+#include "check.h"
+#include <chrono>
+#include <string>
+
+using namespace IoT;
+
+namespace
+{
+    const std::string Iface = "wlan0";
+
+    // Sample i is taken i seconds after start with signal 10 * (i + 1), the even ones connected
+    void recordSeconds(LinkTelemetry& telemetry, VirtualClock& clock, int count)
+    {
+        for (int i = 0; i < count; i++) {
+            if (i != 0) {
+                clock.advance(std::chrono::seconds(1));
+            }
+            LinkSample sample;
+            sample.time = clock.now();
+            sample.signal = 10 * (i + 1);
+            sample.bitrate = 1000 * (i + 1);
+            sample.frequency = 2412;
+            sample.status = i % 2 == 0 ? ConnectionStatus::Connected : ConnectionStatus::Disconnected;
+            telemetry.record(Iface, sample);
+        }
+    }
+
+    void summaries(VirtualClock& clock)
+    {
+        LinkTelemetry telemetry;
+        CHECK(telemetry.query(Iface, std::chrono::seconds(60)).samples == 0);
+
+        recordSeconds(telemetry, clock, 10);
+        LinkStatistics stats = telemetry.query(Iface, std::chrono::seconds(60));
+        CHECK(stats.samples == 10);
+        CHECK(stats.connectedRatio == 0.5);
+        CHECK(stats.signal.min == 10);
+        CHECK(stats.signal.max == 100);
+        CHECK(stats.signal.mean == 55);
+        CHECK(stats.signal.p50 == 50);
+        CHECK(stats.signal.p95 == 90);
+        CHECK(stats.bitrate.max == 10000);
+        CHECK(stats.frequency.min == 2412 && stats.frequency.max == 2412);
+        CHECK(telemetry.query("wlan1", std::chrono::seconds(60)).samples == 0);
+    }
+
+    void window(VirtualClock& clock)
+    {
+        LinkTelemetry telemetry;
+        recordSeconds(telemetry, clock, 10);
+
+        // Samples taken 0 to 4 seconds ago
+        LinkStatistics stats = telemetry.query(Iface, std::chrono::seconds(4));
+        CHECK(stats.samples == 5);
+        CHECK(stats.signal.min == 60);
+        CHECK(stats.signal.max == 100);
+
+        clock.advance(std::chrono::seconds(30));
+        CHECK(telemetry.query(Iface, std::chrono::seconds(4)).samples == 0);
+    }
+
+    void wrapAround(VirtualClock& clock)
+    {
+        LinkTelemetry telemetry;
+        telemetry.configure(4, std::chrono::milliseconds(1000));
+        CHECK(telemetry.period() == std::chrono::milliseconds(1000));
+        recordSeconds(telemetry, clock, 10);
+
+        // Oldest ones are overwritten
+        LinkStatistics stats = telemetry.query(Iface, std::chrono::seconds(60));
+        CHECK(stats.samples == 4);
+        CHECK(stats.signal.min == 70);
+        CHECK(stats.signal.max == 100);
+
+        telemetry.configure(4, std::chrono::milliseconds(1000));
+        CHECK(telemetry.query(Iface, std::chrono::seconds(60)).samples == 0);
+    }
+
+    void noAllocations(VirtualClock& clock)
+    {
+        LinkTelemetry telemetry;
+        telemetry.configure(16, std::chrono::milliseconds(1000));
+        recordSeconds(telemetry, clock, 1);
+
+        size_t before = Bench::allocations();
+        recordSeconds(telemetry, clock, 40);
+        LinkStatistics stats = telemetry.query(Iface, std::chrono::seconds(60));
+        CHECK(Bench::allocations() == before);
+        CHECK(stats.samples == 16);
+    }
+}
+
+int main()
+{
+    VirtualClock clock;
+    Clock::setInstance(&clock);
+
+    summaries(clock);
+    window(clock);
+    wrapAround(clock);
+    noAllocations(clock);
+
+    Clock::setInstance(NULL);
+    return Tests::result();
+}
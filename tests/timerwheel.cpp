@@ -0,0 +1,112 @@
+// TimerWheel on a virtual clock: timers expire on their tick and the thread wakes only for them
+#include "timerwheel.h"
+#include "clock.h"
+#include "check.h"
+#include <atomic>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+using namespace IoT;
+using Tests::eventually;
+
+namespace
+{
+    const auto Resolution = std::chrono::milliseconds(250);
+
+    // Jumps to each deadline the wheel's thread sleeps towards until nothing is pending, returns
+    // how many times time had to move
+    unsigned drain(VirtualClock& clock, TimerWheel& wheel)
+    {
+        unsigned wakeups = 0;
+        while (wheel.pending() != 0 && eventually([&]() { return clock.waiting() != 0; })) {
+            auto before = clock.now();
+            clock.advanceToNext(std::chrono::hours(24));
+            if (clock.now() != before) {
+                wakeups++;
+            }
+        }
+        return wakeups;
+    }
+
+    long long since(VirtualClock& clock, Clock::TimePoint start)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(clock.now() - start).count();
+    }
+
+    void expiry(VirtualClock& clock)
+    {
+        TimerWheel wheel(Resolution);
+        auto start = clock.now();
+        const long long delays[] = { 250, 1000, 16000, 60000, 1100000, 5000000 };
+        std::vector<std::atomic<long long>> fired(6);
+        for (size_t i = 0; i < 6; ++i) {
+            fired[i] = -1;
+            wheel.schedule(std::chrono::milliseconds(delays[i]), [&, i]() { fired[i] = since(clock, start); });
+        }
+        CHECK(wheel.pending() == 6);
+
+        // Every timer and every cascade of the far ones may wake it, but not each tick
+        unsigned wakeups = drain(clock, wheel);
+        CHECK(wakeups < 20);
+        CHECK(eventually([&]() { return fired[5] != -1; }));
+        for (size_t i = 0; i < 6; ++i) {
+            CHECK(fired[i] == delays[i]);
+        }
+    }
+
+    void backoffWakeups(VirtualClock& clock)
+    {
+        TimerWheel wheel(Resolution);
+        std::atomic<bool> fired(false);
+        wheel.schedule(std::chrono::seconds(60), [&]() { fired = true; });
+        CHECK(drain(clock, wheel) <= 2);
+        CHECK(eventually([&]() { return fired.load(); }));
+    }
+
+    // Timer added while the thread sleeps towards a later one counts from now, not from its last wakeup
+    void scheduleWhileSleeping(VirtualClock& clock)
+    {
+        TimerWheel wheel(Resolution);
+        auto start = clock.now();
+        std::atomic<long long> late(-1), early(-1);
+        wheel.schedule(std::chrono::seconds(60), [&]() { late = since(clock, start); });
+        CHECK(eventually([&]() { return clock.waiting() != 0; }));
+        clock.advance(std::chrono::seconds(30));
+        wheel.schedule(std::chrono::seconds(5), [&]() { early = since(clock, start); });
+        // Lets the thread trade the deadline it sleeps towards for the new one before time jumps
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        drain(clock, wheel);
+        CHECK(eventually([&]() { return late != -1; }));
+        CHECK(early == 35000);
+        CHECK(late == 60000);
+    }
+
+    void cancel(VirtualClock& clock)
+    {
+        TimerWheel wheel(Resolution);
+        std::atomic<bool> fired(false);
+        TimerWheel::TimerId id = wheel.schedule(std::chrono::seconds(1), [&]() { fired = true; });
+        CHECK(wheel.cancel(id));
+        CHECK(!wheel.cancel(id));
+        CHECK(wheel.pending() == 0);
+        clock.advance(std::chrono::seconds(2));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(!fired);
+    }
+}
+
+int main()
+{
+    VirtualClock clock;
+    Clock::setInstance(&clock);
+
+    expiry(clock);
+    backoffWakeups(clock);
+    scheduleWhileSleeping(clock);
+    cancel(clock);
+
+    Clock::setInstance(NULL);
+    return Tests::result();
+}